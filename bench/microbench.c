@@ -0,0 +1,728 @@
+/*
+ * Cozmonaut
+ * Copyright 2019 The Cozmonaut Contributors
+ */
+
+//
+// Microbenchmarks
+//
+// These time the primitives every frame (or every line of output) goes
+// through, one at a time and in isolation, so a regression in any of them
+// shows up as a number rather than as a vague slowdown of the whole pipeline.
+//
+// Each case is run in batches: the batch size is doubled until a batch takes
+// long enough to time accurately, then a fixed number of batches is timed and
+// summarized by the median and the spread around it. The median is what to
+// compare between builds; the spread says how far to trust it. Pin the process
+// to one core (-c) for the steadiest numbers.
+//
+// Results are written one JSON object per line (to stdout, or the -o file),
+// and a readable table goes to stderr. Standard output is otherwise sent to
+// /dev/null while the benchmarks run, as that is where the log goes.
+//
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// The tracker is compiled in whole, so its private functions can be timed
+#include "tracker.c"
+
+#include "cozmo_image.h"
+#include "framepool.h"
+#include "linebuf.h"
+#include "log.h"
+#include "registry.h"
+
+/** The most samples per case. */
+#define MICROBENCH__MAX_SAMPLES 1000
+
+/** A benchmark body. Runs the operation a number of times. */
+typedef void (* microbench__fn)(void* arg, unsigned long iters);
+
+/** A benchmark hook, run untimed around the batches of a case. */
+typedef void (* microbench__hook)(void* arg);
+
+/** A benchmark case. */
+struct microbench__case {
+  /** The case name. */
+  const char* name;
+
+  /** The benchmark body. */
+  microbench__fn fn;
+
+  /** The argument for the body and hooks. */
+  void* arg;
+
+  /** Run before the case (nullable). */
+  microbench__hook setup;
+
+  /** Run before each batch (nullable). */
+  microbench__hook reset;
+
+  /** Run after the case (nullable). */
+  microbench__hook teardown;
+
+  /** The number of bytes each operation moves (zero if not meaningful). */
+  size_t bytes;
+};
+
+/** The benchmark options. */
+struct microbench__options {
+  /** The number of timed batches per case. */
+  int samples;
+
+  /** The minimum batch time in nanoseconds. */
+  unsigned long long min_batch_ns;
+
+  /** Only run cases whose names contain this (nullable). */
+  const char* filter;
+
+  /** The results file. */
+  FILE* out;
+};
+
+/** A file descriptor on /dev/null. */
+static int microbench__null_fd = -1;
+
+/** Keeps the compiler from optimizing away the results of a benchmark body. */
+static volatile unsigned long microbench__sink;
+
+/**
+ * Get the monotonic time.
+ *
+ * @return The time in nanoseconds
+ */
+static unsigned long long microbench__now() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (unsigned long long) now.tv_sec * 1000000000ULL + (unsigned long long) now.tv_nsec;
+}
+
+/**
+ * Time one batch.
+ *
+ * @param c The case
+ * @param iters The batch size
+ * @return The batch time in nanoseconds
+ */
+static unsigned long long microbench__batch(const struct microbench__case* c, unsigned long iters) {
+  if (c->reset) {
+    c->reset(c->arg);
+  }
+
+  unsigned long long start = microbench__now();
+  c->fn(c->arg, iters);
+  return microbench__now() - start;
+}
+
+/** Compare two doubles for qsort(). */
+static int microbench__compare(const void* a, const void* b) {
+  double x = *(const double*) a;
+  double y = *(const double*) b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * Pick a percentile out of sorted values.
+ *
+ * @param sorted The sorted values
+ * @param num The number of values
+ * @param p The percentile (0 to 1)
+ * @return The value
+ */
+static double microbench__percentile(const double* sorted, int num, double p) {
+  double pos = p * (num - 1);
+  int lo = (int) pos;
+  int hi = lo + 1 < num ? lo + 1 : lo;
+  return sorted[lo] + (sorted[hi] - sorted[lo]) * (pos - lo);
+}
+
+/**
+ * Run a case and write out its results.
+ *
+ * @param c The case
+ * @param opts The options
+ */
+static void microbench__run(const struct microbench__case* c, const struct microbench__options* opts) {
+  if (c->setup) {
+    c->setup(c->arg);
+  }
+
+  // Grow the batch until it takes long enough to time well
+  // This doubles as the warm-up
+  unsigned long iters = 1;
+  while (microbench__batch(c, iters) < opts->min_batch_ns && iters < (1UL << 40)) {
+    iters *= 2;
+  }
+
+  // Time the batches
+  double ns[MICROBENCH__MAX_SAMPLES];
+  for (int i = 0; i < opts->samples; ++i) {
+    ns[i] = (double) microbench__batch(c, iters) / (double) iters;
+  }
+
+  if (c->teardown) {
+    c->teardown(c->arg);
+  }
+
+  // Summarize by the median and the median absolute deviation around it
+  qsort(ns, (size_t) opts->samples, sizeof(double), &microbench__compare);
+  double median = microbench__percentile(ns, opts->samples, 0.5);
+
+  double dev[MICROBENCH__MAX_SAMPLES];
+  for (int i = 0; i < opts->samples; ++i) {
+    dev[i] = ns[i] > median ? ns[i] - median : median - ns[i];
+  }
+  qsort(dev, (size_t) opts->samples, sizeof(double), &microbench__compare);
+  double mad = microbench__percentile(dev, opts->samples, 0.5);
+
+  double p10 = microbench__percentile(ns, opts->samples, 0.1);
+  double p90 = microbench__percentile(ns, opts->samples, 0.9);
+
+  fprintf(opts->out,
+    "{\"name\":\"%s\",\"ns_per_op\":%.3f,\"min\":%.3f,\"p10\":%.3f,\"p90\":%.3f,\"mad\":%.3f,"
+    "\"iters\":%lu,\"samples\":%d,\"bytes_per_op\":%lu}\n",
+    c->name, median, ns[0], p10, p90, mad, iters, opts->samples, (unsigned long) c->bytes);
+  fflush(opts->out);
+
+  if (c->bytes) {
+    fprintf(stderr, "%-36s %12.1f ns/op  +/- %5.1f%%  %8.2f GB/s\n", c->name, median,
+      median > 0 ? 100 * mad / median : 0, (double) c->bytes / median);
+  } else {
+    fprintf(stderr, "%-36s %12.1f ns/op  +/- %5.1f%%\n", c->name, median, median > 0 ? 100 * mad / median : 0);
+  }
+}
+
+//
+// Logging
+//
+
+/** The log sinks. */
+enum microbench__log_sink {
+  /** Log to /dev/null (formatting and the write call only). */
+  microbench__sink_null,
+
+  /** Log to a regular file (adds the page cache). */
+  microbench__sink_file,
+};
+
+/** A log benchmark. */
+struct microbench__log {
+  /** The log sink. */
+  enum microbench__log_sink sink;
+
+  /** The sink file (for the file sink). */
+  int fd;
+};
+
+static void microbench__log_setup(void* arg) {
+  struct microbench__log* self = arg;
+
+  if (self->sink == microbench__sink_file) {
+    char path[] = "/tmp/cozmo_microbench_XXXXXX";
+    self->fd = mkstemp(path);
+    unlink(path);
+
+    fflush(stdout);
+    dup2(self->fd, STDOUT_FILENO);
+  }
+}
+
+static void microbench__log_reset(void* arg) {
+  struct microbench__log* self = arg;
+
+  // Keep the file from growing without bound
+  if (self->sink == microbench__sink_file) {
+    fflush(stdout);
+    ftruncate(self->fd, 0);
+    lseek(STDOUT_FILENO, 0, SEEK_SET);
+  }
+}
+
+static void microbench__log_teardown(void* arg) {
+  struct microbench__log* self = arg;
+
+  fflush(stdout);
+
+  if (self->sink == microbench__sink_file) {
+    dup2(microbench__null_fd, STDOUT_FILENO);
+    close(self->fd);
+    self->fd = -1;
+  }
+}
+
+static void microbench__log_none(void* arg, unsigned long iters) {
+  for (unsigned long i = 0; i < iters; ++i) {
+    LOGI("A log message with no arguments");
+  }
+}
+
+static void microbench__log_int(void* arg, unsigned long iters) {
+  for (unsigned long i = 0; i < iters; ++i) {
+    LOGI("A log message with an int: {}", _i((int) i));
+  }
+}
+
+static void microbench__log_ulong(void* arg, unsigned long iters) {
+  for (unsigned long i = 0; i < iters; ++i) {
+    LOGI("A log message with an unsigned long: {}", _ul(i));
+  }
+}
+
+static void microbench__log_double(void* arg, unsigned long iters) {
+  for (unsigned long i = 0; i < iters; ++i) {
+    LOGI("A log message with a double: {}", _d((double) i * 0.25));
+  }
+}
+
+static void microbench__log_str(void* arg, unsigned long iters) {
+  for (unsigned long i = 0; i < iters; ++i) {
+    LOGI("A log message with a string: {}", _str("robot"));
+  }
+}
+
+static void microbench__log_mixed(void* arg, unsigned long iters) {
+  for (unsigned long i = 0; i < iters; ++i) {
+    LOGI("Tracker {} saw {} faces in {} ms", _ul(i), _i(3), _d(12.5));
+  }
+}
+
+//
+// Line splitting (as for cstdout.write())
+//
+
+/** A line splitting benchmark. */
+struct microbench__lines {
+  /** The text written in each operation. */
+  const char* text;
+
+  /** The number of pieces to write it in. */
+  int pieces;
+
+  /** The line buffer. */
+  struct linebuf buf;
+};
+
+/** Count lines without logging them. */
+static void microbench__lines_cb(const char* const* lines, unsigned int num, void* user) {
+  microbench__sink += num;
+}
+
+static void microbench__lines_teardown(void* arg) {
+  struct microbench__lines* self = arg;
+
+  linebuf_flush(&self->buf, &microbench__lines_cb, NULL);
+  free(self->buf.data);
+  self->buf = (struct linebuf) {0};
+}
+
+static void microbench__lines(void* arg, unsigned long iters) {
+  struct microbench__lines* self = arg;
+
+  size_t len = strlen(self->text);
+  size_t piece = (len + (size_t) self->pieces - 1) / (size_t) self->pieces;
+
+  for (unsigned long i = 0; i < iters; ++i) {
+    for (size_t off = 0; off < len; off += piece) {
+      linebuf_write(&self->buf, self->text + off, off + piece < len ? piece : len - off, &microbench__lines_cb, NULL);
+    }
+  }
+}
+
+//
+// Frames
+//
+
+/** A frame benchmark. */
+struct microbench__frame {
+  /** The frame width. */
+  int width;
+
+  /** The frame height. */
+  int height;
+
+  /** The source frame. */
+  char* data;
+
+  /** A tracker with no threads (only its frame buffers are used). */
+  struct tracker* tracker;
+};
+
+static void microbench__frame_setup(void* arg) {
+  struct microbench__frame* self = arg;
+
+  size_t size = (size_t) (3 * self->width * self->height);
+  self->data = malloc(size);
+  memset(self->data, 0x5a, size);
+
+  // Set up just enough of a tracker to take frames
+  self->tracker = calloc(1, sizeof(struct tracker));
+  pthread_mutex_init(&self->tracker->frame_mutex, NULL);
+  pthread_mutex_init(&self->tracker->fill_mutex, NULL);
+}
+
+static void microbench__frame_teardown(void* arg) {
+  struct microbench__frame* self = arg;
+
+  framepool_release(self->tracker->frame_data);
+  framepool_release(self->tracker->frame_spare);
+  pthread_mutex_destroy(&self->tracker->fill_mutex);
+  pthread_mutex_destroy(&self->tracker->frame_mutex);
+  free(self->tracker);
+  self->tracker = NULL;
+
+  free(self->data);
+  self->data = NULL;
+}
+
+static void microbench__submit_frame(void* arg, unsigned long iters) {
+  struct microbench__frame* self = arg;
+
+  for (unsigned long i = 0; i < iters; ++i) {
+    tracker_submit_frame(self->tracker, self->width, self->height, self->data, 0);
+  }
+}
+
+static void microbench__image_create(void* arg, unsigned long iters) {
+  struct microbench__frame* self = arg;
+
+  for (unsigned long i = 0; i < iters; ++i) {
+    SFCozmoImage image;
+    sfCozmoImageCreate(&image, self->width, self->height, self->data);
+    sfCozmoImageDestroy(image);
+  }
+}
+
+//
+// Robot lookups
+//
+
+/** A robot lookup benchmark. */
+struct microbench__registry {
+  /** The number of robots. */
+  int num_robots;
+
+  /** Nonzero to look up through a cached handle. */
+  int handle;
+
+  /** Nonzero to look up a robot that is not there. */
+  int miss;
+
+  /** The registry. */
+  struct registry* registry;
+};
+
+/** The values are not really robots, so there is nothing to free. */
+static void microbench__registry_free(void* value, void* user) {
+}
+
+static void microbench__registry_setup(void* arg) {
+  struct microbench__registry* self = arg;
+
+  self->registry = registry_new(&microbench__registry_free, NULL);
+  for (int i = 0; i < self->num_robots; ++i) {
+    registry_add(self->registry, i, (void*) (size_t) (i + 1));
+  }
+}
+
+static void microbench__registry_teardown(void* arg) {
+  struct microbench__registry* self = arg;
+
+  registry_delete(self->registry);
+  self->registry = NULL;
+}
+
+static void microbench__registry_find(void* arg, unsigned long iters) {
+  struct microbench__registry* self = arg;
+
+  int key = self->miss ? self->num_robots : self->num_robots / 2;
+  struct registry_handle handle = {0};
+
+  for (unsigned long i = 0; i < iters; ++i) {
+    unsigned int token = registry_read_lock(self->registry);
+    void* value = self->handle ? registry_handle_find(self->registry, &handle, key)
+      : registry_find(self->registry, key);
+    microbench__sink += (unsigned long) (size_t) value;
+    registry_read_unlock(self->registry, token);
+  }
+}
+
+//
+// Detection bookkeeping
+//
+
+/** A detection callback benchmark. */
+struct microbench__detect {
+  /** The number of faces per frame. */
+  int faces;
+
+  /** A tracker with no threads (only its per-frame state is used). */
+  struct tracker* tracker;
+};
+
+static void microbench__detect_setup(void* arg) {
+  struct microbench__detect* self = arg;
+  self->tracker = calloc(1, sizeof(struct tracker));
+}
+
+static void microbench__detect_teardown(void* arg) {
+  struct microbench__detect* self = arg;
+  free(self->tracker);
+  self->tracker = NULL;
+}
+
+static void microbench__detect_cb(void* arg, unsigned long iters) {
+  struct microbench__detect* self = arg;
+
+  SFRectangle face = {.left = 100, .top = 80, .right = 164, .bottom = 144};
+
+  for (unsigned long i = 0; i < iters; ++i) {
+    self->tracker->this_frame_face_count = 0;
+
+    for (int j = 0; j < self->faces; ++j) {
+      tracker__detect_cb(NULL, NULL, &face, self->tracker);
+    }
+  }
+
+  microbench__sink += (unsigned long) self->tracker->this_frame_face_count;
+}
+
+//
+// Case table
+//
+
+static struct microbench__log microbench__log_null = {.sink = microbench__sink_null, .fd = -1};
+static struct microbench__log microbench__log_file = {.sink = microbench__sink_file, .fd = -1};
+
+static struct microbench__lines microbench__lines_short = {.text = "A short line of output\n", .pieces = 1};
+static struct microbench__lines microbench__lines_pieces = {
+  .text = "A line of output written a few bytes at a time\n",
+  .pieces = 8,
+};
+static struct microbench__lines microbench__lines_block = {
+  .text = "line 1\nline 2\nline 3\nline 4\nline 5\nline 6\nline 7\nline 8\n"
+    "line 9\nline 10\nline 11\nline 12\nline 13\nline 14\nline 15\nline 16\n",
+  .pieces = 1,
+};
+
+static struct microbench__frame microbench__frame_qvga = {.width = 320, .height = 240};
+static struct microbench__frame microbench__frame_vga = {.width = 640, .height = 480};
+static struct microbench__frame microbench__frame_hd = {.width = 1280, .height = 720};
+static struct microbench__frame microbench__frame_fhd = {.width = 1920, .height = 1080};
+
+static struct microbench__registry microbench__registry_4 = {.num_robots = 4};
+static struct microbench__registry microbench__registry_4_handle = {.num_robots = 4, .handle = 1};
+static struct microbench__registry microbench__registry_4_miss = {.num_robots = 4, .miss = 1};
+static struct microbench__registry microbench__registry_64 = {.num_robots = 64};
+
+static struct microbench__detect microbench__detect_1 = {.faces = 1};
+static struct microbench__detect microbench__detect_8 = {.faces = 8};
+static struct microbench__detect microbench__detect_23 = {.faces = 23};
+
+/** Declare one log case. */
+#define MICROBENCH__LOG_CASE(kind, sink) \
+  { \
+    .name = "log_submit/" #kind "/" #sink, \
+    .fn = &microbench__log_##kind, \
+    .arg = &microbench__log_##sink, \
+    .setup = &microbench__log_setup, \
+    .reset = &microbench__log_reset, \
+    .teardown = &microbench__log_teardown, \
+  }
+
+/** Declare the log cases for one sink. */
+#define MICROBENCH__LOG_CASES(sink) \
+  MICROBENCH__LOG_CASE(none, sink), \
+  MICROBENCH__LOG_CASE(int, sink), \
+  MICROBENCH__LOG_CASE(ulong, sink), \
+  MICROBENCH__LOG_CASE(double, sink), \
+  MICROBENCH__LOG_CASE(str, sink), \
+  MICROBENCH__LOG_CASE(mixed, sink)
+
+/** Declare one line buffer case. */
+#define MICROBENCH__LINES_CASE(kind) \
+  { \
+    .name = "linebuf_write/" #kind, \
+    .fn = &microbench__lines, \
+    .arg = &microbench__lines_##kind, \
+    .teardown = &microbench__lines_teardown, \
+  }
+
+/** Declare the frame cases for one resolution. */
+#define MICROBENCH__FRAME_CASES(res, width, height) \
+  { \
+    .name = "tracker_submit_frame/" #width "x" #height, \
+    .fn = &microbench__submit_frame, \
+    .arg = &microbench__frame_##res, \
+    .setup = &microbench__frame_setup, \
+    .teardown = &microbench__frame_teardown, \
+    .bytes = 3 * (width) * (height), \
+  }, \
+  { \
+    .name = "sfCozmoImageCreate/" #width "x" #height, \
+    .fn = &microbench__image_create, \
+    .arg = &microbench__frame_##res, \
+    .setup = &microbench__frame_setup, \
+    .teardown = &microbench__frame_teardown, \
+  }
+
+/** Declare one registry case. */
+#define MICROBENCH__REGISTRY_CASE(name_, kind) \
+  { \
+    .name = "registry_find/" name_, \
+    .fn = &microbench__registry_find, \
+    .arg = &microbench__registry_##kind, \
+    .setup = &microbench__registry_setup, \
+    .teardown = &microbench__registry_teardown, \
+  }
+
+/** Declare one face detection callback case. */
+#define MICROBENCH__DETECT_CASE(faces) \
+  { \
+    .name = "tracker__detect_cb/" #faces, \
+    .fn = &microbench__detect_cb, \
+    .arg = &microbench__detect_##faces, \
+    .setup = &microbench__detect_setup, \
+    .teardown = &microbench__detect_teardown, \
+  }
+
+/** All cases. */
+static struct microbench__case microbench__cases[] = {
+  MICROBENCH__LOG_CASES(null),
+  MICROBENCH__LOG_CASES(file),
+  MICROBENCH__LINES_CASE(short),
+  MICROBENCH__LINES_CASE(pieces),
+  {
+    .name = "linebuf_write/block16",
+    .fn = &microbench__lines,
+    .arg = &microbench__lines_block,
+    .teardown = &microbench__lines_teardown,
+  },
+  MICROBENCH__FRAME_CASES(qvga, 320, 240),
+  MICROBENCH__FRAME_CASES(vga, 640, 480),
+  MICROBENCH__FRAME_CASES(hd, 1280, 720),
+  MICROBENCH__FRAME_CASES(fhd, 1920, 1080),
+  MICROBENCH__REGISTRY_CASE("4", 4),
+  MICROBENCH__REGISTRY_CASE("4/handle", 4_handle),
+  MICROBENCH__REGISTRY_CASE("4/miss", 4_miss),
+  MICROBENCH__REGISTRY_CASE("64", 64),
+  MICROBENCH__DETECT_CASE(1),
+  MICROBENCH__DETECT_CASE(8),
+  MICROBENCH__DETECT_CASE(23),
+};
+
+/**
+ * Print usage.
+ *
+ * @param argv0 The program name
+ */
+static void microbench__usage(const char* argv0) {
+  fprintf(stderr,
+    "usage: %s [-n samples] [-t min_batch_ms] [-c cpu] [-o output] [-l] [filter]\n"
+    "  -n  timed batches per case (default 31)\n"
+    "  -t  minimum batch time in milliseconds (default 10)\n"
+    "  -c  pin to this CPU\n"
+    "  -o  write JSON results here instead of stdout\n"
+    "  -l  list cases and exit\n",
+    argv0);
+}
+
+int main(int argc, char* argv[]) {
+  struct microbench__options opts = {
+    .samples = 31,
+    .min_batch_ns = 10000000ULL,
+  };
+
+  const char* out_path = NULL;
+  int cpu = -1;
+  int list = 0;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:t:c:o:lh")) != -1) {
+    switch (opt) {
+      case 'n':
+        opts.samples = atoi(optarg);
+        break;
+      case 't':
+        opts.min_batch_ns = (unsigned long long) (atof(optarg) * 1e6);
+        break;
+      case 'c':
+        cpu = atoi(optarg);
+        break;
+      case 'o':
+        out_path = optarg;
+        break;
+      case 'l':
+        list = 1;
+        break;
+      default:
+        microbench__usage(argv[0]);
+        return 2;
+    }
+  }
+
+  if (optind < argc) {
+    opts.filter = argv[optind];
+  }
+
+  if (opts.samples < 1 || opts.samples > MICROBENCH__MAX_SAMPLES) {
+    fprintf(stderr, "samples must be between 1 and %d\n", MICROBENCH__MAX_SAMPLES);
+    return 2;
+  }
+
+  size_t num_cases = sizeof microbench__cases / sizeof microbench__cases[0];
+
+  if (list) {
+    for (size_t i = 0; i < num_cases; ++i) {
+      printf("%s\n", microbench__cases[i].name);
+    }
+    return 0;
+  }
+
+  // Pin to one CPU for steadier numbers
+  if (cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof set, &set) < 0) {
+      fprintf(stderr, "unable to pin to CPU %d: %s\n", cpu, strerror(errno));
+      return 1;
+    }
+  }
+
+  // Keep results apart from the log, which goes to standard output
+  if (out_path) {
+    opts.out = fopen(out_path, "w");
+  } else {
+    opts.out = fdopen(dup(STDOUT_FILENO), "w");
+  }
+
+  if (!opts.out) {
+    fprintf(stderr, "unable to open output: %s\n", strerror(errno));
+    return 1;
+  }
+
+  // Send the log to /dev/null unless a case says otherwise
+  microbench__null_fd = open("/dev/null", O_WRONLY);
+  fflush(stdout);
+  dup2(microbench__null_fd, STDOUT_FILENO);
+
+  for (size_t i = 0; i < num_cases; ++i) {
+    if (opts.filter && !strstr(microbench__cases[i].name, opts.filter)) {
+      continue;
+    }
+
+    microbench__run(&microbench__cases[i], &opts);
+  }
+
+  fclose(opts.out);
+  return 0;
+}
@@ -4,13 +4,18 @@
 #
 
 import asyncio
+import time
 from typing import Any, Dict, Text
 
-import PIL.Image
 import base
-import cv2
 
 from cozmonaut.entry_point import EntryPoint
+from cozmonaut.lazy import lazy_import
+from cozmonaut.trace import traced
+
+# These are heavy, so only load them once they are used
+cv2 = lazy_import('cv2')
+PIL_Image = lazy_import('PIL.Image')
 
 
 class EntryPointInteract(EntryPoint):
@@ -29,16 +34,26 @@ class EntryPointInteract(EntryPoint):
         # Open first video capture device
         self.capture = cv2.VideoCapture(0)
 
+    @traced()
     async def capture_loop(self):
+        # The last frame we decoded
+        frame = None
+
         while True:
-            # Get the next frame
-            ret, frame = self.capture.read()
+            if self.tracker.wants_frame:
+                # Get the next frame and note when it was captured
+                ret, frame = self.capture.read()
+                timestamp = time.monotonic_ns()
 
-            # Show the frame
-            cv2.imshow('Output', frame)
+                # Send the camera frame off for face tracking
+                self.tracker.push_camera(PIL_Image.fromarray(frame), timestamp)
+            else:
+                # While the tracker is busy, take frames off the device without decoding them
+                self.capture.grab()
 
-            # Send the camera frame off for face tracking
-            self.tracker.push_camera(PIL.Image.fromarray(frame))
+            # Show the last decoded frame
+            if frame is not None:
+                cv2.imshow('Output', frame)
 
             # Poll window and stop on Q key down
             if cv2.waitKey(1) == ord('q'):
@@ -47,6 +62,7 @@ class EntryPointInteract(EntryPoint):
             # Yield control
             await asyncio.sleep(0)
 
+    @traced()
     async def face_loop(self):
         while True:
             # Wait for a new track
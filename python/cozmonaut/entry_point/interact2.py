@@ -3,13 +3,20 @@
 # Copyright 2019 The Cozmonaut Contributors
 #
 
+from __future__ import annotations
+
 import asyncio
+import functools
 from typing import Any, Dict, Text
 
 import base
-import cozmo
 
 from cozmonaut.entry_point import EntryPoint
+from cozmonaut.lazy import lazy_import
+from cozmonaut.trace import traced
+
+# The SDK is heavy, so only load it once it is used
+cozmo = lazy_import('cozmo')
 
 
 class EntryPointInteract(EntryPoint):
@@ -17,20 +24,25 @@ class EntryPointInteract(EntryPoint):
     The entry point for interactive mode.
     """
 
-    def on_evt_new_raw_camera_image(self, evt: cozmo.robot.camera.EvtNewRawCameraImage, **kwargs):
+    @traced()
+    def on_evt_new_raw_camera_image(self, tracker: base.Tracker, evt: cozmo.robot.camera.EvtNewRawCameraImage,
+                                    **kwargs):
         """
         Event handler for new camera frames.
 
+        :param tracker: The tracker for the robot
         :param evt: The event
         :param kwargs: Remaining keyword arguments
         """
 
-        # TODO: Get the robot ID (needed to have more than one Cozmo)
-        robot_id = 1
+        # Skip the conversion and copy if the frame would only replace one still waiting
+        if not tracker.wants_frame:
+            return
 
         # Push latest camera frame
-        base.get_tracker(robot_id).push_frame(evt.image)
+        tracker.push_camera(evt.image)
 
+    @traced()
     async def robot_main(self, robot: cozmo.robot.Robot):
         """
         The main function for a robot.
@@ -43,7 +55,10 @@ class EntryPointInteract(EntryPoint):
         robot.camera.color_image_enabled = True
 
         # Start listening for new camera frames
-        robot.camera.add_event_handler(cozmo.robot.camera.EvtNewRawCameraImage, self.on_evt_new_raw_camera_image)
+        # The tracker is looked up once here rather than on every frame
+        tracker = base.get_tracker(robot.robot_id)
+        robot.camera.add_event_handler(cozmo.robot.camera.EvtNewRawCameraImage,
+                                       functools.partial(self.on_evt_new_raw_camera_image, tracker))
 
         # Go for a drive
         # TODO: Actually do our work
@@ -51,6 +66,7 @@ class EntryPointInteract(EntryPoint):
         await robot.drive_straight(distance=cozmo.util.Distance(distance_mm=500),
                                    speed=cozmo.util.Speed(speed_mmps=50)).wait_for_completed()
 
+    @traced()
     async def robot_battery_voltage_monitor_loop(self, robot: cozmo.robot.Robot):
         """
         The battery voltage monitor loop for a robot.
@@ -72,6 +88,7 @@ class EntryPointInteract(EntryPoint):
             # Match target refresh rate
             await asyncio.sleep(monitor.delay_battery)
 
+    @traced()
     async def robot_imu_monitor_loop(self, robot: cozmo.robot.Robot):
         """
         The inertial motion unit (IMU) monitor loop for a robot.
@@ -96,6 +113,7 @@ class EntryPointInteract(EntryPoint):
             # Match target refresh rate
             await asyncio.sleep(monitor.delay_imu)
 
+    @traced()
     async def robot_wheel_speed_monitor_loop(self, robot: cozmo.robot.Robot):
         """
         The wheel speed monitor loop for a robot.
@@ -133,6 +151,7 @@ class EntryPointInteract(EntryPoint):
             asyncio.ensure_future(self.robot_wheel_speed_monitor_loop(robot)),
         )
 
+    @traced()
     async def connection_main(self, conn: cozmo.conn.CozmoConnection):
         """
         The main function for SDK connections.
@@ -146,11 +165,15 @@ class EntryPointInteract(EntryPoint):
         # Make base aware of the robot
         base.add_robot(robot.robot_id)
 
-        # Run main function and sensor loop for robot
-        await asyncio.gather(
-            asyncio.ensure_future(self.robot_main(robot)),
-            asyncio.ensure_future(self.robot_monitor_loop(robot)),
-        )
+        try:
+            # Run main function and sensor loop for robot
+            await asyncio.gather(
+                asyncio.ensure_future(self.robot_main(robot)),
+                asyncio.ensure_future(self.robot_monitor_loop(robot)),
+            )
+        finally:
+            # Stop tracking and free the robot's resources
+            base.remove_robot(robot.robot_id)
 
     def main(self, args: Dict[Text, Any]) -> int:
         """
@@ -166,6 +189,9 @@ class EntryPointInteract(EntryPoint):
         :return: The exit code (zero for success, otherwise nonzero)
         """
 
+        # Stay put when starting up
+        cozmo.robot.Robot.drive_off_charger_on_connect = False
+
         # Get the event loop
         loop = asyncio.get_event_loop()
 
@@ -179,7 +205,3 @@ class EntryPointInteract(EntryPoint):
         # Run connection main function
         loop.run_until_complete(task)
         return 0
-
-
-# Stay put when starting up
-cozmo.robot.Robot.drive_off_charger_on_connect = False
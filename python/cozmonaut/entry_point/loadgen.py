@@ -0,0 +1,358 @@
+#
+# Cozmonaut
+# Copyright 2019 The Cozmonaut Contributors
+#
+
+import argparse
+import asyncio
+import json
+import resource
+import statistics
+import time
+from typing import Any, Dict, List, Optional, Text, Tuple
+
+import base
+
+from cozmonaut.entry_point import EntryPoint
+from cozmonaut.trace import traced
+
+
+class _Frame:
+    """
+    A raw RGB24 camera frame.
+
+    This quacks like the PIL images the SDK hands us, so it goes through the
+    same Tracker.push_camera() path as a real robot's camera.
+    """
+
+    def __init__(self, width: int, height: int, data: bytes):
+        self.width = width
+        self.height = height
+        self._data = data
+
+    def tobytes(self) -> bytes:
+        return self._data
+
+
+class _RobotStats:
+    """
+    The measurements for one virtual robot.
+    """
+
+    def __init__(self, robot_id: int):
+        self.robot_id = robot_id
+
+        # Frames pushed to the tracker
+        self.pushed = 0
+
+        # Frames still pending when the next one was due
+        self.overruns = 0
+
+        # Frames skipped because the tracker did not want them
+        self.skipped = 0
+
+        # Frames the tracker dropped for missing the deadline (these have no latency)
+        self.stale = 0
+
+        # Seconds from push until detection results were in
+        self.latencies: List[float] = []
+
+        # Telemetry readings pushed to the monitor
+        self.telemetry = 0
+
+        # The tracker's own counters at the end of the run
+        self.tracker: Dict[Text, Any] = {}
+
+    def report(self, duration: float) -> Dict[Text, Any]:
+        """
+        Summarize the measurements.
+
+        :param duration: The length of the run in seconds
+        :return: The summary
+        """
+
+        lat = sorted(self.latencies)
+
+        def pct(p: float) -> Optional[float]:
+            return lat[min(len(lat) - 1, int(p * len(lat)))] * 1000 if lat else None
+
+        return {
+            'robot_id': self.robot_id,
+            'pushed': self.pushed,
+            'completed': len(lat),
+            'overruns': self.overruns,
+            'skipped': self.skipped,
+            'stale': self.stale,
+            'throughput_fps': len(lat) / duration,
+            'latency_ms_mean': statistics.mean(lat) * 1000 if lat else None,
+            'latency_ms_p50': pct(0.50),
+            'latency_ms_p90': pct(0.90),
+            'latency_ms_p99': pct(0.99),
+            'latency_ms_max': lat[-1] * 1000 if lat else None,
+            'telemetry': self.telemetry,
+            'tracker_frames': self.tracker.get('frames'),
+            'tracker_frames_dropped': self.tracker.get('frames_dropped'),
+            'tracker_frames_stale': self.tracker.get('frames_stale'),
+            'tracker_fps': self.tracker.get('fps'),
+        }
+
+
+def _parse_size(text: Text) -> Tuple[int, int]:
+    width, _, height = text.partition('x')
+    try:
+        return int(width), int(height)
+    except ValueError:
+        raise argparse.ArgumentTypeError(f'expected WIDTHxHEIGHT, got {text!r}')
+
+
+class EntryPointLoadgen(EntryPoint):
+    """
+    The entry point for the synthetic multi-robot load generator.
+
+    This registers a number of virtual robots, feeds each one camera frames and
+    telemetry at fixed rates through the same base APIs the real robots use,
+    and reports per-robot latency and throughput and the total CPU time spent.
+    """
+
+    def __init__(self):
+        self.opts = None
+        self.frames: List[_Frame] = []
+
+    def load_frames(self) -> List[_Frame]:
+        """
+        Load the frames to feed the trackers.
+
+        :return: The frames
+        """
+
+        width, height = self.opts.size
+        frame_size = width * height * 3
+
+        if self.opts.replay:
+            # Slice the replay file into frames
+            with open(self.opts.replay, 'rb') as f:
+                data = f.read()
+
+            frames = [_Frame(width, height, data[i:i + frame_size])
+                      for i in range(0, len(data) - frame_size + 1, frame_size)]
+
+            if not frames:
+                raise ValueError(f'{self.opts.replay} holds less than one {width}x{height} RGB24 frame')
+
+            return frames
+
+        # Make a handful of distinct frames from a shifting byte ramp
+        ramp = bytes(range(256)) * (frame_size // 256 + 2)
+        return [_Frame(width, height, ramp[i * 7:i * 7 + frame_size]) for i in range(8)]
+
+    @traced()
+    async def camera_loop(self, tracker: base.Tracker, stats: _RobotStats, end: float):
+        """
+        The camera loop for a virtual robot.
+
+        :param tracker: The robot's tracker
+        :param stats: The robot's measurements
+        :param end: The loop time to stop at
+        """
+
+        loop = asyncio.get_event_loop()
+        period = 1 / self.opts.fps
+        poll = self.opts.poll_ms / 1000
+
+        # Spread the robots over the frame period, so they don't all push at once
+        next_time = loop.time() + period * (stats.robot_id % 16) / 16
+
+        while next_time < end:
+            await asyncio.sleep(max(0.0, next_time - loop.time()))
+
+            # Skip the frame if the tracker has one waiting, like a real producer would
+            if self.opts.backpressure and not tracker.wants_frame:
+                stats.skipped += 1
+                next_time += period
+                continue
+
+            # Note the stale count, so a frame dropped for its age is not taken for a finished one
+            stale_before = tracker.stats()['frames_stale'] if self.opts.deadline_ms else 0
+
+            # Push the next frame
+            frame = self.frames[stats.pushed % len(self.frames)]
+            start = time.perf_counter()
+            tracker.push_camera(frame, time.monotonic_ns())
+            stats.pushed += 1
+
+            next_time += period
+
+            # Wait for detection results, up to when the next frame is due
+            while tracker.frame_pending and loop.time() < next_time:
+                await asyncio.sleep(poll)
+
+            if tracker.frame_pending:
+                stats.overruns += 1
+            elif self.opts.deadline_ms and tracker.stats()['frames_stale'] > stale_before:
+                stats.stale += 1
+            else:
+                stats.latencies.append(time.perf_counter() - start)
+
+    @traced()
+    async def telemetry_loop(self, monitor: base.Monitor, stats: _RobotStats, end: float):
+        """
+        The telemetry loop for a virtual robot.
+
+        :param monitor: The robot's monitor
+        :param stats: The robot's measurements
+        :param end: The loop time to stop at
+        """
+
+        loop = asyncio.get_event_loop()
+        delay = 1 / self.opts.telemetry_hz
+
+        n = 0
+        while loop.time() < end:
+            # Push a plausible reading for each subsystem
+            monitor.push_battery(3.9 - 0.0001 * n)
+            monitor.push_accelerometer(0.0, 0.0, 9.81)
+            monitor.push_gyroscope(0.0, 0.0, 0.01 * (n % 10))
+            monitor.push_wheel_speeds(50.0, 50.0)
+            stats.telemetry += 4
+            n += 1
+
+            await asyncio.sleep(delay)
+
+    async def run(self, robot_ids: List[int]) -> List[_RobotStats]:
+        """
+        Run the load against all virtual robots.
+
+        :param robot_ids: The robot IDs
+        :return: The measurements per robot
+        """
+
+        loop = asyncio.get_event_loop()
+
+        trackers = [base.get_tracker(robot_id) for robot_id in robot_ids]
+        monitors = [base.get_monitor(robot_id) for robot_id in robot_ids]
+
+        if self.opts.deadline_ms:
+            for tracker in trackers:
+                tracker.deadline = self.opts.deadline_ms / 1000
+
+        # Let the trackers warm up their detectors before anything is timed
+        while not all(tracker.ready for tracker in trackers):
+            await asyncio.sleep(0.05)
+
+        all_stats = [_RobotStats(robot_id) for robot_id in robot_ids]
+        end = loop.time() + self.opts.duration
+
+        loops = []
+        for tracker, monitor, stats in zip(trackers, monitors, all_stats):
+            loops.append(asyncio.ensure_future(self.camera_loop(tracker, stats, end)))
+            loops.append(asyncio.ensure_future(self.telemetry_loop(monitor, stats, end)))
+
+        await asyncio.gather(*loops)
+
+        # Pick up the trackers' own counters
+        for tracker, stats in zip(trackers, all_stats):
+            stats.tracker = tracker.stats()
+
+        return all_stats
+
+    def main(self, args: Dict[Text, Any]) -> int:
+        """
+        The main method.
+
+        This entry point takes the following arguments:
+         - argv: List[str] - The command-line arguments after "loadgen"
+
+        :param args: A dictionary with above arguments
+        :return: The exit code (zero for success, otherwise nonzero)
+        """
+
+        parser = argparse.ArgumentParser(prog='cozmo loadgen',
+                                         description='Drive virtual robots through base for scaling tests.')
+        parser.add_argument('--robots', type=int, default=4, help='the number of virtual robots (default 4)')
+        parser.add_argument('--first-id', type=int, default=1000, help='the first robot ID (default 1000)')
+        parser.add_argument('--fps', type=float, default=15, help='camera frames per second per robot (default 15)')
+        parser.add_argument('--size', type=_parse_size, default=(320, 240),
+                            help='camera frame size as WIDTHxHEIGHT (default 320x240)')
+        parser.add_argument('--replay', help='a raw RGB24 file of frames to replay instead of synthetic frames')
+        parser.add_argument('--telemetry-hz', type=float, default=10,
+                            help='telemetry rounds per second per robot (default 10)')
+        parser.add_argument('--duration', type=float, default=30, help='the test length in seconds (default 30)')
+        parser.add_argument('--poll-ms', type=float, default=1, help='the result polling period (default 1 ms)')
+        parser.add_argument('--backpressure', action='store_true',
+                            help='skip frames while the tracker has one waiting (see Tracker.wants_frame)')
+        parser.add_argument('--deadline-ms', type=float,
+                            help='drop frames older than this when detection gets to them (see Tracker.deadline)')
+        parser.add_argument('--output', help='also write the results as JSON to this file')
+
+        try:
+            self.opts = parser.parse_args(args.get('argv', []))
+        except SystemExit as e:
+            return e.code
+
+        if self.opts.robots < 1 or self.opts.fps <= 0 or self.opts.telemetry_hz <= 0 or self.opts.duration <= 0:
+            parser.print_usage()
+            return 2
+
+        try:
+            self.frames = self.load_frames()
+        except (OSError, ValueError) as e:
+            print(f'cannot load frames: {e}')
+            return 1
+
+        robot_ids = list(range(self.opts.first_id, self.opts.first_id + self.opts.robots))
+
+        # Make base aware of the virtual robots
+        for robot_id in robot_ids:
+            base.add_robot(robot_id)
+
+        try:
+            # Time and measure the run
+            usage_start = resource.getrusage(resource.RUSAGE_SELF)
+            wall_start = time.perf_counter()
+
+            loop = asyncio.get_event_loop()
+            all_stats = loop.run_until_complete(self.run(robot_ids))
+
+            wall = time.perf_counter() - wall_start
+            usage_end = resource.getrusage(resource.RUSAGE_SELF)
+        finally:
+            # Stop tracking and free the robots' resources
+            for robot_id in robot_ids:
+                base.remove_robot(robot_id)
+
+        cpu_user = usage_end.ru_utime - usage_start.ru_utime
+        cpu_sys = usage_end.ru_stime - usage_start.ru_stime
+
+        reports = [stats.report(self.opts.duration) for stats in all_stats]
+        results = {
+            'robots': self.opts.robots,
+            'fps': self.opts.fps,
+            'size': '{}x{}'.format(*self.opts.size),
+            'duration_s': wall,
+            'cpu_user_s': cpu_user,
+            'cpu_sys_s': cpu_sys,
+            'cpu_cores': (cpu_user + cpu_sys) / wall,
+            'per_robot': reports,
+        }
+
+        # Print a table
+        print(f'{"robot":>6} {"pushed":>7} {"done":>7} {"overrun":>7} {"skipped":>7} {"fps":>6} '
+              f'{"p50 ms":>7} {"p90 ms":>7} {"p99 ms":>7} {"max ms":>7} {"dropped":>7} {"stale":>7}')
+
+        def ms(value: Optional[float]) -> Text:
+            return f'{value:7.2f}' if value is not None else f'{"-":>7}'
+
+        for r in reports:
+            print(f'{r["robot_id"]:>6} {r["pushed"]:>7} {r["completed"]:>7} {r["overruns"]:>7} {r["skipped"]:>7} '
+                  f'{r["throughput_fps"]:6.2f} {ms(r["latency_ms_p50"])} {ms(r["latency_ms_p90"])} '
+                  f'{ms(r["latency_ms_p99"])} {ms(r["latency_ms_max"])} {r["tracker_frames_dropped"]:>7} '
+                  f'{r["tracker_frames_stale"]:>7}')
+
+        print(f'total: {sum(r["throughput_fps"] for r in reports):.2f} fps over {self.opts.robots} robots, '
+              f'cpu {cpu_user:.2f}s user + {cpu_sys:.2f}s sys ({results["cpu_cores"]:.2f} cores)')
+
+        if self.opts.output:
+            with open(self.opts.output, 'w') as f:
+                json.dump(results, f, indent=2)
+
+        return 0
@@ -0,0 +1,42 @@
+#
+# Cozmonaut
+# Copyright 2019 The Cozmonaut Contributors
+#
+
+import importlib.util
+import sys
+from types import ModuleType
+from typing import Text
+
+
+def lazy_import(name: Text) -> ModuleType:
+    """
+    Import a module lazily.
+
+    The module is located and registered right away, but its code does not run
+    until one of its attributes is first accessed. Heavy third-party modules
+    (OpenCV, PIL, the Cozmo SDK) take a good fraction of a second to import, so
+    this keeps them off the startup path until an entry point actually uses
+    them.
+
+    :param name: The module name
+    :return: The module
+    """
+
+    # Reuse the module if it is already around
+    module = sys.modules.get(name)
+    if module is not None:
+        return module
+
+    # Find the module without executing it
+    spec = importlib.util.find_spec(name)
+    if spec is None:
+        raise ImportError(f'No module named {name!r}', name=name)
+
+    # Defer execution until first attribute access
+    loader = importlib.util.LazyLoader(spec.loader)
+    spec.loader = loader
+    module = importlib.util.module_from_spec(spec)
+    sys.modules[name] = module
+    loader.exec_module(module)
+    return module
@@ -0,0 +1,112 @@
+#
+# Cozmonaut
+# Copyright 2019 The Cozmonaut Contributors
+#
+
+import asyncio
+import contextlib
+import functools
+import types
+from typing import Any, Callable, Coroutine, Iterator, Optional, Text
+
+import base
+
+
+@contextlib.contextmanager
+def span(name: Text) -> Iterator[None]:
+    """
+    Trace a span of synchronous code.
+
+    The span shows up on the timeline of the calling thread, next to the spans
+    recorded in C (see trace.h). Spans on a thread must nest, so a span must not
+    be held across an await; use traced() on the coroutine function instead.
+
+    :param name: The span name
+    """
+
+    base.trace_begin(name)
+    try:
+        yield
+    finally:
+        base.trace_end()
+
+
+@types.coroutine
+def _step_traced(name: Text, coro: Coroutine) -> Any:
+    """
+    Drive a coroutine, tracing each step it takes between awaits.
+
+    :param name: The span name
+    :param coro: The coroutine
+    :return: The result of the coroutine
+    """
+
+    value = None
+    exc = None
+
+    while True:
+        # Run the coroutine up to its next suspension
+        base.trace_begin(name)
+        try:
+            if exc is None:
+                yielded = coro.send(value)
+            else:
+                yielded = coro.throw(exc)
+        except StopIteration as stop:
+            return stop.value
+        finally:
+            base.trace_end()
+
+        # Pass the suspension up to the event loop and the outcome back down
+        try:
+            value = yield yielded
+            exc = None
+        except BaseException as e:
+            value = None
+            exc = e
+
+
+def traced(name: Optional[Text] = None) -> Callable:
+    """
+    Trace calls to a function or coroutine function.
+
+    A plain function gets one span per call. A coroutine function gets one span
+    per step between awaits, so its spans nest properly with those of the other
+    coroutines sharing the thread. With tracing off, the function is returned
+    untouched.
+
+    :param name: The span name (defaults to the qualified function name)
+    :return: The decorator
+    """
+
+    def decorate(fn: Callable) -> Callable:
+        if not base.trace_enabled():
+            return fn
+
+        span_name = name or fn.__qualname__
+
+        if asyncio.iscoroutinefunction(fn):
+            @functools.wraps(fn)
+            async def coroutine_wrapper(*args, **kwargs):
+                return await _step_traced(span_name, fn(*args, **kwargs))
+
+            return coroutine_wrapper
+
+        @functools.wraps(fn)
+        def wrapper(*args, **kwargs):
+            with span(span_name):
+                return fn(*args, **kwargs)
+
+        return wrapper
+
+    return decorate
+
+
+def dump(path: Optional[Text] = None):
+    """
+    Dump the trace to a Chrome trace file.
+
+    :param path: The file path (defaults to the COZMONAUT_TRACE path)
+    """
+
+    base.trace_dump(path)
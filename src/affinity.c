@@ -0,0 +1,176 @@
+/*
+ * Cozmonaut
+ * Copyright 2019 The Cozmonaut Contributors
+ */
+
+#define _GNU_SOURCE
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include "affinity.h"
+#include "log.h"
+
+/** The number of thread roles. */
+#define AFFINITY__NUM_ROLES (affinity_role_io + 1)
+
+/** The role names as they appear in COZMONAUT_CPUS. */
+static const char* const affinity__role_names[AFFINITY__NUM_ROLES] = {
+  [affinity_role_detection] = "detection",
+  [affinity_role_recognition] = "recognition",
+  [affinity_role_python] = "python",
+  [affinity_role_io] = "io",
+};
+
+/** Guards the one-time configuration parse. */
+static pthread_once_t affinity__once = PTHREAD_ONCE_INIT;
+
+/** The CPU set of each role. */
+static cpu_set_t affinity__cpus[AFFINITY__NUM_ROLES];
+
+/** Nonzero for roles that have a CPU set. */
+static int affinity__has_cpus[AFFINITY__NUM_ROLES];
+
+/** The SCHED_FIFO priority for detection threads, or zero for none. */
+static int affinity__rt_detection;
+
+/**
+ * Parse a CPU list like "0-3,6".
+ *
+ * @param list The CPU list
+ * @param cpus The CPU set to fill in
+ * @return Zero on success, otherwise nonzero
+ */
+static int affinity__parse_cpus(const char* list, cpu_set_t* cpus) {
+  CPU_ZERO(cpus);
+
+  while (*list) {
+    // Parse the next CPU or range
+    char* end;
+    long first = strtol(list, &end, 10);
+    long last = first;
+    if (end == list) {
+      return 1;
+    }
+    if (*end == '-') {
+      list = end + 1;
+      last = strtol(list, &end, 10);
+      if (end == list) {
+        return 1;
+      }
+    }
+
+    if (first < 0 || last < first || last >= CPU_SETSIZE) {
+      return 1;
+    }
+
+    for (long cpu = first; cpu <= last; ++cpu) {
+      CPU_SET((int) cpu, cpus);
+    }
+
+    if (*end == ',') {
+      ++end;
+    } else if (*end) {
+      return 1;
+    }
+    list = end;
+  }
+
+  return CPU_COUNT(cpus) == 0;
+}
+
+/** Read the placement configuration from the environment. */
+static void affinity__configure() {
+  const char* config = getenv("COZMONAUT_CPUS");
+  if (config) {
+    char* copy = strdup(config);
+
+    // Go over the role assignments
+    char* save;
+    for (char* entry = strtok_r(copy, ";", &save); entry; entry = strtok_r(NULL, ";", &save)) {
+      char* list = strchr(entry, '=');
+      if (!list) {
+        LOGW("Bad entry in COZMONAUT_CPUS: {}", _str(entry));
+        continue;
+      }
+      *list++ = '\0';
+
+      int role = 0;
+      while (role < AFFINITY__NUM_ROLES && strcmp(entry, affinity__role_names[role]) != 0) {
+        ++role;
+      }
+
+      if (role == AFFINITY__NUM_ROLES) {
+        LOGW("Unknown thread role in COZMONAUT_CPUS: {}", _str(entry));
+        continue;
+      }
+
+      if (affinity__parse_cpus(list, &affinity__cpus[role]) != 0) {
+        LOGW("Bad CPU list for {} in COZMONAUT_CPUS: {}", _str(entry), _str(list));
+        continue;
+      }
+
+      affinity__has_cpus[role] = 1;
+      LOGI("Placing {} threads on CPUs {}", _str(entry), _str(list));
+    }
+
+    free(copy);
+  }
+
+  const char* rt = getenv("COZMONAUT_RT_DETECTION");
+  if (rt) {
+    int priority = atoi(rt);
+    if (priority >= sched_get_priority_min(SCHED_FIFO) && priority <= sched_get_priority_max(SCHED_FIFO)) {
+      affinity__rt_detection = priority;
+    } else {
+      LOGW("Bad SCHED_FIFO priority in COZMONAUT_RT_DETECTION: {}", _str(rt));
+    }
+  }
+}
+
+void affinity_apply(enum affinity_role role, const char* name) {
+  pthread_once(&affinity__once, &affinity__configure);
+
+  // Name the thread (the kernel keeps 15 characters)
+  char comm[16];
+  strncpy(comm, name, sizeof comm - 1);
+  comm[sizeof comm - 1] = '\0';
+  pthread_setname_np(pthread_self(), comm);
+
+  // Pin the thread to its role's CPUs
+  if (affinity__has_cpus[role]) {
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &affinity__cpus[role]);
+    if (err != 0) {
+      LOGW("Unable to pin thread {}: {}", _str(comm), _str(strerror(err)));
+    }
+  }
+
+  // Give detection a real-time scheduling class
+  if (role == affinity_role_detection && affinity__rt_detection) {
+    struct sched_param param = {
+      .sched_priority = affinity__rt_detection,
+    };
+
+    int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (err != 0) {
+      LOGW("Unable to make thread {} real-time: {}", _str(comm), _str(strerror(err)));
+    }
+  }
+}
+
+void affinity_mutex_init(pthread_mutex_t* mutex) {
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+
+  // Fall back to a plain mutex where priority inheritance is not supported
+  int err = pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+  if (err != 0) {
+    LOGW("Unable to use priority inheritance: {}", _str(strerror(err)));
+  }
+
+  pthread_mutex_init(mutex, &attr);
+  pthread_mutexattr_destroy(&attr);
+}
@@ -0,0 +1,72 @@
+/*
+ * Cozmonaut
+ * Copyright 2019 The Cozmonaut Contributors
+ */
+
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+//
+// Thread placement
+//
+// Each long-lived thread names itself and takes its place according to its
+// role when it starts. The COZMONAUT_CPUS environment variable maps roles to
+// CPU lists, separated by semicolons (e.g. "detection=2-3;recognition=1;
+// python=0;io=0"). Roles left out run wherever the scheduler puts them. With
+// COZMONAUT_RT_DETECTION set to a priority (1-99), detection threads also run
+// under SCHED_FIFO, which needs CAP_SYS_NICE or an rtprio limit.
+//
+// Threads started by Python inherit the placement of the python role.
+//
+// Mutexes that detection threads take are set up with affinity_mutex_init(),
+// so a real-time detection thread never waits behind a preempted holder.
+//
+
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** A thread role. */
+enum affinity_role {
+  /** Tracker face detection. */
+  affinity_role_detection,
+
+  /** Tracker face recognition. */
+  affinity_role_recognition,
+
+  /** The Python interpreter loop. */
+  affinity_role_python,
+
+  /** Service workers, the metrics server, and other I/O. */
+  affinity_role_io,
+};
+
+/**
+ * Place the calling thread according to its role.
+ *
+ * This sets the thread name, CPU affinity, and scheduling class. Failures are
+ * logged and otherwise ignored, so the thread keeps running where it is.
+ *
+ * @param role The thread role
+ * @param name The thread name (truncated to 15 characters)
+ */
+void affinity_apply(enum affinity_role role, const char* name);
+
+/**
+ * Initialize a mutex that detection threads take.
+ *
+ * The mutex uses priority inheritance. While a real-time detection thread
+ * waits on it, the holder runs at the detection thread's priority, so other
+ * threads cannot keep the holder (and the detection thread) off the CPU.
+ *
+ * @param mutex The mutex
+ */
+void affinity_mutex_init(pthread_mutex_t* mutex);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // #ifndef AFFINITY_H
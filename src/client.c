@@ -3,25 +3,47 @@
  * Copyright 2019 The Cozmonaut Contributors
  */
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <pthread.h>
 
 #include <Python.h>
 
-#include <klib/khash.h>
-
+#include "affinity.h"
 #include "client.h"
+#include "jpegdec.h"
+#include "linebuf.h"
+#include "lockprof.h"
 #include "log.h"
+#include "metrics.h"
+#include "registry.h"
 #include "service.h"
+#include "state.h"
+#include "telemetry.h"
+#include "trace.h"
 #include "tracker.h"
 
+#if PY_VERSION_HEX < 0x030900A4
+
+/** Set the size of a variable-size object (Python 3.9 added this). */
+#define Py_SET_SIZE(ob, size) (((PyVarObject*) (ob))->ob_size = (size))
+
+#endif
+
+#ifdef COZMONAUT_FROZEN
+
+/** The frozen cozmonaut package (generated by tools/freeze.py). */
+extern const struct _frozen cozmonaut_frozen_modules[];
+
+#else
+
 // TODO: Compute this eventually
 static const char* OUR_MODULE_PATH = "../python/";
 
-/** A hash map from integers to Python objects. */
-KHASH_MAP_INIT_INT64(i2py, PyObject*)
+#endif
 
 //
 // base.Monitor class
@@ -35,6 +57,15 @@ typedef struct {
 
   /** The ID of the associated robot. */
   int robot_id;
+
+  /** The telemetry archive (nullable). */
+  struct telemetry* telemetry;
+
+  /** The shared-memory state slot (nullable). */
+  struct state_robot* state;
+
+  /** The number of readings pushed on each telemetry channel. Read by the metrics thread. */
+  unsigned long long samples[telemetry_channel__count];
 } MonitorObject;
 
 static int Monitor_init(MonitorObject* self, PyObject* args, PyObject* kwds) {
@@ -42,6 +73,11 @@ static int Monitor_init(MonitorObject* self, PyObject* args, PyObject* kwds) {
 }
 
 static void Monitor_dealloc(MonitorObject* self) {
+  // Close telemetry archive
+  if (self->telemetry) {
+    telemetry_close(self->telemetry);
+  }
+
   Py_TYPE(self)->tp_free(self);
 }
 
@@ -55,6 +91,20 @@ static PyObject* Monitor_push_battery(MonitorObject* self, PyObject* args) {
 
   LOGI("Battery: {}", _d(voltage));
 
+  // Count the reading
+  __atomic_add_fetch(&self->samples[telemetry_channel_battery], 1, __ATOMIC_RELAXED);
+
+  // Archive the reading
+  if (self->telemetry) {
+    telemetry_record(self->telemetry, telemetry_channel_battery, telemetry_time(), (double[]) {voltage});
+  }
+
+  // Publish the reading
+  if (self->state) {
+    state_monitor_begin(self->state)->battery = voltage;
+    state_monitor_end(self->state);
+  }
+
   Py_INCREF(Py_None);
   return Py_None;
 }
@@ -69,6 +119,23 @@ static PyObject* Monitor_push_accelerometer(MonitorObject* self, PyObject* args)
 
   LOGI("Accelerometer: ({}, {}, {})", _d(x), _d(y), _d(z));
 
+  // Count the reading
+  __atomic_add_fetch(&self->samples[telemetry_channel_accelerometer], 1, __ATOMIC_RELAXED);
+
+  // Archive the reading
+  if (self->telemetry) {
+    telemetry_record(self->telemetry, telemetry_channel_accelerometer, telemetry_time(), (double[]) {x, y, z});
+  }
+
+  // Publish the reading
+  if (self->state) {
+    struct state_monitor* state = state_monitor_begin(self->state);
+    state->accelerometer[0] = x;
+    state->accelerometer[1] = y;
+    state->accelerometer[2] = z;
+    state_monitor_end(self->state);
+  }
+
   Py_INCREF(Py_None);
   return Py_None;
 }
@@ -83,12 +150,29 @@ static PyObject* Monitor_push_gyroscope(MonitorObject* self, PyObject* args) {
 
   LOGI("Gyroscope: ({}, {}, {})", _d(x), _d(y), _d(z));
 
+  // Count the reading
+  __atomic_add_fetch(&self->samples[telemetry_channel_gyroscope], 1, __ATOMIC_RELAXED);
+
+  // Archive the reading
+  if (self->telemetry) {
+    telemetry_record(self->telemetry, telemetry_channel_gyroscope, telemetry_time(), (double[]) {x, y, z});
+  }
+
+  // Publish the reading
+  if (self->state) {
+    struct state_monitor* state = state_monitor_begin(self->state);
+    state->gyroscope[0] = x;
+    state->gyroscope[1] = y;
+    state->gyroscope[2] = z;
+    state_monitor_end(self->state);
+  }
+
   Py_INCREF(Py_None);
   return Py_None;
 }
 
 static PyObject* Monitor_push_wheel_speeds(MonitorObject* self, PyObject* args) {
-  // Unpack gyroscope reading (no reference)
+  // Unpack wheel speeds (no reference)
   double l, r;
   if (!PyArg_ParseTuple(args, "dd", &l, &r)) {
     // Forward exception
@@ -96,7 +180,23 @@ static PyObject* Monitor_push_wheel_speeds(MonitorObject* self, PyObject* args)
   }
 
   LOGI("Left wheel: {}", _d(l));
-  LOGI("Right wheel: {}", _d(l));
+  LOGI("Right wheel: {}", _d(r));
+
+  // Count the reading
+  __atomic_add_fetch(&self->samples[telemetry_channel_wheel_speeds], 1, __ATOMIC_RELAXED);
+
+  // Archive the reading
+  if (self->telemetry) {
+    telemetry_record(self->telemetry, telemetry_channel_wheel_speeds, telemetry_time(), (double[]) {l, r});
+  }
+
+  // Publish the reading
+  if (self->state) {
+    struct state_monitor* state = state_monitor_begin(self->state);
+    state->wheel_speeds[0] = l;
+    state->wheel_speeds[1] = r;
+    state_monitor_end(self->state);
+  }
 
   Py_INCREF(Py_None);
   return Py_None;
@@ -175,28 +275,365 @@ static PyTypeObject MonitorType = {
   .tp_new = &PyType_GenericNew,
 };
 
+//
+// base.Tracker class
+//
+// Part of base extension module.
+//
+
+/** An instance of the Tracker class. */
+typedef struct {
+  PyObject_HEAD
+
+  /** The face tracker. */
+  struct tracker* tracker;
+} TrackerObject;
+
+//
+// base.TrackView class
+//
+// Part of base extension module.
+//
+
+/**
+ * An instance of the TrackView class.
+ *
+ * This is a read-only buffer over one field of a track in tracker-owned
+ * memory. Track properties hand these out wrapped in memoryviews, so consumers
+ * can read bounding boxes and identities (e.g. with numpy) without boxing each
+ * value into a Python object. Views are only handed out for active tracks,
+ * but a view kept past the end of its track goes on reading the slot, which
+ * may by then belong to another track. Check Track.active before trusting it.
+ */
+typedef struct {
+  PyObject_HEAD
+
+  /** The object that keeps the memory alive. */
+  PyObject* owner;
+
+  /** The memory. */
+  void* buf;
+
+  /** The struct-module format of each item. */
+  const char* format;
+
+  /** The size of each item. */
+  Py_ssize_t itemsize;
+
+  /** The number of items. */
+  Py_ssize_t shape[1];
+
+  /** The item strides (always contiguous). */
+  Py_ssize_t strides[1];
+} TrackViewObject;
+
+static void TrackView_dealloc(TrackViewObject* self) {
+  // Release references
+  Py_XDECREF(self->owner); // nullable
+
+  Py_TYPE(self)->tp_free(self);
+}
+
+static int TrackView_getbuffer(TrackViewObject* self, Py_buffer* view, int flags) {
+  // The memory belongs to the tracker, so refuse writers
+  if (flags & PyBUF_WRITABLE) {
+    PyErr_SetString(PyExc_BufferError, "track views are read-only");
+    view->obj = NULL;
+    return -1;
+  }
+
+  view->buf = self->buf;
+  view->obj = (PyObject*) self;
+  view->len = self->itemsize * self->shape[0];
+  view->readonly = 1;
+  view->itemsize = self->itemsize;
+  view->format = (flags & PyBUF_FORMAT) ? (char*) self->format : NULL;
+  view->ndim = 1;
+  view->shape = (flags & PyBUF_ND) ? self->shape : NULL;
+  view->strides = (flags & PyBUF_STRIDES) ? self->strides : NULL;
+  view->suboffsets = NULL;
+  view->internal = NULL;
+
+  // The view keeps us (and so the memory) alive
+  Py_INCREF(self);
+  return 0;
+}
+
+/** Buffer protocol for base.TrackView class. */
+static PyBufferProcs TrackView_as_buffer = {
+  .bf_getbuffer = (getbufferproc) &TrackView_getbuffer,
+};
+
+/** The TrackView class. */
+static PyTypeObject TrackViewType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  .tp_name = "base.TrackView",
+  .tp_basicsize = sizeof(TrackViewObject),
+  .tp_itemsize = 0,
+  .tp_dealloc = (destructor) &TrackView_dealloc,
+  .tp_as_buffer = &TrackView_as_buffer,
+  .tp_flags = Py_TPFLAGS_DEFAULT,
+};
+
+/**
+ * Make a memoryview over tracker-owned memory.
+ *
+ * @param owner The object that keeps the memory alive
+ * @param buf The memory
+ * @param format The struct-module format of each item
+ * @param itemsize The size of each item
+ * @param num The number of items
+ * @return The memoryview (new reference), or NULL on failure
+ */
+static PyObject* TrackView__memoryview(PyObject* owner, void* buf, const char* format, Py_ssize_t itemsize,
+  Py_ssize_t num) {
+  // Create track view object (new reference)
+  TrackViewObject* view = PyObject_New(TrackViewObject, &TrackViewType);
+  if (!view) {
+    // Forward exception
+    return NULL;
+  }
+
+  // References:
+  //  - view
+
+  Py_INCREF(owner);
+  view->owner = owner;
+  view->buf = buf;
+  view->format = format;
+  view->itemsize = itemsize;
+  view->shape[0] = num;
+  view->strides[0] = itemsize;
+
+  // Wrap the view in a memoryview (new reference)
+  PyObject* memoryview = PyMemoryView_FromObject((PyObject*) view);
+
+  // Release references
+  Py_DECREF(view);
+
+  return memoryview;
+}
+
 //
 // base.Track class
 //
 // Part of base extension module.
 //
 
+/** The most Track objects to keep around for reuse. */
+#define TRACK_FREELIST_MAX 64
+
 /** An instance of the Track class. */
 typedef struct {
   PyObject_HEAD
 
   /** The track number. */
   int number;
+
+  /** The tracker (nullable). */
+  TrackerObject* tracker;
+
+  /** The track in tracker-owned memory (nullable). */
+  const struct tracker_track* track;
 } TrackObject;
 
+/** The Track class. */
+static PyTypeObject TrackType;
+
+/** Recycled Track objects. Only touched with the GIL held. */
+static TrackObject* Track__freelist[TRACK_FREELIST_MAX];
+
+/** The number of recycled Track objects. */
+static int Track__freelist_num;
+
+static PyObject* TrackObject_new(PyTypeObject* type, PyObject* args, PyObject* kwds) {
+  // Reuse a recycled object if we can
+  if (type == &TrackType && Track__freelist_num > 0) {
+    TrackObject* self = Track__freelist[--Track__freelist_num];
+    PyObject_Init((PyObject*) self, type);
+    self->number = 0;
+    self->tracker = NULL;
+    self->track = NULL;
+    return (PyObject*) self;
+  }
+
+  return PyType_GenericNew(type, args, kwds);
+}
+
 static int TrackObject_init(TrackObject* self, PyObject* args, PyObject* kwds) {
   return 0;
 }
 
 static void TrackObject_dealloc(TrackObject* self) {
+  // Release references
+  Py_XDECREF(self->tracker); // nullable
+
+  // Recycle the object if there is room
+  if (Py_TYPE(self) == &TrackType && Track__freelist_num < TRACK_FREELIST_MAX) {
+    Track__freelist[Track__freelist_num++] = self;
+    return;
+  }
+
   Py_TYPE(self)->tp_free(self);
 }
 
+/**
+ * Create a Track object for a track.
+ *
+ * This skips the Python call machinery, as it is on the per-track path.
+ *
+ * @param tracker The tracker
+ * @param number The track number
+ * @return The Track object (new reference), or NULL on failure
+ */
+static TrackObject* Track__create(TrackerObject* tracker, int number) {
+  // Create track object (new reference)
+  TrackObject* self = (TrackObject*) TrackObject_new(&TrackType, NULL, NULL);
+  if (!self) {
+    // Forward exception
+    return NULL;
+  }
+
+  // Take references on parameter objects
+  Py_INCREF(tracker);
+
+  self->number = number;
+  self->tracker = tracker;
+  self->track = tracker_get_track(tracker->tracker, number);
+
+  return self;
+}
+
+/**
+ * Check that a Track object still refers to a live track.
+ *
+ * Track numbers are never reused, so a slot that has moved on to another
+ * track no longer matches the number.
+ *
+ * @param self The Track object
+ * @return Nonzero if it does, otherwise zero
+ */
+static int Track__is_active(TrackObject* self) {
+  return self->track && self->track->active && self->track->number == self->number;
+}
+
+static PyObject* Track_getter_number(TrackObject* self, void* closure) {
+  return PyLong_FromLong(self->number);
+}
+
+static PyObject* Track_getter_active(TrackObject* self, void* closure) {
+  return PyBool_FromLong(Track__is_active(self));
+}
+
+static PyObject* Track_getter_bbox(TrackObject* self, void* closure) {
+  // A lost track's slot may already hold another track
+  if (!Track__is_active(self)) {
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+
+  // Expose (x, y, w, h) as four ints
+  return TrackView__memoryview((PyObject*) self, (void*) &self->track->bbox, "i", sizeof(int), 4);
+}
+
+static PyObject* Track_getter_timestamp(TrackObject* self, void* closure) {
+  // A lost track's slot may already hold another track
+  if (!Track__is_active(self)) {
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+
+  // Expose the capture time of the frame the face was last seen in as a single long long
+  return TrackView__memoryview((PyObject*) self, (void*) &self->track->bbox.timestamp, "q", sizeof(long long), 1);
+}
+
+static PyObject* Track_getter_identity(TrackObject* self, void* closure) {
+  // A lost track's slot may already hold another track
+  if (!Track__is_active(self)) {
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+
+  // Expose the embedding as 128 doubles
+  return TrackView__memoryview((PyObject*) self, (void*) self->track->identity, "d", sizeof(double),
+    sizeof(tracker_identity) / sizeof(double));
+}
+
+static PyObject* Track_getter_confidence(TrackObject* self, void* closure) {
+  // A lost track's slot may already hold another track
+  if (!Track__is_active(self)) {
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+
+  // Expose the confidence as a single float
+  return TrackView__memoryview((PyObject*) self, (void*) &self->track->confidence, "f", sizeof(float), 1);
+}
+
+static PyObject* Track_getter_face(TrackObject* self, void* closure) {
+  // A lost track's slot may already hold another track
+  if (!Track__is_active(self)) {
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+
+  // Create bytes object for the crop (new reference)
+  PyObject* face = PyBytes_FromStringAndSize(NULL, 3 * TRACKER_FACE_SIZE * TRACKER_FACE_SIZE);
+  if (!face) {
+    // Forward exception
+    return NULL;
+  }
+
+  // References:
+  //  - face (keep on success)
+
+  // Copy the newest crop in (a copy, as recognition overwrites it in place)
+  if (tracker_read_face(self->tracker->tracker, self->number, (unsigned char*) PyBytes_AS_STRING(face), NULL)) {
+    // Release references
+    Py_DECREF(face);
+
+    // Recognition has not cropped this face yet
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+
+  return face;
+}
+
+/** Getters and setters for base.Track class. */
+static PyGetSetDef Track_getset[] = {
+  {
+    .name = "number",
+    .get = (getter) &Track_getter_number,
+  },
+  {
+    .name = "active",
+    .get = (getter) &Track_getter_active,
+  },
+  {
+    .name = "bbox",
+    .get = (getter) &Track_getter_bbox,
+  },
+  {
+    .name = "timestamp",
+    .get = (getter) &Track_getter_timestamp,
+  },
+  {
+    .name = "identity",
+    .get = (getter) &Track_getter_identity,
+  },
+  {
+    .name = "confidence",
+    .get = (getter) &Track_getter_confidence,
+  },
+  {
+    .name = "face",
+    .get = (getter) &Track_getter_face,
+  },
+  {
+  },
+};
+
 /** The Track class. */
 static PyTypeObject TrackType = {
   PyVarObject_HEAD_INIT(NULL, 0)
@@ -205,25 +642,11 @@ static PyTypeObject TrackType = {
   .tp_itemsize = 0,
   .tp_dealloc = (destructor) &TrackObject_dealloc,
   .tp_flags = Py_TPFLAGS_DEFAULT,
+  .tp_getset = Track_getset,
   .tp_init = (initproc) &TrackObject_init,
-  .tp_new = &PyType_GenericNew,
+  .tp_new = &TrackObject_new,
 };
 
-
-//
-// base.Tracker class
-//
-// Part of base extension module.
-//
-
-/** An instance of the Tracker class. */
-typedef struct {
-  PyObject_HEAD
-
-  /** The face tracker. */
-  struct tracker* tracker;
-} TrackerObject;
-
 //
 // base.FutureTrack class
 //
@@ -282,7 +705,11 @@ static PyObject* FutureTrackIterator_iternext(FutureTrackIteratorObject* self) {
   // If an event was returned
   if (evt) {
     // Create track object (new reference)
-    TrackObject* track = (TrackObject*) PyObject_CallObject((PyObject*) &TrackType, NULL);
+    TrackObject* track = Track__create(self->future->tracker, evt->track);
+
+    // We're done with the event
+    tracker_event_release(evt);
+
     if (!track) {
       // Forward exception
       return NULL;
@@ -291,9 +718,6 @@ static PyObject* FutureTrackIterator_iternext(FutureTrackIteratorObject* self) {
     // References:
     //   - track (keep on success)
 
-    // Store track number
-    track->number = evt->track;
-
     // Create StopIteration exception (new reference)
     PyObject* exc = PyObject_CallObject(PyExc_StopIteration, NULL);
     if (!exc) {
@@ -399,6 +823,98 @@ static PyTypeObject FutureTrackType = {
   .tp_new = &PyType_GenericNew,
 };
 
+//
+// base.EventArray class
+//
+// Part of base extension module.
+//
+
+/**
+ * The PEP 3118 format of a tracker event record.
+ *
+ * This spells out struct tracker_event_record field by field, so numpy turns
+ * an event array into a structured array with named fields.
+ */
+#define EVENT_ARRAY_FORMAT \
+  "T{=Q:seq:i:type:i:track:i:bbox_x:i:bbox_y:i:bbox_w:i:bbox_h:q:bbox_timestamp:i:bbox_old_x:i:bbox_old_y:" \
+  "i:bbox_old_w:i:bbox_old_h:q:bbox_old_timestamp:i:registration:f:confidence:i:version:i:reserved:}"
+
+/**
+ * An instance of the EventArray class.
+ *
+ * This holds drained tracker events inline. It exposes them through the buffer
+ * protocol, so numpy.asarray() makes a structured array over it without a copy.
+ */
+typedef struct {
+  PyObject_VAR_HEAD
+
+  /** The number of events (as handed out through the buffer protocol). */
+  Py_ssize_t shape[1];
+
+  /** The event stride (as handed out through the buffer protocol). */
+  Py_ssize_t strides[1];
+
+  /** The events. */
+  struct tracker_event_record events[];
+} EventArrayObject;
+
+static void EventArray_dealloc(EventArrayObject* self) {
+  Py_TYPE(self)->tp_free(self);
+}
+
+static Py_ssize_t EventArray_length(EventArrayObject* self) {
+  return Py_SIZE(self);
+}
+
+static int EventArray_getbuffer(EventArrayObject* self, Py_buffer* view, int flags) {
+  // Drained events are a snapshot, so refuse writers
+  if (flags & PyBUF_WRITABLE) {
+    PyErr_SetString(PyExc_BufferError, "event arrays are read-only");
+    view->obj = NULL;
+    return -1;
+  }
+
+  self->shape[0] = Py_SIZE(self);
+  self->strides[0] = sizeof(struct tracker_event_record);
+
+  view->buf = self->events;
+  view->obj = (PyObject*) self;
+  view->len = Py_SIZE(self) * (Py_ssize_t) sizeof(struct tracker_event_record);
+  view->readonly = 1;
+  view->itemsize = sizeof(struct tracker_event_record);
+  view->format = (flags & PyBUF_FORMAT) ? EVENT_ARRAY_FORMAT : NULL;
+  view->ndim = 1;
+  view->shape = (flags & PyBUF_ND) ? self->shape : NULL;
+  view->strides = (flags & PyBUF_STRIDES) ? self->strides : NULL;
+  view->suboffsets = NULL;
+  view->internal = NULL;
+
+  Py_INCREF(self);
+  return 0;
+}
+
+/** Sequence methods for base.EventArray class. */
+static PySequenceMethods EventArray_as_sequence = {
+  .sq_length = (lenfunc) &EventArray_length,
+};
+
+/** Buffer protocol for base.EventArray class. */
+static PyBufferProcs EventArray_as_buffer = {
+  .bf_getbuffer = (getbufferproc) &EventArray_getbuffer,
+};
+
+/** The EventArray class. */
+static PyTypeObject EventArrayType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  .tp_name = "base.EventArray",
+  .tp_basicsize = sizeof(EventArrayObject),
+  .tp_itemsize = sizeof(struct tracker_event_record),
+  .tp_dealloc = (destructor) &EventArray_dealloc,
+  .tp_as_sequence = &EventArray_as_sequence,
+  .tp_as_buffer = &EventArray_as_buffer,
+  .tp_flags = Py_TPFLAGS_DEFAULT,
+};
+
 //
 // base.Tracker class (cont.)
 //
@@ -408,25 +924,35 @@ static PyTypeObject FutureTrackType = {
 static int Tracker_init(TrackerObject* self, PyObject* args, PyObject* kwds) {
   // Create face tracker
   self->tracker = tracker_new();
+  if (!self->tracker) {
+    PyErr_SetString(PyExc_RuntimeError, "unable to start face tracker");
+    return -1;
+  }
 
   return 0;
 }
 
 static void Tracker_dealloc(TrackerObject* self) {
-  // Destroy face tracker
-  tracker_delete(self->tracker);
+  // Destroy face tracker, if it was ever created
+  if (self->tracker) {
+    tracker_delete(self->tracker);
+  }
 
   Py_TYPE(self)->tp_free(self);
 }
 
 PyObject* Tracker_push_camera(TrackerObject* self, PyObject* args) {
-  // Unpack PIL image frame (no reference)
+  // Unpack PIL image frame (no reference) and capture time
   PyObject* image;
-  if (!PyArg_ParseTuple(args, "O", &image)) {
+  long long timestamp = 0;
+  if (!PyArg_ParseTuple(args, "O|L", &image, &timestamp)) {
     // Forward exception
     return NULL;
   }
 
+  trace_begin("Tracker_push_camera");
+  LOCKPROF_GIL_HOLD_BEGIN();
+
   // Acquire reference on image
   Py_INCREF(image);
 
@@ -439,6 +965,9 @@ PyObject* Tracker_push_camera(TrackerObject* self, PyObject* args) {
     // Release references
     Py_DECREF(image);
 
+    LOCKPROF_GIL_HOLD_END();
+    trace_end();
+
     // Forward exception
     return NULL;
   }
@@ -454,6 +983,9 @@ PyObject* Tracker_push_camera(TrackerObject* self, PyObject* args) {
     Py_DECREF(tobytes);
     Py_DECREF(image);
 
+    LOCKPROF_GIL_HOLD_END();
+    trace_end();
+
     // Forward exception
     return NULL;
   }
@@ -471,6 +1003,9 @@ PyObject* Tracker_push_camera(TrackerObject* self, PyObject* args) {
     Py_DECREF(tobytes);
     Py_DECREF(image);
 
+    LOCKPROF_GIL_HOLD_END();
+    trace_end();
+
     // Forward exception
     return NULL;
   }
@@ -490,6 +1025,9 @@ PyObject* Tracker_push_camera(TrackerObject* self, PyObject* args) {
     Py_DECREF(tobytes);
     Py_DECREF(image);
 
+    LOCKPROF_GIL_HOLD_END();
+    trace_end();
+
     // Forward exception
     return NULL;
   }
@@ -512,7 +1050,7 @@ PyObject* Tracker_push_camera(TrackerObject* self, PyObject* args) {
 
   // Submit image as the tracking frame
   // The tracker will do a copy, so we don't have to
-  tracker_submit_frame(self->tracker, width, height, data);
+  tracker_submit_frame(self->tracker, width, height, data, timestamp);
 
   // Release references
   Py_DECREF(image_height);
@@ -521,6 +1059,75 @@ PyObject* Tracker_push_camera(TrackerObject* self, PyObject* args) {
   Py_DECREF(tobytes);
   Py_DECREF(image);
 
+  LOCKPROF_GIL_HOLD_END();
+  trace_end();
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+PyObject* Tracker_push_jpeg(TrackerObject* self, PyObject* args) {
+  // Unpack JPEG data, scale, and capture time
+  Py_buffer jpeg;
+  int scale = 1;
+  long long timestamp = 0;
+  if (!PyArg_ParseTuple(args, "y*|iL", &jpeg, &scale, &timestamp)) {
+    // Forward exception
+    return NULL;
+  }
+
+  // References:
+  //  - jpeg (buffer)
+
+  if (scale != 1 && scale != 2 && scale != 4 && scale != 8) {
+    // Release references
+    PyBuffer_Release(&jpeg);
+
+    PyErr_SetString(PyExc_ValueError, "scale must be 1, 2, 4, or 8");
+    return NULL;
+  }
+
+  // Decode the frame straight into the tracker
+  // The buffer stays put while we hold it, so let other Python threads run
+  int rc;
+  LOCKPROF_BEGIN_ALLOW_THREADS
+  rc = jpegdec_to_tracker(self->tracker, jpeg.buf, (size_t) jpeg.len, scale, timestamp);
+  LOCKPROF_END_ALLOW_THREADS
+
+  // Release references
+  PyBuffer_Release(&jpeg);
+
+  if (rc) {
+    PyErr_SetString(PyExc_ValueError, "unable to decode JPEG frame");
+    return NULL;
+  }
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+PyObject* Tracker_attach_ring(TrackerObject* self, PyObject* args) {
+  // Unpack segment name, frame size, and slot count
+  const char* name;
+  int width;
+  int height;
+  unsigned int slots = 4;
+  if (!PyArg_ParseTuple(args, "sii|I", &name, &width, &height, &slots)) {
+    // Forward exception
+    return NULL;
+  }
+
+  if (width <= 0 || height <= 0) {
+    PyErr_SetString(PyExc_ValueError, "frame size must be positive");
+    return NULL;
+  }
+
+  // Size the slots for the biggest RGB24 frame the capture side will write
+  if (tracker_attach_ring(self->tracker, name, slots, (size_t) 3 * width * height)) {
+    PyErr_Format(PyExc_RuntimeError, "unable to attach frame ring %s", name);
+    return NULL;
+  }
+
   Py_INCREF(Py_None);
   return Py_None;
 }
@@ -536,6 +1143,114 @@ PyObject* Tracker_wait_for_new_track(TrackerObject* self, PyObject* args) {
   return (PyObject*) future;
 }
 
+PyObject* Tracker_drain(TrackerObject* self, PyObject* args) {
+  LOCKPROF_GIL_HOLD_BEGIN();
+
+  // Size the array for everything pending now
+  // Events that arrive in the meantime wait for the next drain
+  size_t num = tracker_pending_events(self->tracker);
+
+  // Create event array object (new reference)
+  EventArrayObject* array = PyObject_NewVar(EventArrayObject, &EventArrayType, (Py_ssize_t) num);
+  if (!array) {
+    LOCKPROF_GIL_HOLD_END();
+
+    // Forward exception
+    return NULL;
+  }
+
+  // Drain the events straight into the array
+  // Nobody else drains this tracker, but a poll may have taken some in the meantime
+  Py_SET_SIZE(array, (Py_ssize_t) tracker_drain_events(self->tracker, array->events, num));
+
+  LOCKPROF_GIL_HOLD_END();
+  return (PyObject*) array;
+}
+
+PyObject* Tracker_stats(TrackerObject* self, PyObject* args) {
+  struct tracker_stats stats;
+  tracker_get_stats(self->tracker, &stats);
+
+  return Py_BuildValue("{s:K,s:K,s:K,s:d,s:i,s:K,s:K,s:K,s:K}",
+    "frames", stats.frames,
+    "frames_dropped", stats.frames_dropped,
+    "frames_stale", stats.frames_stale,
+    "fps", stats.fps,
+    "faces", stats.faces,
+    "faces_total", stats.faces_total,
+    "copy_ns", stats.copy_ns,
+    "detect_ns", stats.detect_ns,
+    "track_ns", stats.track_ns);
+}
+
+static PyObject* Tracker_getter_ready(TrackerObject* self, void* closure) {
+  return PyBool_FromLong(tracker_ready(self->tracker));
+}
+
+static PyObject* Tracker_getter_frame_pending(TrackerObject* self, void* closure) {
+  return PyBool_FromLong(tracker_frame_pending(self->tracker));
+}
+
+static PyObject* Tracker_getter_wants_frame(TrackerObject* self, void* closure) {
+  return PyBool_FromLong(tracker_wants_frame(self->tracker));
+}
+
+static PyObject* Tracker_getter_deadline(TrackerObject* self, void* closure) {
+  long long deadline_ns = tracker_get_deadline(self->tracker);
+  if (!deadline_ns) {
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+
+  return PyFloat_FromDouble((double) deadline_ns / 1e9);
+}
+
+static int Tracker_setter_deadline(TrackerObject* self, PyObject* value, void* closure) {
+  // Deleting or clearing the deadline turns it off
+  if (!value || value == Py_None) {
+    tracker_set_deadline(self->tracker, 0);
+    return 0;
+  }
+
+  // Unpack the deadline in seconds
+  double deadline = PyFloat_AsDouble(value);
+  if (deadline == -1.0 && PyErr_Occurred()) {
+    // Forward exception
+    return -1;
+  }
+
+  if (deadline <= 0) {
+    PyErr_SetString(PyExc_ValueError, "deadline must be positive");
+    return -1;
+  }
+
+  tracker_set_deadline(self->tracker, (long long) (deadline * 1e9));
+  return 0;
+}
+
+/** Getters and setters for base.Tracker class. */
+static PyGetSetDef Tracker_getset[] = {
+  {
+    .name = "ready",
+    .get = (getter) &Tracker_getter_ready,
+  },
+  {
+    .name = "frame_pending",
+    .get = (getter) &Tracker_getter_frame_pending,
+  },
+  {
+    .name = "wants_frame",
+    .get = (getter) &Tracker_getter_wants_frame,
+  },
+  {
+    .name = "deadline",
+    .get = (getter) &Tracker_getter_deadline,
+    .set = (setter) &Tracker_setter_deadline,
+  },
+  {
+  },
+};
+
 /** Methods for base.Tracker class. */
 static PyMethodDef Tracker_methods[] = {
   {
@@ -543,11 +1258,31 @@ static PyMethodDef Tracker_methods[] = {
     .ml_meth = (PyCFunction) Tracker_push_camera,
     .ml_flags = METH_VARARGS,
   },
+  {
+    .ml_name = "push_jpeg",
+    .ml_meth = (PyCFunction) Tracker_push_jpeg,
+    .ml_flags = METH_VARARGS,
+  },
+  {
+    .ml_name = "attach_ring",
+    .ml_meth = (PyCFunction) Tracker_attach_ring,
+    .ml_flags = METH_VARARGS,
+  },
   {
     .ml_name = "wait_for_new_track",
     .ml_meth = (PyCFunction) Tracker_wait_for_new_track,
     .ml_flags = METH_VARARGS,
   },
+  {
+    .ml_name = "drain",
+    .ml_meth = (PyCFunction) Tracker_drain,
+    .ml_flags = METH_NOARGS,
+  },
+  {
+    .ml_name = "stats",
+    .ml_meth = (PyCFunction) Tracker_stats,
+    .ml_flags = METH_NOARGS,
+  },
   {
   },
 };
@@ -561,6 +1296,7 @@ static PyTypeObject TrackerType = {
   .tp_dealloc = (destructor) &Tracker_dealloc,
   .tp_flags = Py_TPFLAGS_DEFAULT,
   .tp_methods = Tracker_methods,
+  .tp_getset = Tracker_getset,
   .tp_init = (initproc) &Tracker_init,
   .tp_new = &PyType_GenericNew,
 };
@@ -569,11 +1305,270 @@ static PyTypeObject TrackerType = {
 // base extension module
 //
 
-/** The monitor map. */
-static khash_t(i2py)* map_monitor;
+/** A registered robot. */
+struct base__robot {
+  /** The robot ID. */
+  int robot_id;
+
+  /** The monitor. */
+  MonitorObject* monitor;
+
+  /** The tracker. */
+  TrackerObject* tracker;
+};
+
+/**
+ * The robot registry.
+ *
+ * Python threads read and change this with the GIL held. The metrics thread
+ * also reads it, without the GIL (see base__collect_metrics()), and that is
+ * why lookups go through lock-free read sections rather than relying on the
+ * GIL: a scrape never waits on Python, and Python never waits on a scrape.
+ */
+static struct registry* robots;
+
+/** The robot handle for this thread's last lookup. */
+static __thread struct registry_handle robot_handle;
+
+/**
+ * Tear down a robot once it is out of the registry.
+ *
+ * This is called with the GIL held.
+ *
+ * @param value The robot
+ * @param user Not used
+ */
+static void base__robot_free(void* value, void* user) {
+  struct base__robot* robot = value;
+
+  // Stop the tracker threads now, even if Python still holds the tracker
+  // The robot is already out of the registry, so let other Python threads run while the threads wind down
+  LOCKPROF_BEGIN_ALLOW_THREADS
+  tracker_stop(robot->tracker->tracker);
+  LOCKPROF_END_ALLOW_THREADS
+
+  // Give up the shared-memory state slot
+  if (robot->monitor->state) {
+    state_release(robot->monitor->state);
+    robot->monitor->state = NULL;
+  }
+
+  // Release references
+  Py_DECREF(robot->tracker);
+  Py_DECREF(robot->monitor);
+
+  free(robot);
+}
+
+/** The counters for one robot, as gathered for a metrics scrape. */
+struct base__robot_metrics {
+  /** The robot ID. */
+  int robot_id;
+
+  /** The tracker counters. */
+  struct tracker_stats tracker;
+
+  /** The number of readings pushed on each telemetry channel. */
+  unsigned long long samples[telemetry_channel__count];
+};
+
+/** The robot counters for a metrics scrape. */
+struct base__metrics_scrape {
+  /** The robot counters. */
+  struct base__robot_metrics* robots;
+
+  /** The number of robots. */
+  size_t num;
+
+  /** The capacity of robots. */
+  size_t cap;
+};
+
+/**
+ * Gather the counters for one robot.
+ *
+ * This runs on the metrics thread without the GIL, inside a registry read
+ * section, so it only reads counters that are safe to read lock-free.
+ *
+ * @param robot_id The robot ID
+ * @param value The robot
+ * @param user The scrape
+ */
+static void base__gather_robot_metrics(int robot_id, void* value, void* user) {
+  struct base__robot* robot = value;
+  struct base__metrics_scrape* scrape = user;
+
+  if (scrape->num == scrape->cap) {
+    scrape->cap = scrape->cap ? 2 * scrape->cap : 8;
+    scrape->robots = realloc(scrape->robots, scrape->cap * sizeof(struct base__robot_metrics));
+  }
+
+  struct base__robot_metrics* metrics = &scrape->robots[scrape->num++];
+  metrics->robot_id = robot_id;
+  tracker_get_stats(robot->tracker->tracker, &metrics->tracker);
+  for (int channel = 0; channel < telemetry_channel__count; ++channel) {
+    metrics->samples[channel] = __atomic_load_n(&robot->monitor->samples[channel], __ATOMIC_RELAXED);
+  }
+}
+
+/**
+ * Collect per-robot metrics.
+ *
+ * @param out The scrape
+ * @param user Not used
+ */
+static void base__collect_metrics(struct metrics_out* out, void* user) {
+  static const char* const channels[] = {"battery", "accelerometer", "gyroscope", "wheel_speeds"};
+
+  struct registry* registry = __atomic_load_n(&robots, __ATOMIC_ACQUIRE);
+  if (!registry) {
+    return;
+  }
+
+  // Gather everything up front, so the read section stays short
+  struct base__metrics_scrape scrape = {0};
+  unsigned int token = registry_read_lock(registry);
+  registry_for_each(registry, &base__gather_robot_metrics, &scrape);
+  registry_read_unlock(registry, token);
+
+  metrics_family(out, "cozmonaut_tracker_frames_total", "counter", "Frames processed by the face detector.");
+  for (size_t i = 0; i < scrape.num; ++i) {
+    metrics_printf(out, "cozmonaut_tracker_frames_total{robot=\"%d\"} %llu\n", scrape.robots[i].robot_id,
+      scrape.robots[i].tracker.frames);
+  }
+
+  metrics_family(out, "cozmonaut_tracker_frames_dropped_total", "counter",
+    "Frames replaced or skipped before the face detector got to them.");
+  for (size_t i = 0; i < scrape.num; ++i) {
+    metrics_printf(out, "cozmonaut_tracker_frames_dropped_total{robot=\"%d\"} %llu\n", scrape.robots[i].robot_id,
+      scrape.robots[i].tracker.frames_dropped);
+  }
+
+  metrics_family(out, "cozmonaut_tracker_frames_stale_total", "counter",
+    "Frames dropped for being older than the tracker deadline.");
+  for (size_t i = 0; i < scrape.num; ++i) {
+    metrics_printf(out, "cozmonaut_tracker_frames_stale_total{robot=\"%d\"} %llu\n", scrape.robots[i].robot_id,
+      scrape.robots[i].tracker.frames_stale);
+  }
+
+  metrics_family(out, "cozmonaut_tracker_fps", "gauge", "Smoothed face detection rate.");
+  for (size_t i = 0; i < scrape.num; ++i) {
+    metrics_printf(out, "cozmonaut_tracker_fps{robot=\"%d\"} %.3f\n", scrape.robots[i].robot_id,
+      scrape.robots[i].tracker.fps);
+  }
+
+  metrics_family(out, "cozmonaut_tracker_faces", "gauge", "Faces in the last processed frame.");
+  for (size_t i = 0; i < scrape.num; ++i) {
+    metrics_printf(out, "cozmonaut_tracker_faces{robot=\"%d\"} %d\n", scrape.robots[i].robot_id,
+      scrape.robots[i].tracker.faces);
+  }
+
+  metrics_family(out, "cozmonaut_tracker_faces_total", "counter", "Faces over all processed frames.");
+  for (size_t i = 0; i < scrape.num; ++i) {
+    metrics_printf(out, "cozmonaut_tracker_faces_total{robot=\"%d\"} %llu\n", scrape.robots[i].robot_id,
+      scrape.robots[i].tracker.faces_total);
+  }
+
+  metrics_family(out, "cozmonaut_tracker_stage_seconds_total", "counter", "Time spent in each detection stage.");
+  for (size_t i = 0; i < scrape.num; ++i) {
+    const struct tracker_stats* stats = &scrape.robots[i].tracker;
+    int robot_id = scrape.robots[i].robot_id;
+    metrics_printf(out, "cozmonaut_tracker_stage_seconds_total{robot=\"%d\",stage=\"copy\"} %.6f\n", robot_id,
+      (double) stats->copy_ns / 1e9);
+    metrics_printf(out, "cozmonaut_tracker_stage_seconds_total{robot=\"%d\",stage=\"detect\"} %.6f\n", robot_id,
+      (double) stats->detect_ns / 1e9);
+    metrics_printf(out, "cozmonaut_tracker_stage_seconds_total{robot=\"%d\",stage=\"track\"} %.6f\n", robot_id,
+      (double) stats->track_ns / 1e9);
+  }
+
+  metrics_family(out, "cozmonaut_monitor_samples_total", "counter", "Monitor readings pushed by channel.");
+  for (size_t i = 0; i < scrape.num; ++i) {
+    for (int channel = 0; channel < telemetry_channel__count; ++channel) {
+      metrics_printf(out, "cozmonaut_monitor_samples_total{robot=\"%d\",channel=\"%s\"} %llu\n",
+        scrape.robots[i].robot_id, channels[channel], scrape.robots[i].samples[channel]);
+    }
+  }
+
+  free(scrape.robots);
+}
+
+/** The IDs of the registered robots. */
+struct base__robot_ids {
+  /** The robot IDs. */
+  int* ids;
+
+  /** The number of robot IDs. */
+  size_t num;
+
+  /** The capacity of ids. */
+  size_t cap;
+};
+
+/**
+ * Gather the ID of a robot.
+ *
+ * @param robot_id The robot ID
+ * @param value The robot
+ * @param user The robot IDs
+ */
+static void base__gather_robot_id(int robot_id, void* value, void* user) {
+  struct base__robot_ids* ids = user;
+
+  if (ids->num == ids->cap) {
+    ids->cap = ids->cap ? 2 * ids->cap : 8;
+    ids->ids = realloc(ids->ids, ids->cap * sizeof(int));
+  }
+
+  ids->ids[ids->num++] = robot_id;
+}
+
+/**
+ * Remove every robot and destroy the robot registry.
+ *
+ * This is called with the GIL held, once nothing else scrapes the registry.
+ */
+static void base__remove_all_robots() {
+  if (!robots) {
+    return;
+  }
+
+  // Gather the IDs first, as robots cannot be removed inside a read section
+  struct base__robot_ids ids = {0};
+  unsigned int token = registry_read_lock(robots);
+  registry_for_each(robots, &base__gather_robot_id, &ids);
+  registry_read_unlock(robots, token);
+
+  // Remove the robots and stop their trackers
+  // Each removal lets other Python threads run, so the registry stays usable until the last one is gone
+  for (size_t i = 0; i < ids.num; ++i) {
+    registry_remove(robots, ids.ids[i]);
+  }
+
+  free(ids.ids);
+
+  // Destroy the registry
+  // Anything added meanwhile goes with it
+  struct registry* registry = robots;
+  __atomic_store_n(&robots, NULL, __ATOMIC_RELEASE);
+  registry_delete(registry);
+}
 
-/** The tracker map. */
-static khash_t(i2py)* map_tracker;
+/**
+ * Look up a robot.
+ *
+ * The registry only changes under the GIL, so with the GIL held the robot
+ * stays valid after the read section ends.
+ *
+ * @param robot_id The robot ID
+ * @return The robot, or NULL if the robot is unknown
+ */
+static struct base__robot* base__find_robot(int robot_id) {
+  unsigned int token = registry_read_lock(robots);
+  struct base__robot* robot = registry_handle_find(robots, &robot_handle, robot_id);
+  registry_read_unlock(robots, token);
+
+  return robot;
+}
 
 static PyObject* base_add_robot(PyObject* self, PyObject* args) {
   // Unpack robot ID (no reference)
@@ -583,6 +1578,12 @@ static PyObject* base_add_robot(PyObject* self, PyObject* args) {
     return NULL;
   }
 
+  // Refuse to replace a robot that is still registered
+  if (base__find_robot(robot_id)) {
+    PyErr_Format(PyExc_ValueError, "robot %d is already added", robot_id);
+    return NULL;
+  }
+
   // Create a new monitor object (new reference)
   MonitorObject* monitor = (MonitorObject*) PyObject_CallObject((PyObject*) &MonitorType, NULL);
   if (!monitor) {
@@ -593,6 +1594,15 @@ static PyObject* base_add_robot(PyObject* self, PyObject* args) {
   // References:
   //  - monitor (keep on success)
 
+  // Associate monitor with robot
+  monitor->robot_id = robot_id;
+
+  // Open a telemetry archive for the robot if archiving is enabled
+  const char* telemetry_dir = getenv("COZMONAUT_TELEMETRY_DIR");
+  if (telemetry_dir) {
+    monitor->telemetry = telemetry_open(telemetry_dir, robot_id);
+  }
+
   // Create a new tracker object (new reference)
   TrackerObject* tracker = (TrackerObject*) PyObject_CallObject((PyObject*) &TrackerType, NULL);
   if (!tracker) {
@@ -610,75 +1620,274 @@ static PyObject* base_add_robot(PyObject* self, PyObject* args) {
   //  - monitor (keep on success)
   //  - tracker (keep on success)
 
-  khiter_t it;
-  int ret;
+  // Hand the monitor and tracker over to the registry
+  struct base__robot* robot = malloc(sizeof(struct base__robot));
+  robot->robot_id = robot_id;
+  robot->monitor = monitor;
+  robot->tracker = tracker;
+
+  // Another thread may have added the same robot while we were not holding the GIL
+  if (registry_add(robots, robot_id, robot)) {
+    // Tear down our copy (releases the references)
+    base__robot_free(robot, NULL);
+
+    PyErr_Format(PyExc_ValueError, "robot %d is already added", robot_id);
+    return NULL;
+  }
+
+  // Publish robot state to shared memory if there is room
+  // This waits until the robot is ours, so a duplicate never takes a second slot
+  struct state_robot* state = state_claim(robot_id);
+  monitor->state = state;
+  tracker_set_state(tracker->tracker, state);
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject* base_remove_robot(PyObject* self, PyObject* args) {
+  // Unpack robot ID (no reference)
+  int robot_id;
+  if (!PyArg_ParseTuple(args, "i", &robot_id)) {
+    // Forward exception
+    return NULL;
+  }
+
+  // Remove the robot and stop its tracker
+  // Removing an unknown robot does nothing, so disconnect handlers need not check
+  registry_remove(robots, robot_id);
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject* base_get_monitor(PyObject* self, PyObject* args) {
+  // Unpack robot ID (no reference)
+  int robot_id;
+  if (!PyArg_ParseTuple(args, "i", &robot_id)) {
+    // Forward exception
+    return NULL;
+  }
+
+  // Look up robot
+  struct base__robot* robot = base__find_robot(robot_id);
+
+  // If no robot exists, return none
+  if (!robot) {
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+
+  // Return monitor
+  Py_INCREF(robot->monitor);
+  return (PyObject*) robot->monitor;
+}
+
+static PyObject* base_get_tracker(PyObject* self, PyObject* args) {
+  // Unpack robot ID (no reference)
+  int robot_id;
+  if (!PyArg_ParseTuple(args, "i", &robot_id)) {
+    // Forward exception
+    return NULL;
+  }
+
+  // Look up robot
+  struct base__robot* robot = base__find_robot(robot_id);
+
+  // If no robot exists, return none
+  if (!robot) {
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+
+  // Return tracker
+  Py_INCREF(robot->tracker);
+  return (PyObject*) robot->tracker;
+}
+
+static PyObject* base_trace_enabled(PyObject* self, PyObject* args) {
+  return PyBool_FromLong(trace__enabled);
+}
+
+static PyObject* base_trace_begin(PyObject* self, PyObject* args) {
+  // Unpack span name (no reference)
+  const char* name;
+  if (!PyArg_ParseTuple(args, "s", &name)) {
+    // Forward exception
+    return NULL;
+  }
+
+  // Names from Python don't outlive the call, so they need interning
+  if (trace__enabled) {
+    trace_begin(trace_intern(name));
+  }
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject* base_trace_end(PyObject* self, PyObject* args) {
+  trace_end();
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject* base_trace_dump(PyObject* self, PyObject* args) {
+  // Unpack optional file path (no reference)
+  const char* path = NULL;
+  if (!PyArg_ParseTuple(args, "|z", &path)) {
+    // Forward exception
+    return NULL;
+  }
+
+  // Dump without the GIL, as this writes out every ring
+  int rc;
+  LOCKPROF_BEGIN_ALLOW_THREADS
+  rc = trace_dump(path);
+  LOCKPROF_END_ALLOW_THREADS
+
+  if (rc) {
+    PyErr_SetString(PyExc_RuntimeError, "unable to dump trace");
+    return NULL;
+  }
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+/** State for collecting lock profile results. */
+struct base__lock_stats_ctx {
+  /** The list of call sites. */
+  PyObject* sites;
+
+  /** Nonzero if an exception was raised. */
+  int failed;
+};
+
+/**
+ * Convert a lock profile histogram to a list.
+ *
+ * @param hist The histogram
+ * @return The list (new reference), or NULL on failure
+ */
+static PyObject* base__lock_hist(const unsigned long long* hist) {
+  // Create list (new reference)
+  PyObject* list = PyList_New(LOCKPROF_BUCKETS);
+  if (!list) {
+    // Forward exception
+    return NULL;
+  }
+
+  for (int i = 0; i < LOCKPROF_BUCKETS; ++i) {
+    // Create count (new reference)
+    PyObject* count = PyLong_FromUnsignedLongLong(hist[i]);
+    if (!count) {
+      // Release references
+      Py_DECREF(list);
 
-  // Key this robot ID into the monitor map
-  it = kh_put(i2py, map_monitor, (khint64_t) robot_id, &ret);
+      // Forward exception
+      return NULL;
+    }
 
-  // Store monitor object in monitor map
-  kh_val(map_monitor, robot_id) = (PyObject*) monitor;
+    // Steals count
+    PyList_SET_ITEM(list, i, count);
+  }
 
-  // Key this robot ID into the tracker map
-  it = kh_put(i2py, map_tracker, (khint64_t) robot_id, &ret);
+  return list;
+}
 
-  // Store tracker object in tracker map
-  kh_val(map_tracker, robot_id) = (PyObject*) tracker;
+/**
+ * Add one lock profile call site to the results.
+ *
+ * @param stats The call site statistics
+ * @param user The collection state
+ */
+static void base__lock_stats_visit(const struct lockprof_stats* stats, void* user) {
+  struct base__lock_stats_ctx* ctx = user;
+  if (ctx->failed) {
+    return;
+  }
 
-  // TODO: Clean up the maps
+  // Create site dictionary (new reference)
+  // The histograms are passed with N, so they are released if this fails
+  PyObject* site = Py_BuildValue("{s:s,s:s,s:i,s:K,s:K,s:K,s:K,s:K,s:K,s:N,s:N}",
+    "lock", stats->lock,
+    "file", stats->file,
+    "line", stats->line,
+    "acquisitions", stats->acquisitions,
+    "contended", stats->contended,
+    "wait_ns", stats->wait_ns,
+    "hold_ns", stats->hold_ns,
+    "wait_max_ns", stats->wait_max_ns,
+    "hold_max_ns", stats->hold_max_ns,
+    "wait_hist", base__lock_hist(stats->wait_hist),
+    "hold_hist", base__lock_hist(stats->hold_hist));
+  if (!site || PyList_Append(ctx->sites, site) < 0) {
+    // Release references
+    Py_XDECREF(site);
 
-  Py_INCREF(Py_None);
-  return Py_None;
+    // Forward exception
+    ctx->failed = 1;
+    return;
+  }
+
+  Py_DECREF(site);
 }
 
-static PyObject* base_get_monitor(PyObject* self, PyObject* args) {
-  // Unpack robot ID (no reference)
-  int robot_id;
-  if (!PyArg_ParseTuple(args, "i", &robot_id)) {
+static PyObject* base_lock_stats(PyObject* self, PyObject* args) {
+  // Create bucket bounds list (new reference)
+  PyObject* buckets = PyList_New(LOCKPROF_BUCKETS - 1);
+  if (!buckets) {
     // Forward exception
     return NULL;
   }
 
-  // Look up monitor for robot
-  khiter_t it = kh_get(i2py, map_monitor, (khint64_t) robot_id);
+  // References:
+  //  - buckets
 
-  // If no mapping exists, return none
-  if (it == kh_end(map_monitor)) {
-    Py_INCREF(Py_None);
-    return Py_None;
-  }
+  for (int i = 0; i < LOCKPROF_BUCKETS - 1; ++i) {
+    // Create bucket bound (new reference)
+    PyObject* bound = PyLong_FromUnsignedLongLong(lockprof_bucket_ns[i]);
+    if (!bound) {
+      // Release references
+      Py_DECREF(buckets);
 
-  // Get mapped monitor
-  MonitorObject* monitor = (MonitorObject*) kh_val(map_monitor, it);
+      // Forward exception
+      return NULL;
+    }
 
-  // Return monitor
-  Py_INCREF(monitor);
-  return (PyObject*) monitor;
-}
+    // Steals bound
+    PyList_SET_ITEM(buckets, i, bound);
+  }
+
+  // Create call site list (new reference)
+  struct base__lock_stats_ctx ctx = {PyList_New(0), 0};
+  if (!ctx.sites) {
+    // Release references
+    Py_DECREF(buckets);
 
-static PyObject* base_get_tracker(PyObject* self, PyObject* args) {
-  // Unpack robot ID (no reference)
-  int robot_id;
-  if (!PyArg_ParseTuple(args, "i", &robot_id)) {
     // Forward exception
     return NULL;
   }
 
-  // Look up tracker for robot
-  khiter_t it = kh_get(i2py, map_tracker, (khint64_t) robot_id);
+  // References:
+  //  - buckets
+  //  - ctx.sites
+
+  // Fill in the call sites (none unless built with COZMONAUT_LOCK_PROFILE)
+  lockprof_for_each(&base__lock_stats_visit, &ctx);
+  if (ctx.failed) {
+    // Release references
+    Py_DECREF(ctx.sites);
+    Py_DECREF(buckets);
 
-  // If no mapping exists, return none
-  if (it == kh_end(map_tracker)) {
-    Py_INCREF(Py_None);
-    return Py_None;
+    // Forward exception
+    return NULL;
   }
 
-  // Get mapped tracker
-  TrackerObject* tracker = (TrackerObject*) kh_val(map_tracker, it);
-
-  // Return tracker
-  Py_INCREF(tracker);
-  return (PyObject*) tracker;
+  // Steals both
+  return Py_BuildValue("{s:N,s:N}", "buckets_ns", buckets, "sites", ctx.sites);
 }
 
 /** Methods for base module. */
@@ -688,6 +1897,11 @@ static PyMethodDef base_methods[] = {
     .ml_meth = base_add_robot,
     .ml_flags = METH_VARARGS,
   },
+  {
+    .ml_name = "remove_robot",
+    .ml_meth = base_remove_robot,
+    .ml_flags = METH_VARARGS,
+  },
   {
     .ml_name = "get_monitor",
     .ml_meth = base_get_monitor,
@@ -698,6 +1912,31 @@ static PyMethodDef base_methods[] = {
     .ml_meth = base_get_tracker,
     .ml_flags = METH_VARARGS,
   },
+  {
+    .ml_name = "lock_stats",
+    .ml_meth = base_lock_stats,
+    .ml_flags = METH_NOARGS,
+  },
+  {
+    .ml_name = "trace_enabled",
+    .ml_meth = base_trace_enabled,
+    .ml_flags = METH_NOARGS,
+  },
+  {
+    .ml_name = "trace_begin",
+    .ml_meth = base_trace_begin,
+    .ml_flags = METH_VARARGS,
+  },
+  {
+    .ml_name = "trace_end",
+    .ml_meth = base_trace_end,
+    .ml_flags = METH_NOARGS,
+  },
+  {
+    .ml_name = "trace_dump",
+    .ml_meth = base_trace_dump,
+    .ml_flags = METH_VARARGS,
+  },
   {
   },
 };
@@ -742,6 +1981,18 @@ static PyMODINIT_FUNC PyInit_base() {
     return NULL;
   }
 
+  // Ensure TrackView type is ready
+  if (PyType_Ready(&TrackViewType) < 0) {
+    // Forward exception
+    return NULL;
+  }
+
+  // Ensure EventArray type is ready
+  if (PyType_Ready(&EventArrayType) < 0) {
+    // Forward exception
+    return NULL;
+  }
+
   // Create module instance
   PyObject* m = PyModule_Create(&base_module);
 
@@ -828,104 +2079,88 @@ static PyMODINIT_FUNC PyInit_base() {
   // References:
   //  - m (keep on success)
 
-  // Initialize monitor map
-  map_monitor = kh_init(i2py);
-
-  // Initialize tracker map
-  map_tracker = kh_init(i2py);
+  // Initialize robot registry
+  // The metrics thread may be looking for it already
+  if (!robots) {
+    __atomic_store_n(&robots, registry_new(&base__robot_free, NULL), __ATOMIC_RELEASE);
+  }
 
   return m;
 }
 
+//
+// Console redirect helpers
+//
+// Shared by the cstdout and cstderr extension modules.
+//
+
+/**
+ * Hand a batch of console lines to the logger.
+ *
+ * @param level The log level
+ * @param msg_fmt The message format string
+ * @param lines The lines
+ * @param num The number of lines
+ */
+static void console__log_lines(enum log_level level, const char* msg_fmt, const char* const* lines,
+  unsigned int num) {
+  struct log_record_msg_fmt_arg args[LINEBUF_BATCH];
+  struct log_record recs[LINEBUF_BATCH];
+
+  // Build one record per line, each pointing straight into the line buffer
+  for (unsigned int i = 0; i < num; ++i) {
+    args[i] = LOG_ARG_STR(lines[i]);
+    recs[i] = (struct log_record) {
+      .level = level,
+      .msg_fmt = msg_fmt,
+      .msg_fmt_args = &args[i],
+      .msg_fmt_args_num = 1,
+      .src_file = __FILE__,
+      .src_line = __LINE__,
+    };
+  }
+
+  log_submit_batch(recs, num);
+}
+
 //
 // cstdout extension module
 //
 
-/** The sys.stdout write buffer. */
-static __thread char* cstdout_buf;
+/** The sys.stdout line buffer. */
+static __thread struct linebuf cstdout_buf;
 
-/** The string length of the stdout buffer. */
-static __thread size_t cstdout_buf_len;
+/** Log a batch of stdout lines as info. */
+static void cstdout__lines(const char* const* lines, unsigned int num, void* user) {
+  console__log_lines(log_level_info, "(stdout) {}", lines, num);
+}
 
 static PyObject* cstdout_flush(PyObject* self, PyObject* args) {
-  // If text is buffered
-  if (cstdout_buf) {
-    // Log write-buffered text as info
-    LOGI("(stdout) {}", _str(cstdout_buf));
-
-    // Clear the write buffer
-    free(cstdout_buf);
-    cstdout_buf = NULL;
-    cstdout_buf_len = 0;
-  }
+  // Log any write-buffered text
+  linebuf_flush(&cstdout_buf, &cstdout__lines, NULL);
 
   Py_INCREF(Py_None);
   return Py_None;
 }
 
-static PyObject* cstdout_write(PyObject* self, PyObject* args) {
+static PyObject* cstdout_write(PyObject* self, PyObject* arg) {
+  LOCKPROF_GIL_HOLD_BEGIN();
+
   // Unpack string value (no reference)
-  char* string;
-  if (!PyArg_ParseTuple(args, "s", &string)) {
+  // This borrows the string's cached UTF-8 representation, so there is no copy
+  Py_ssize_t len;
+  const char* string = PyUnicode_AsUTF8AndSize(arg, &len);
+  if (!string) {
+    LOCKPROF_GIL_HOLD_END();
+
+    // Forward exception
     return NULL;
   }
 
-  // Get string length
-  size_t string_len = strlen(string);
-
-  // If the string has a newline
-  char* nl;
-  if ((nl = strchr(string, '\n')) != NULL) {
-    // Concatenate write-buffered text with first line of incoming text
-    size_t buf_len = cstdout_buf_len + (nl - string);
-    char* buf = malloc(buf_len + 1);
-    memcpy(buf, cstdout_buf, cstdout_buf_len);
-    memcpy(buf + cstdout_buf_len, string, string_len);
-    buf[buf_len] = '\0';
-
-    // Clear the write buffer
-    free(cstdout_buf);
-    cstdout_buf = NULL;
-    cstdout_buf_len = 0;
-
-    // Log first line as info
-    LOGI("(stdout) {}", _str(buf));
-
-    // Free the concat buffer
-    free(buf);
-
-    // If text remains
-    if (nl + 1 != string + string_len) {
-      // Log intermediary lines
-      char* line_begin = nl + 1;
-      char* line_end = strchr(line_begin, '\n');
-      while (line_end != NULL) {
-        // Slice line and log it as info
-        *line_end = '\0';
-        LOGI("(stdout) {}", _str(line_begin));
-        *line_end = '\n';
-
-        // Advance to next line
-        line_begin = line_end + 1;
-        line_end = strchr(line_begin, '\n');
-      }
-
-      // If even more text remains, buffer it
-      if (line_begin) {
-        cstdout_buf_len = (string + string_len) - line_begin;
-        cstdout_buf = malloc(cstdout_buf_len + 1);
-        memcpy(cstdout_buf, line_begin, cstdout_buf_len);
-        cstdout_buf[cstdout_buf_len] = '\0';
-      }
-    }
-  } else {
-    // The string has no newline
-    // Buffer the whole string for later
-    cstdout_buf = realloc(cstdout_buf, cstdout_buf_len + string_len + 1);
-    memcpy(cstdout_buf + cstdout_buf_len, string, string_len);
-    cstdout_buf_len += string_len;
-    cstdout_buf[cstdout_buf_len] = '\0';
-  }
+  // Buffer the text and log any complete lines
+  linebuf_write(&cstdout_buf, string, (size_t) len, &cstdout__lines, NULL);
+
+  LOCKPROF_GIL_HOLD_END();
 
   Py_INCREF(Py_None);
   return Py_None;
@@ -941,7 +2176,7 @@ static PyMethodDef cstdout_methods[] = {
   {
     .ml_name = "write",
     .ml_meth = cstdout_write,
-    .ml_flags = METH_VARARGS,
+    .ml_flags = METH_O,
   },
   {},
 };
@@ -963,91 +2198,40 @@ static PyMODINIT_FUNC PyInit_cstdout() {
 // cstderr extension module
 //
 
-/** The sys.stderr write buffer. */
-static __thread char* cstderr_buf;
+/** The sys.stderr line buffer. */
+static __thread struct linebuf cstderr_buf;
 
-/** The string length of the stderr buffer. */
-static __thread size_t cstderr_buf_len;
+/** Log a batch of stderr lines as errors. */
+static void cstderr__lines(const char* const* lines, unsigned int num, void* user) {
+  console__log_lines(log_level_error, "(stderr) {}", lines, num);
+}
 
 static PyObject* cstderr_flush(PyObject* self, PyObject* args) {
-  // If text is buffered
-  if (cstderr_buf) {
-    // Log write-buffered text as an error
-    LOGE("(stderr) {}", _str(cstderr_buf));
-
-    // Clear the write buffer
-    free(cstderr_buf);
-    cstderr_buf = NULL;
-    cstderr_buf_len = 0;
-  }
+  // Log any write-buffered text
+  linebuf_flush(&cstderr_buf, &cstderr__lines, NULL);
 
   Py_INCREF(Py_None);
   return Py_None;
 }
 
-static PyObject* cstderr_write(PyObject* self, PyObject* args) {
+static PyObject* cstderr_write(PyObject* self, PyObject* arg) {
+  LOCKPROF_GIL_HOLD_BEGIN();
+
   // Unpack string value (no reference)
-  char* string;
-  if (!PyArg_ParseTuple(args, "s", &string)) {
+  // This borrows the string's cached UTF-8 representation, so there is no copy
+  Py_ssize_t len;
+  const char* string = PyUnicode_AsUTF8AndSize(arg, &len);
+  if (!string) {
+    LOCKPROF_GIL_HOLD_END();
+
+    // Forward exception
     return NULL;
   }
 
-  // Get string length
-  size_t string_len = strlen(string);
-
-  // If the string has a newline
-  char* nl;
-  if ((nl = strchr(string, '\n')) != NULL) {
-    // Concatenate write-buffered text with first line of incoming text
-    size_t buf_len = cstderr_buf_len + (nl - string);
-    char* buf = malloc(buf_len + 1);
-    memcpy(buf, cstderr_buf, cstderr_buf_len);
-    memcpy(buf + cstderr_buf_len, string, string_len);
-    buf[buf_len] = '\0';
-
-    // Clear the write buffer
-    free(cstderr_buf);
-    cstderr_buf = NULL;
-    cstderr_buf_len = 0;
-
-    // Log first line as an error
-    LOGE("(stderr) {}", _str(buf));
-
-    // Free the concat buffer
-    free(buf);
-
-    // If text remains
-    if (nl + 1 != string + string_len) {
-      // Log intermediary lines
-      char* line_begin = nl + 1;
-      char* line_end = strchr(line_begin, '\n');
-      while (line_end != NULL) {
-        // Slice line and log it as an error
-        *line_end = '\0';
-        LOGE("(stderr) {}", _str(line_begin));
-        *line_end = '\n';
-
-        // Advance to next line
-        line_begin = line_end + 1;
-        line_end = strchr(line_begin, '\n');
-      }
-
-      // If even more text remains, buffer it
-      if (line_begin) {
-        cstderr_buf_len = (string + string_len) - line_begin;
-        cstderr_buf = malloc(cstderr_buf_len + 1);
-        memcpy(cstderr_buf, line_begin, cstderr_buf_len);
-        cstderr_buf[cstderr_buf_len] = '\0';
-      }
-    }
-  } else {
-    // The string has no newline
-    // Buffer the whole string for later
-    cstderr_buf = realloc(cstderr_buf, cstderr_buf_len + string_len + 1);
-    memcpy(cstderr_buf + cstderr_buf_len, string, string_len);
-    cstderr_buf_len += string_len;
-    cstderr_buf[cstderr_buf_len] = '\0';
-  }
+  // Buffer the text and log any complete lines
+  linebuf_write(&cstderr_buf, string, (size_t) len, &cstderr__lines, NULL);
+
+  LOCKPROF_GIL_HOLD_END();
 
   Py_INCREF(Py_None);
   return Py_None;
@@ -1063,7 +2247,7 @@ static PyMethodDef cstderr_methods[] = {
   {
     .ml_name = "write",
     .ml_meth = cstderr_write,
-    .ml_flags = METH_VARARGS,
+    .ml_flags = METH_O,
   },
   {},
 };
@@ -1306,6 +2490,8 @@ static void exception() {
   }
 }
 
+#ifndef COZMONAUT_FROZEN
+
 /** Append paths. */
 static void append_paths() {
   // Import sys module (new reference)
@@ -1365,6 +2551,52 @@ static void append_paths() {
   Py_DECREF(sys);
 }
 
+#else
+
+/** Register the frozen cozmonaut package with the import system. */
+static void append_frozen_modules() {
+  // Count the modules already frozen into the interpreter
+  // These may include the import machinery itself, so they must be kept
+  size_t num_builtin = 0;
+  if (PyImport_FrozenModules) {
+    while (PyImport_FrozenModules[num_builtin].name) {
+      ++num_builtin;
+    }
+  }
+
+  // Count our modules
+  size_t num_ours = 0;
+  while (cozmonaut_frozen_modules[num_ours].name) {
+    ++num_ours;
+  }
+
+  // Build a combined table (with room for the terminator)
+  // This lives as long as the process does
+  struct _frozen* table = calloc(num_builtin + num_ours + 1, sizeof(struct _frozen));
+  if (num_builtin) {
+    memcpy(table, PyImport_FrozenModules, num_builtin * sizeof(struct _frozen));
+  }
+  memcpy(table + num_builtin, cozmonaut_frozen_modules, num_ours * sizeof(struct _frozen));
+
+  PyImport_FrozenModules = table;
+
+  LOGD("Using {} frozen cozmonaut modules", _ul(num_ours));
+}
+
+#endif // #ifndef COZMONAUT_FROZEN
+
+/**
+ * Get the milliseconds elapsed since a point in time.
+ *
+ * @param since The point in time (monotonic clock)
+ * @return The elapsed milliseconds
+ */
+static double client__elapsed_ms(const struct timespec* since) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double) (now.tv_sec - since->tv_sec) * 1e3 + (double) (now.tv_nsec - since->tv_nsec) / 1e6;
+}
+
 /** Python thread state for main thread. */
 static PyThreadState* main_thread_state;
 
@@ -1378,6 +2610,11 @@ static void python_init() {
   PyImport_AppendInittab("cstdout", PyInit_cstdout);
   PyImport_AppendInittab("cstderr", PyInit_cstderr);
 
+#ifdef COZMONAUT_FROZEN
+  // Serve our own package out of the executable
+  append_frozen_modules();
+#endif
+
   // Spin up the Python VM
   Py_Initialize();
 
@@ -1420,8 +2657,10 @@ static void python_init() {
   PySys_SetObject("stdout", cstdout);
   PySys_SetObject("stderr", cstderr);
 
+#ifndef COZMONAUT_FROZEN
   // Append known paths
   append_paths();
+#endif
 
   // Release references
   Py_DECREF(cstderr);
@@ -1436,6 +2675,10 @@ static void python_terminate() {
   // Restore main thread state
   PyEval_RestoreThread(main_thread_state);
 
+  // Tear down the robots still around
+  // Their trackers would otherwise outlive the VM and write to state slots after the segment is closed
+  base__remove_all_robots();
+
   // Kill the Python VM
   if (Py_FinalizeEx() < 0) {
     LOGW("Unable to finalize the Python VM");
@@ -1446,12 +2689,187 @@ static void python_terminate() {
 /** The client thread. */
 static pthread_t client__thread;
 
-/** The client instance mutex. */
-static pthread_mutex_t client__mutex;
+/** Nonzero once the client thread is running. Only touched on the service worker thread. */
+static int client__thread_started;
 
-/** The selected client operation. */
+/** The selected client operation. Only touched on the service worker thread. */
 static enum client_op client__selected_op;
 
+/** The command-line arguments for the selected operation (NULL-terminated, nullable). */
+static char** client__selected_argv;
+
+/** The exit code of the client operation. */
+static int client__exit_code;
+
+/**
+ * Create the arguments dictionary for an entry point.
+ *
+ * @return The dictionary (new reference), or NULL on failure
+ */
+static PyObject* client__make_args() {
+  // Create arguments dictionary (new reference)
+  PyObject* args = PyDict_New();
+  if (!args) {
+    // Forward exception
+    return NULL;
+  }
+
+  // References:
+  //  - args
+
+  // Create argument list (new reference)
+  PyObject* argv = PyList_New(0);
+  if (!argv) {
+    // Release references
+    Py_DECREF(args);
+
+    // Forward exception
+    return NULL;
+  }
+
+  // References:
+  //  - args
+  //  - argv
+
+  for (char** arg = client__selected_argv; arg && *arg; ++arg) {
+    // Decode argument (new reference)
+    PyObject* str = PyUnicode_DecodeFSDefault(*arg);
+    if (!str || PyList_Append(argv, str) < 0) {
+      // Release references
+      Py_XDECREF(str);
+      Py_DECREF(argv);
+      Py_DECREF(args);
+
+      // Forward exception
+      return NULL;
+    }
+
+    Py_DECREF(str);
+  }
+
+  // Add argument list to arguments dictionary
+  if (PyDict_SetItemString(args, "argv", argv) < 0) {
+    // Release references
+    Py_DECREF(argv);
+    Py_DECREF(args);
+
+    // Forward exception
+    return NULL;
+  }
+
+  // Release references
+  Py_DECREF(argv);
+
+  return args;
+}
+
+/**
+ * Load and run a Python entry point.
+ *
+ * @param code_load Python code to load the entry point as ep
+ * @return The exit code of the entry point
+ */
+static int client__run_entry_point(const char* code_load) {
+  // Python code to run the entry point for the operation
+  static const char PYTHON_CODE_RUN[] =
+    "ep_rc = ep.main(args)\n";
+
+  // Acquire GIL
+  PyGILState_STATE state;
+  LOCKPROF_GIL_ENSURE(state);
+
+  // Time the entry point load
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  // Import the __main__ module (borrowed reference)
+  PyObject* main = PyImport_AddModule("__main__");
+  if (!main) {
+    // Handle exception
+    exception();
+
+    // Release GIL
+    PyGILState_Release(state);
+    return 1;
+  }
+
+  // Get main module dictionary (borrowed reference)
+  PyObject* dict = PyModule_GetDict(main);
+
+  // Create arguments dictionary (new reference)
+  PyObject* args = client__make_args();
+  if (!args) {
+    // Handle exception
+    exception();
+
+    // Release GIL
+    PyGILState_Release(state);
+    return 1;
+  }
+
+  // References
+  //  - args
+
+  // Add arguments dictionary to module
+  if (PyDict_SetItemString(dict, "args", args) < 0) {
+    // Release references
+    Py_DECREF(args);
+
+    // Handle exception
+    exception();
+
+    // Release GIL
+    PyGILState_Release(state);
+    return 1;
+  }
+
+  // Load the entry point (new reference)
+  PyObject* result = PyRun_String(code_load, Py_file_input, dict, dict);
+  if (!result) {
+    // Release references
+    Py_DECREF(args);
+
+    // Handle exception
+    exception();
+
+    // Release GIL
+    PyGILState_Release(state);
+    return 1;
+  }
+
+  Py_DECREF(result);
+
+  LOGI("Entry point is loaded after {} ms", _d(client__elapsed_ms(&start)));
+
+  // Run the entry point (new reference)
+  result = PyRun_String(PYTHON_CODE_RUN, Py_file_input, dict, dict);
+  if (!result) {
+    // Release references
+    Py_DECREF(args);
+
+    // Handle exception
+    exception();
+
+    // Release GIL
+    PyGILState_Release(state);
+    return 1;
+  }
+
+  Py_DECREF(result);
+
+  // Pick up the exit code (borrowed reference)
+  PyObject* rc = PyDict_GetItemString(dict, "ep_rc");
+  int code = rc && PyLong_Check(rc) ? (int) PyLong_AsLong(rc) : 0;
+
+  // Release references
+  Py_DECREF(args);
+
+  // Release GIL
+  PyGILState_Release(state);
+
+  return code;
+}
+
 /**
  * Main function for the client thread.
  *
@@ -1459,15 +2877,13 @@ static enum client_op client__selected_op;
  * @return Not used
  */
 static void* client__thread_main(void* ptr) {
-  // Lock the instance mutex
-  pthread_mutex_lock(&client__mutex);
+  // Take our place before Python starts any threads of its own, so they inherit it
+  affinity_apply(affinity_role_python, "cz-python");
 
   // Cache selected operation
+  // It was set before this thread was created, so no lock is needed
   enum client_op op = client__selected_op;
 
-  // Unlock the instance mutex
-  pthread_mutex_unlock(&client__mutex);
-
   // Handle the operation
   switch (op) {
     case client_op_friend_list:
@@ -1476,107 +2892,16 @@ static void* client__thread_main(void* ptr) {
     case client_op_friend_remove:
       LOGF("FRIEND REMOVE NOT IMPLEMENTED");
       abort();
-    case client_op_interact: {
-      // Python code for the operation
-      static const char PYTHON_CODE[] =
+    case client_op_interact:
+      client__exit_code = client__run_entry_point(
         "from cozmonaut.entry_point.interact import EntryPointInteract\n"
-        "ep = EntryPointInteract()\n"
-        "ep.main(args)\n";
-
-      // Acquire GIL
-      PyGILState_STATE state = PyGILState_Ensure();
-
-      // Import the __main__ module (new reference)
-      PyObject* main = PyImport_AddModule("__main__");
-      if (!main) {
-        // Handle exception
-        exception();
-
-        // Release GIL
-        PyGILState_Release(state);
-        return NULL;
-      }
-
-      // References
-      //  - main
-
-      // Get main module dictionary (new reference)
-      PyObject* dict = PyModule_GetDict(main);
-      if (!dict) {
-        // Release references
-        Py_DECREF(main);
-
-        // Handle exception
-        exception();
-
-        // Release GIL
-        PyGILState_Release(state);
-        return NULL;
-      }
-
-      // References
-      //  - main
-      //  - dict
-
-      // Create arguments dictionary (new reference)
-      PyObject* args = PyDict_New();
-      if (!args) {
-        // Release references
-        Py_DECREF(dict);
-        Py_DECREF(main);
-
-        // Handle exception
-        exception();
-
-        // Release GIL
-        PyGILState_Release(state);
-        return NULL;
-      }
-
-      // References
-      //  - main
-      //  - dict
-      //  - args
-
-      // Add arguments dictionary to module
-      if (PyDict_SetItemString(dict, "args", args) < 0) {
-        // Release references
-        Py_DECREF(args);
-        Py_DECREF(dict);
-        Py_DECREF(main);
-
-        // Handle exception
-        exception();
-
-        // Release GIL
-        PyGILState_Release(state);
-        return NULL;
-      }
-
-      // Run the operation Python code
-      if (!PyRun_String(PYTHON_CODE, Py_file_input, dict, dict)) {
-        // Release references
-        Py_DECREF(args);
-        Py_DECREF(dict);
-        Py_DECREF(main);
-
-        // Handle exception
-        exception();
-
-        // Release GIL
-        PyGILState_Release(state);
-        return NULL;
-      }
-
-      // Release references
-      Py_DECREF(args);
-      Py_DECREF(dict);
-      Py_DECREF(main);
-
-      // Release GIL
-      PyGILState_Release(state);
+        "ep = EntryPointInteract()\n");
+      break;
+    case client_op_loadgen:
+      client__exit_code = client__run_entry_point(
+        "from cozmonaut.entry_point.loadgen import EntryPointLoadgen\n"
+        "ep = EntryPointLoadgen()\n");
       break;
-    }
   }
 
   return NULL;
@@ -1586,17 +2911,13 @@ static void* client__thread_main(void* ptr) {
  * Select the client operation.
  *
  * @param op The client operation
+ * @param argv The command-line arguments for the operation (NULL-terminated, nullable)
  * @return Zero on success, otherwise nonzero
  */
-static int client__call_select(enum client_op op) {
-  // Lock the instance mutex
-  pthread_mutex_lock(&client__mutex);
-
+static int client__call_select(enum client_op op, char** argv) {
   // Select operation
   client__selected_op = op;
-
-  // Unlock the instance mutex
-  pthread_mutex_unlock(&client__mutex);
+  client__selected_argv = argv;
 
   return 0;
 }
@@ -1607,14 +2928,40 @@ static int client__call_select(enum client_op op) {
  * @return Zero on success, otherwise nonzero
  */
 static int client__call_start() {
-  // Lock the instance mutex
-  pthread_mutex_lock(&client__mutex);
-
   // Start the client thread
-  pthread_create(&client__thread, NULL, &client__thread_main, NULL);
+  int err = pthread_create(&client__thread, NULL, &client__thread_main, NULL);
+  if (err) {
+    LOGE("Unable to spawn the client thread: {}", _str(strerror(err)));
+    return 1;
+  }
+
+  client__thread_started = 1;
+  return 0;
+}
+
+/**
+ * Wait for the client operation to finish.
+ *
+ * @param ret Where to put the exit code
+ * @return Zero on success, otherwise nonzero
+ */
+static int client__call_join(void** ret) {
+  // A client thread that never started has nothing to wait for, so the operation failed
+  if (!client__thread_started) {
+    if (ret) {
+      *ret = (void*) (intptr_t) 1;
+    }
+
+    return 1;
+  }
 
-  // Unlock the instance mutex
-  pthread_mutex_unlock(&client__mutex);
+  // Wait for the client thread to die
+  pthread_join(client__thread, NULL);
+  client__thread_started = 0;
+
+  if (ret) {
+    *ret = (void*) (intptr_t) client__exit_code;
+  }
 
   return 0;
 }
@@ -1622,35 +2969,65 @@ static int client__call_start() {
 void client_on_start(struct service* svc) {
   LOGI("Client service started");
 
+  // Open the shared-memory state segment for external monitoring tools
+  const char* state_name = getenv("COZMONAUT_STATE_SHM");
+  state_open(state_name ? state_name : STATE_DEFAULT_NAME);
+
   // Bring up our Python environment
   LOGD("Bringing up Python virtual machine");
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
   python_init();
+  LOGI("Python virtual machine is up after {} ms", _d(client__elapsed_ms(&start)));
+
+  // Export per-robot counters
+  metrics_add_collector(&base__collect_metrics, NULL);
 }
 
 void client_on_stop(struct service* svc) {
   LOGI("Client service stopping");
 
+  // Stop exporting per-robot counters
+  metrics_remove_collector(&base__collect_metrics, NULL);
+
   // Tear down our Python environment
   LOGD("Tearing down Python virtual machine");
   python_terminate();
+
+  // Close the shared-memory state segment
+  state_close();
 }
 
 int client_call(struct service* svc, int fn, void* arg1, void* arg2, void** ret) {
   switch (fn) {
     case client_call_select:
-      return client__call_select((enum client_op) arg1);
+      return client__call_select((enum client_op) arg1, arg2);
     case client_call_start:
       return client__call_start();
+    case client_call_join:
+      return client__call_join(ret);
     default:
       return 1;
   }
 }
 
-static struct service service = {
+/**
+ * The services the client needs running first.
+ *
+ * The client registers a metrics collector as it starts. It does not wait on
+ * the tracker service, so the Python VM comes up while the detector loads.
+ */
+static struct service* const client__deps[] = {
+  SERVICE_METRICS,
+  NULL,
+};
+
+struct service client_service = {
   .name = "client",
   .on_start = &client_on_start,
   .on_stop = &client_on_stop,
   .call = &client_call,
+  .deps = client__deps,
+  .async = 1,
+  .main_thread = 1,
 };
-
-struct service* const SERVICE_CLIENT = &service;
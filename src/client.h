@@ -12,7 +12,7 @@ enum client_call {
    *
    * Arguments:
    *  1. (enum client_op) The operation
-   *  2. N/C
+   *  2. (char**) The operation's command-line arguments (NULL-terminated, nullable)
    *
    * Return:
    *  N/C
@@ -30,6 +30,18 @@ enum client_call {
    *  N/C
    */
   client_call_start,
+
+  /**
+   * Wait for the client operation to finish.
+   *
+   * Arguments:
+   *  1. N/C
+   *  2. N/C
+   *
+   * Return:
+   *  (intptr_t) The exit code of the operation
+   */
+  client_call_join,
 };
 
 /** A client operation. */
@@ -37,9 +49,13 @@ enum client_op {
   client_op_friend_list,
   client_op_friend_remove,
   client_op_interact,
+  client_op_loadgen,
 };
 
 /** The client service. */
-extern struct service* const SERVICE_CLIENT;
+extern struct service client_service;
+
+/** The client service, for service lists and dependencies. */
+#define SERVICE_CLIENT (&client_service)
 
 #endif // #ifndef CLIENT_H
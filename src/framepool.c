@@ -0,0 +1,211 @@
+/*
+ * Cozmonaut
+ * Copyright 2019 The Cozmonaut Contributors
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "affinity.h"
+#include "framepool.h"
+#include "log.h"
+
+/** The smallest size class (64 KiB). */
+#define FRAMEPOOL__MIN_CLASS 16
+
+/** The number of size classes (up to 2 GiB). */
+#define FRAMEPOOL__NUM_CLASSES 16
+
+/** The most free buffers kept in one size class. */
+#define FRAMEPOOL__MAX_FREE 8
+
+/** The smallest buffer worth backing with huge pages. */
+#define FRAMEPOOL__HUGE_MIN (2 * 1024 * 1024)
+
+/** Guards the one-time pool mutex setup. */
+static pthread_once_t framepool__once = PTHREAD_ONCE_INIT;
+
+/** The pool mutex. Detection threads take this (see affinity_mutex_init). */
+static pthread_mutex_t framepool__mutex;
+
+/** The free buffers in each size class. */
+static struct framepool_buffer* framepool__free[FRAMEPOOL__NUM_CLASSES];
+
+/** The number of free buffers in each size class. */
+static int framepool__num_free[FRAMEPOOL__NUM_CLASSES];
+
+/** Set up the pool mutex. */
+static void framepool__init() {
+  affinity_mutex_init(&framepool__mutex);
+}
+
+/**
+ * Find the size class for a size.
+ *
+ * @param size The size
+ * @return The size class, or -1 if the size is too big
+ */
+static int framepool__class(size_t size) {
+  int size_class = 0;
+  while (((size_t) 1 << (FRAMEPOOL__MIN_CLASS + size_class)) < size) {
+    if (++size_class == FRAMEPOOL__NUM_CLASSES) {
+      return -1;
+    }
+  }
+
+  return size_class;
+}
+
+/**
+ * Allocate a buffer.
+ *
+ * @param size_class The size class
+ * @return The buffer, or NULL on failure
+ */
+static struct framepool_buffer* framepool__alloc(int size_class) {
+  struct framepool_buffer* buf = calloc(1, sizeof(struct framepool_buffer));
+  if (!buf) {
+    return NULL;
+  }
+
+  buf->capacity = (size_t) 1 << (FRAMEPOOL__MIN_CLASS + size_class);
+  buf->size_class = size_class;
+
+  // Try huge pages for big buffers if asked
+  if (getenv("COZMONAUT_HUGEPAGES") && buf->capacity >= FRAMEPOOL__HUGE_MIN) {
+    // Explicit huge pages need a reserved pool, so fall back to transparent ones
+    void* data = mmap(NULL, buf->capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (data == MAP_FAILED) {
+      data = mmap(NULL, buf->capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (data != MAP_FAILED) {
+        madvise(data, buf->capacity, MADV_HUGEPAGE);
+      }
+    }
+
+    if (data != MAP_FAILED) {
+      buf->data = data;
+      buf->mapped = 1;
+      return buf;
+    }
+  }
+
+  // Otherwise, allocate with cache-line alignment
+  void* data;
+  if (posix_memalign(&data, FRAMEPOOL_ALIGN, buf->capacity) != 0) {
+    free(buf);
+    return NULL;
+  }
+
+  buf->data = data;
+  return buf;
+}
+
+/**
+ * Free a buffer.
+ *
+ * @param buf The buffer
+ */
+static void framepool__free_buffer(struct framepool_buffer* buf) {
+  for (int i = 0; i < FRAMEPOOL_MAX_IMAGES; ++i) {
+    sfCozmoImageDestroy(buf->images[i]);
+  }
+
+  if (buf->mapped) {
+    munmap(buf->data, buf->capacity);
+  } else {
+    free(buf->data);
+  }
+
+  free(buf);
+}
+
+struct framepool_buffer* framepool_acquire(size_t size) {
+  int size_class = framepool__class(size);
+  if (size_class < 0) {
+    LOGF("Frame of {} bytes is too big for the frame pool", _ul(size));
+    abort();
+  }
+
+  pthread_once(&framepool__once, &framepool__init);
+  pthread_mutex_lock(&framepool__mutex);
+
+  // Reuse a free buffer if there is one
+  struct framepool_buffer* buf = framepool__free[size_class];
+  if (buf) {
+    framepool__free[size_class] = buf->next;
+    --framepool__num_free[size_class];
+  }
+
+  pthread_mutex_unlock(&framepool__mutex);
+
+  if (!buf) {
+    buf = framepool__alloc(size_class);
+    if (!buf) {
+      LOGF("Unable to allocate a frame buffer of {} bytes", _ul((size_t) 1 << (FRAMEPOOL__MIN_CLASS + size_class)));
+      abort();
+    }
+  }
+
+  buf->next = NULL;
+  buf->refs = 1;
+  return buf;
+}
+
+void framepool_retain(struct framepool_buffer* buf) {
+  __atomic_add_fetch(&buf->refs, 1, __ATOMIC_RELAXED);
+}
+
+void framepool_release(struct framepool_buffer* buf) {
+  if (!buf) {
+    return;
+  }
+
+  // Others may still be reading the frame
+  if (__atomic_sub_fetch(&buf->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+    return;
+  }
+
+  pthread_mutex_lock(&framepool__mutex);
+
+  // Keep the buffer around for the next taker if there is room
+  if (framepool__num_free[buf->size_class] < FRAMEPOOL__MAX_FREE) {
+    buf->next = framepool__free[buf->size_class];
+    framepool__free[buf->size_class] = buf;
+    ++framepool__num_free[buf->size_class];
+    buf = NULL;
+  }
+
+  pthread_mutex_unlock(&framepool__mutex);
+
+  if (buf) {
+    framepool__free_buffer(buf);
+  }
+}
+
+int framepool_shared(const struct framepool_buffer* buf) {
+  return __atomic_load_n(&buf->refs, __ATOMIC_ACQUIRE) > 1;
+}
+
+SFCozmoImage framepool_image(struct framepool_buffer* buf, int width, int height) {
+  // Reuse the image for this frame size if we have one
+  for (int i = 0; i < FRAMEPOOL_MAX_IMAGES; ++i) {
+    if (buf->images[i] && buf->image_sizes[i][0] == width && buf->image_sizes[i][1] == height) {
+      return buf->images[i];
+    }
+  }
+
+  // Otherwise, make one in place of the oldest
+  int i = buf->image_next;
+  buf->image_next = (i + 1) % FRAMEPOOL_MAX_IMAGES;
+
+  sfCozmoImageDestroy(buf->images[i]);
+  sfCozmoImageCreate(&buf->images[i], width, height, buf->data);
+  buf->image_sizes[i][0] = width;
+  buf->image_sizes[i][1] = height;
+
+  return buf->images[i];
+}
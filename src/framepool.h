@@ -0,0 +1,114 @@
+/*
+ * Cozmonaut
+ * Copyright 2019 The Cozmonaut Contributors
+ */
+
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include <stddef.h>
+
+#include "cozmo_image.h"
+
+//
+// Frame buffer pool
+//
+// Frame buffers are handed out from a process-wide pool shared by all
+// trackers. Buffers come in power-of-two size classes and go back to the pool
+// when released, so a camera that flips between preview and full resolution
+// keeps reusing the same warm memory instead of going back to the allocator.
+// Every buffer is 64-byte aligned. With the COZMONAUT_HUGEPAGES environment
+// variable set, large buffers are backed by huge pages where the system
+// allows it.
+//
+// Buffers are reference-counted, so a frame can be shared between threads
+// without a copy. A shared buffer must not be written to; whoever wants to
+// write trades it in for a fresh one instead. The buffer goes back to the pool
+// with its last reference.
+//
+
+/** The alignment of frame buffer data. */
+#define FRAMEPOOL_ALIGN 64
+
+/** The most frame sizes a buffer keeps a spdyface image for. */
+#define FRAMEPOOL_MAX_IMAGES 4
+
+/** A pooled frame buffer. */
+struct framepool_buffer {
+  /** The buffer data. */
+  char* data;
+
+  /** The buffer capacity. */
+  size_t capacity;
+
+  /** The size class. */
+  int size_class;
+
+  /** Nonzero if the data was mapped rather than allocated. */
+  int mapped;
+
+  /** The spdyface images over the data, one per frame size (nullable). */
+  SFCozmoImage images[FRAMEPOOL_MAX_IMAGES];
+
+  /** The frame sizes of the spdyface images. */
+  int image_sizes[FRAMEPOOL_MAX_IMAGES][2];
+
+  /** The image to replace when a new frame size comes along. */
+  int image_next;
+
+  /** The number of references. Accessed atomically. */
+  int refs;
+
+  /** The next free buffer in the same size class. */
+  struct framepool_buffer* next;
+};
+
+/**
+ * Take a buffer from the pool.
+ *
+ * This aborts if the buffer cannot be had, as there is no going on without
+ * frame memory.
+ *
+ * @param size The minimum capacity
+ * @return The buffer (with one reference)
+ */
+struct framepool_buffer* framepool_acquire(size_t size);
+
+/**
+ * Take another reference to a buffer.
+ *
+ * @param buf The buffer
+ */
+void framepool_retain(struct framepool_buffer* buf);
+
+/**
+ * Release a reference to a buffer.
+ *
+ * The buffer goes back to the pool with the last reference.
+ *
+ * @param buf The buffer (nullable)
+ */
+void framepool_release(struct framepool_buffer* buf);
+
+/**
+ * Check whether a buffer has more than one reference.
+ *
+ * @param buf The buffer
+ * @return Nonzero if the buffer is shared, otherwise zero
+ */
+int framepool_shared(const struct framepool_buffer* buf);
+
+/**
+ * Get a spdyface image over a buffer.
+ *
+ * The buffer keeps an image for each of the last FRAMEPOOL_MAX_IMAGES frame
+ * sizes it saw, so switching between a few resolutions allocates nothing.
+ *
+ * @param buf The buffer
+ * @param width The frame width
+ * @param height The frame height
+ * @return The image
+ */
+SFCozmoImage framepool_image(struct framepool_buffer* buf, int width, int height);
+
+#endif // #ifndef FRAMEPOOL_H
@@ -0,0 +1,269 @@
+/*
+ * Cozmonaut
+ * Copyright 2019 The Cozmonaut Contributors
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "framering.h"
+
+/** The alignment of the data area (a page, so slots start on fresh pages). */
+#define FRAMERING__PAGE 4096
+
+struct framering {
+  /** The mapped segment. */
+  struct framering_header* header;
+
+  /** The size of the mapping. */
+  size_t size;
+
+  /** The segment name. */
+  char name[256];
+
+  /** Nonzero if we created the segment. */
+  int owner;
+};
+
+/**
+ * Wait on a futex in shared memory.
+ *
+ * @param addr The futex word
+ * @param val The value to sleep on
+ * @param timeout_ms The timeout in milliseconds
+ */
+static void framering__futex_wait(unsigned int* addr, unsigned int val, int timeout_ms) {
+  struct timespec timeout = {timeout_ms / 1000, (long) (timeout_ms % 1000) * 1000000};
+  syscall(SYS_futex, addr, FUTEX_WAIT, val, &timeout, NULL, 0);
+}
+
+/**
+ * Wake a waiter on a futex in shared memory.
+ *
+ * @param addr The futex word
+ */
+static void framering__futex_wake(unsigned int* addr) {
+  syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+/**
+ * Compute the total size of a segment.
+ *
+ * @param header The segment header
+ * @return The segment size
+ */
+static size_t framering__size(const struct framering_header* header) {
+  return header->data_offset + (size_t) header->num_slots * header->slot_size;
+}
+
+struct framering* framering_create(const char* name, unsigned int num_slots, size_t slot_size) {
+  if (num_slots == 0 || num_slots > FRAMERING_MAX_SLOTS || slot_size == 0 || slot_size > 0x7fffffffu) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  // Lay out the segment
+  struct framering_header layout = {
+    .version = FRAMERING_VERSION,
+    .num_slots = num_slots,
+    .slot_size = (unsigned int) ((slot_size + FRAMERING_ALIGN - 1) / FRAMERING_ALIGN * FRAMERING_ALIGN),
+    .data_offset = (sizeof(struct framering_header) + FRAMERING__PAGE - 1) / FRAMERING__PAGE * FRAMERING__PAGE,
+  };
+  size_t size = framering__size(&layout);
+
+  // Create or reuse the segment
+  int fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  // Size it for our layout
+  if (ftruncate(fd, (off_t) size) < 0) {
+    int err = errno;
+    close(fd);
+    shm_unlink(name);
+    errno = err;
+    return NULL;
+  }
+
+  // Map it
+  void* addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    int err = errno;
+    shm_unlink(name);
+    errno = err;
+    return NULL;
+  }
+
+  struct framering_header* header = addr;
+
+  // Wipe anything a previous process left behind and publish the magic number last
+  __atomic_store_n(&header->magic, 0, __ATOMIC_RELAXED);
+  *header = layout;
+  __atomic_store_n(&header->magic, FRAMERING_MAGIC, __ATOMIC_RELEASE);
+
+  struct framering* self = calloc(1, sizeof(struct framering));
+  self->header = header;
+  self->size = size;
+  strncpy(self->name, name, sizeof self->name - 1);
+  self->owner = 1;
+  return self;
+}
+
+struct framering* framering_open(const char* name) {
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  // Map the header first to find out how big the whole thing is
+  struct framering_header* header = mmap(NULL, sizeof(struct framering_header), PROT_READ, MAP_SHARED, fd, 0);
+  if (header == MAP_FAILED) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return NULL;
+  }
+
+  // Refuse segments from an incompatible build
+  if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != FRAMERING_MAGIC || header->version != FRAMERING_VERSION) {
+    munmap(header, sizeof(struct framering_header));
+    close(fd);
+    errno = EPROTO;
+    return NULL;
+  }
+
+  size_t size = framering__size(header);
+  munmap(header, sizeof(struct framering_header));
+
+  // Map the whole thing
+  void* addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    return NULL;
+  }
+
+  struct framering* self = calloc(1, sizeof(struct framering));
+  self->header = addr;
+  self->size = size;
+  strncpy(self->name, name, sizeof self->name - 1);
+  return self;
+}
+
+void framering_close(struct framering* self) {
+  // Tell the other side we are gone if the segment is ours
+  if (self->owner) {
+    __atomic_store_n(&self->header->magic, 0, __ATOMIC_RELEASE);
+  }
+
+  munmap(self->header, self->size);
+
+  if (self->owner) {
+    shm_unlink(self->name);
+  }
+
+  free(self);
+}
+
+size_t framering_slot_size(struct framering* self) {
+  return self->header->slot_size;
+}
+
+unsigned long long framering_dropped(struct framering* self) {
+  return __atomic_load_n(&self->header->dropped, __ATOMIC_RELAXED);
+}
+
+char* framering_write_begin(struct framering* self) {
+  struct framering_header* header = self->header;
+
+  // The producer owns the head, and the consumer owns the tail
+  unsigned int head = __atomic_load_n(&header->head, __ATOMIC_RELAXED);
+  unsigned int tail = __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE);
+
+  // Drop the frame if every slot is taken
+  if (head - tail >= header->num_slots) {
+    __atomic_add_fetch(&header->dropped, 1, __ATOMIC_RELAXED);
+    return NULL;
+  }
+
+  return (char*) header + header->data_offset + (size_t) (head % header->num_slots) * header->slot_size;
+}
+
+void framering_write_end(struct framering* self, int width, int height, long long timestamp) {
+  struct framering_header* header = self->header;
+
+  unsigned int head = __atomic_load_n(&header->head, __ATOMIC_RELAXED);
+
+  struct framering_slot* slot = &header->slots[head % header->num_slots];
+  slot->width = width;
+  slot->height = height;
+  slot->frame = head;
+  slot->timestamp = timestamp;
+
+  // Publish the frame
+  __atomic_store_n(&header->head, head + 1, __ATOMIC_SEQ_CST);
+
+  // Wake the consumer only if it went to sleep
+  // Both sides use sequentially-consistent accesses here, so one of us always sees the other
+  if (__atomic_load_n(&header->consumer_waiting, __ATOMIC_SEQ_CST)) {
+    framering__futex_wake(&header->head);
+  }
+}
+
+const struct framering_slot* framering_read_begin(struct framering* self, int timeout_ms) {
+  struct framering_header* header = self->header;
+
+  unsigned int tail = __atomic_load_n(&header->tail, __ATOMIC_RELAXED);
+  unsigned int head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+
+  // Sleep until the producer publishes something
+  if (head == tail && timeout_ms > 0) {
+    __atomic_store_n(&header->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+
+    head = __atomic_load_n(&header->head, __ATOMIC_SEQ_CST);
+    if (head == tail) {
+      framering__futex_wait(&header->head, head, timeout_ms);
+    }
+
+    __atomic_store_n(&header->consumer_waiting, 0, __ATOMIC_RELAXED);
+    head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+  }
+
+  if (head == tail) {
+    return NULL;
+  }
+
+  // Skip to the newest frame and hand the older slots back right away
+  if (head - tail > 1) {
+    __atomic_add_fetch(&header->dropped, head - tail - 1, __ATOMIC_RELAXED);
+    tail = head - 1;
+    __atomic_store_n(&header->tail, tail, __ATOMIC_RELEASE);
+  }
+
+  return &header->slots[tail % header->num_slots];
+}
+
+char* framering_slot_data(struct framering* self, const struct framering_slot* slot) {
+  struct framering_header* header = self->header;
+  return (char*) header + header->data_offset + (size_t) framering_slot_index(self, slot) * header->slot_size;
+}
+
+unsigned int framering_slot_index(struct framering* self, const struct framering_slot* slot) {
+  return (unsigned int) (slot - self->header->slots);
+}
+
+void framering_read_end(struct framering* self) {
+  struct framering_header* header = self->header;
+
+  unsigned int tail = __atomic_load_n(&header->tail, __ATOMIC_RELAXED);
+  __atomic_store_n(&header->tail, tail + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,210 @@
+/*
+ * Cozmonaut
+ * Copyright 2019 The Cozmonaut Contributors
+ */
+
+#ifndef FRAMERING_H
+#define FRAMERING_H
+
+#include <stddef.h>
+
+//
+// Shared-memory frame ring
+//
+// A frame ring is a POSIX shared-memory segment holding a fixed number of
+// frame slots, for a capture process to hand frames to a tracker in another
+// process. There is exactly one producer and one consumer. The producer fills
+// a free slot in place and publishes it; the consumer works on the slot in
+// place and hands it back. Frames are RGB24, laid out as for
+// tracker_submit_frame().
+//
+// The ring is made of two counters: head counts the frames published, and tail
+// counts the frames handed back. A consumer with nothing to do sleeps on the
+// head counter with a futex, and the producer only makes the wake-up syscall
+// when the consumer says it is asleep. A producer never waits; when the ring
+// is full, it drops the frame. A consumer that falls behind skips straight to
+// the newest frame, as only the newest one matters for tracking.
+//
+// Like the state segment (see state.h), this layout is shared with programs
+// outside this build, so it only uses fixed-size plain types accessed with the
+// compiler's __atomic builtins. This is also built into the cozmostate library
+// for capture programs to link.
+//
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** The segment magic number ("CZFR"). */
+#define FRAMERING_MAGIC 0x52465a43u
+
+/** The segment layout version. */
+#define FRAMERING_VERSION 1u
+
+/** The maximum number of slots in a ring. */
+#define FRAMERING_MAX_SLOTS 16
+
+/** The alignment of slot data. */
+#define FRAMERING_ALIGN 64
+
+/** A frame slot header. */
+struct framering_slot {
+  /** The frame width. */
+  int width;
+
+  /** The frame height. */
+  int height;
+
+  /** The frame number (the head counter value when published). */
+  unsigned int frame;
+
+  /** Reserved. */
+  unsigned int reserved;
+
+  /** The capture time in nanoseconds on the monotonic clock (zero if unknown). */
+  long long timestamp;
+};
+
+/** The segment header. */
+struct framering_header {
+  /** The segment magic number. Written last during setup. */
+  unsigned int magic;
+
+  /** The segment layout version. */
+  unsigned int version;
+
+  /** The number of slots. */
+  unsigned int num_slots;
+
+  /** The data capacity of each slot. A multiple of FRAMERING_ALIGN. */
+  unsigned int slot_size;
+
+  /** The offset of the first slot's data from the start of the segment. */
+  unsigned int data_offset;
+
+  /** The number of frames published. Also the futex the consumer sleeps on. */
+  unsigned int head;
+
+  /** The number of frames handed back. */
+  unsigned int tail;
+
+  /** Nonzero while the consumer is asleep (or about to be). */
+  unsigned int consumer_waiting;
+
+  /** The number of frames dropped by the producer (ring full) or skipped by the consumer. */
+  unsigned long long dropped;
+
+  /** The slot headers. */
+  struct framering_slot slots[FRAMERING_MAX_SLOTS];
+};
+
+/** A mapped frame ring. */
+struct framering;
+
+/**
+ * Create a frame ring.
+ *
+ * This is for the consumer side. Any stale segment of the same name is reused
+ * and wiped, and the segment is removed again when the ring is closed.
+ *
+ * @param name The segment name
+ * @param num_slots The number of slots (at most FRAMERING_MAX_SLOTS)
+ * @param slot_size The data capacity of each slot
+ * @return The frame ring, or NULL on failure (with errno set)
+ */
+struct framering* framering_create(const char* name, unsigned int num_slots, size_t slot_size);
+
+/**
+ * Map an existing frame ring.
+ *
+ * This is for the producer side.
+ *
+ * @param name The segment name
+ * @return The frame ring, or NULL on failure (with errno set)
+ */
+struct framering* framering_open(const char* name);
+
+/**
+ * Unmap a frame ring.
+ *
+ * @param self The frame ring
+ */
+void framering_close(struct framering* self);
+
+/**
+ * Get the data capacity of each slot.
+ *
+ * @param self The frame ring
+ * @return The slot capacity
+ */
+size_t framering_slot_size(struct framering* self);
+
+/**
+ * Get the number of dropped and skipped frames so far.
+ *
+ * @param self The frame ring
+ * @return The number of frames
+ */
+unsigned long long framering_dropped(struct framering* self);
+
+/**
+ * Begin writing a frame.
+ *
+ * This never blocks. If the ring is full, the frame is counted as dropped.
+ *
+ * @param self The frame ring
+ * @return The slot data to fill in, or NULL if the ring is full
+ */
+char* framering_write_begin(struct framering* self);
+
+/**
+ * Publish the frame being written.
+ *
+ * @param self The frame ring
+ * @param width The frame width
+ * @param height The frame height
+ * @param timestamp The capture time in nanoseconds on the monotonic clock (or zero)
+ */
+void framering_write_end(struct framering* self, int width, int height, long long timestamp);
+
+/**
+ * Begin reading the newest frame.
+ *
+ * Any older frames still waiting are skipped.
+ *
+ * @param self The frame ring
+ * @param timeout_ms How long to wait for a frame in milliseconds (zero to not wait)
+ * @return The slot header, or NULL if no frame came in time
+ */
+const struct framering_slot* framering_read_begin(struct framering* self, int timeout_ms);
+
+/**
+ * Get the data of a slot.
+ *
+ * @param self The frame ring
+ * @param slot The slot header
+ * @return The slot data
+ */
+char* framering_slot_data(struct framering* self, const struct framering_slot* slot);
+
+/**
+ * Get the index of a slot.
+ *
+ * @param self The frame ring
+ * @param slot The slot header
+ * @return The slot index
+ */
+unsigned int framering_slot_index(struct framering* self, const struct framering_slot* slot);
+
+/**
+ * Hand back the frame being read.
+ *
+ * @param self The frame ring
+ */
+void framering_read_end(struct framering* self);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // #ifndef FRAMERING_H
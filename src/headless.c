@@ -0,0 +1,528 @@
+/*
+ * Cozmonaut
+ * Copyright 2019 The Cozmonaut Contributors
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "framepool.h"
+#include "headless.h"
+#include "log.h"
+#include "state.h"
+#include "tracker.h"
+
+/** The number of event records drained at once. */
+#define HEADLESS__DRAIN_BATCH 256
+
+/** The default shared-memory state segment name in headless mode. */
+#define HEADLESS__STATE_NAME "/cozmonaut-state-headless"
+
+/** A frame input. */
+struct headless__input {
+  /** The file descriptor. */
+  int fd;
+
+  /** The mapped file (nullable). Regular files are mapped whole. */
+  const char* map;
+
+  /** The size of the mapped file. */
+  size_t map_size;
+
+  /** The read position in the mapped file. */
+  size_t map_pos;
+
+  /** The read buffer for unmapped input (nullable). */
+  char* buf;
+
+  /** The capacity of the read buffer. */
+  size_t buf_cap;
+};
+
+/** A frame format. */
+enum headless__format {
+  headless__format_rgb24,
+  headless__format_yuv420,
+  headless__format_mono,
+};
+
+/** The stop flag. Set by SIGINT and SIGTERM. */
+static volatile sig_atomic_t headless__stop;
+
+/**
+ * Handle a stop signal.
+ *
+ * @param sig The signal number
+ */
+static void headless__on_signal(int sig) {
+  headless__stop = 1;
+}
+
+/**
+ * Open a frame input.
+ *
+ * @param self The input
+ * @param path The input path, or "-" for standard input
+ * @return Zero on success, otherwise nonzero
+ */
+static int headless__input_open(struct headless__input* self, const char* path) {
+  memset(self, 0, sizeof(struct headless__input));
+
+  if (strcmp(path, "-") == 0) {
+    self->fd = STDIN_FILENO;
+  } else {
+    self->fd = open(path, O_RDONLY);
+    if (self->fd < 0) {
+      LOGE("Unable to open input {}: {}", _str(path), _str(strerror(errno)));
+      return 1;
+    }
+  }
+
+  // Map regular files, so frames can be handed to the tracker straight from the page cache
+  struct stat st;
+  if (fstat(self->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void* map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, self->fd, 0);
+    if (map != MAP_FAILED) {
+      madvise(map, (size_t) st.st_size, MADV_SEQUENTIAL);
+      self->map = map;
+      self->map_size = (size_t) st.st_size;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Close a frame input.
+ *
+ * @param self The input
+ */
+static void headless__input_close(struct headless__input* self) {
+  if (self->map) {
+    munmap((void*) self->map, self->map_size);
+  }
+
+  if (self->fd != STDIN_FILENO) {
+    close(self->fd);
+  }
+
+  free(self->buf);
+}
+
+/**
+ * Take the next bytes from a frame input.
+ *
+ * For mapped input, this points into the mapping. Otherwise, the bytes are
+ * read into a buffer that is reused on the next call.
+ *
+ * @param self The input
+ * @param len The number of bytes
+ * @return The bytes, or NULL at the end of input
+ */
+static const char* headless__input_next(struct headless__input* self, size_t len) {
+  if (self->map) {
+    if (self->map_size - self->map_pos < len) {
+      return NULL;
+    }
+
+    const char* data = self->map + self->map_pos;
+    self->map_pos += len;
+    return data;
+  }
+
+  if (self->buf_cap < len) {
+    free(self->buf);
+    self->buf = malloc(len);
+    self->buf_cap = len;
+  }
+
+  // Pipes hand out whatever they have, so keep reading until the bytes are all here
+  size_t got = 0;
+  while (got < len) {
+    ssize_t num = read(self->fd, self->buf + got, len - got);
+    if (num < 0 && errno == EINTR && !headless__stop) {
+      continue;
+    }
+    if (num <= 0) {
+      return NULL;
+    }
+    got += (size_t) num;
+  }
+
+  return self->buf;
+}
+
+/**
+ * Read a header line from a frame input.
+ *
+ * @param self The input
+ * @param line The line destination (NUL-terminated, without the newline)
+ * @param max The capacity of the line destination
+ * @return Zero on success, otherwise nonzero
+ */
+static int headless__input_line(struct headless__input* self, char* line, size_t max) {
+  size_t len = 0;
+
+  do {
+    const char* c = headless__input_next(self, 1);
+    if (!c) {
+      return 1;
+    }
+
+    if (*c == '\n') {
+      break;
+    }
+
+    // Keep what fits and skip the rest
+    if (len + 1 < max) {
+      line[len++] = *c;
+    }
+  } while (1);
+
+  line[len] = '\0';
+  return 0;
+}
+
+/**
+ * Parse a YUV4MPEG2 stream header.
+ *
+ * @param line The header line
+ * @param [out] width The frame width
+ * @param [out] height The frame height
+ * @param [out] format The frame format
+ * @return Zero on success, otherwise nonzero
+ */
+static int headless__parse_y4m(char* line, int* width, int* height, enum headless__format* format) {
+  if (strncmp(line, "YUV4MPEG2", 9) != 0) {
+    LOGE("Input is not a YUV4MPEG2 stream (give the size with -s for raw RGB24)");
+    return 1;
+  }
+
+  *width = 0;
+  *height = 0;
+  *format = headless__format_yuv420;
+
+  for (char* tok = strtok(line + 9, " "); tok; tok = strtok(NULL, " ")) {
+    switch (tok[0]) {
+      case 'W':
+        *width = atoi(tok + 1);
+        break;
+      case 'H':
+        *height = atoi(tok + 1);
+        break;
+      case 'C':
+        if (strncmp(tok + 1, "420", 3) == 0) {
+          *format = headless__format_yuv420;
+        } else if (strcmp(tok + 1, "mono") == 0) {
+          *format = headless__format_mono;
+        } else {
+          LOGE("Unsupported YUV4MPEG2 colorspace: {}", _str(tok + 1));
+          return 1;
+        }
+        break;
+    }
+  }
+
+  if (*width <= 0 || *height <= 0) {
+    LOGE("YUV4MPEG2 header has no frame size");
+    return 1;
+  }
+
+  return 0;
+}
+
+/**
+ * Clamp a color component.
+ *
+ * @param value The value
+ * @return The value in the range [0, 255]
+ */
+static char headless__clamp(int value) {
+  return (char) (value < 0 ? 0 : value > 255 ? 255 : value);
+}
+
+/**
+ * Convert a YUV frame to RGB24.
+ *
+ * This uses the BT.601 studio-range coefficients most YUV4MPEG2 writers use.
+ *
+ * @param src The YUV frame
+ * @param width The frame width
+ * @param height The frame height
+ * @param format The frame format
+ * @param dst The RGB24 destination
+ */
+static void headless__to_rgb(const char* src, int width, int height, enum headless__format format, char* dst) {
+  const unsigned char* y_plane = (const unsigned char*) src;
+
+  // Mono frames just repeat the luma
+  if (format == headless__format_mono) {
+    for (size_t i = 0; i < (size_t) width * height; ++i) {
+      dst[3 * i + 0] = dst[3 * i + 1] = dst[3 * i + 2] = (char) y_plane[i];
+    }
+    return;
+  }
+
+  int chroma_width = (width + 1) / 2;
+  int chroma_height = (height + 1) / 2;
+  const unsigned char* u_plane = y_plane + (size_t) width * height;
+  const unsigned char* v_plane = u_plane + (size_t) chroma_width * chroma_height;
+
+  for (int row = 0; row < height; ++row) {
+    const unsigned char* y_row = y_plane + (size_t) row * width;
+    const unsigned char* u_row = u_plane + (size_t) (row / 2) * chroma_width;
+    const unsigned char* v_row = v_plane + (size_t) (row / 2) * chroma_width;
+    char* out = dst + (size_t) row * width * 3;
+
+    for (int col = 0; col < width; ++col) {
+      int c = 298 * (y_row[col] - 16);
+      int d = u_row[col / 2] - 128;
+      int e = v_row[col / 2] - 128;
+
+      *out++ = headless__clamp((c + 409 * e + 128) >> 8);
+      *out++ = headless__clamp((c - 100 * d - 208 * e + 128) >> 8);
+      *out++ = headless__clamp((c + 516 * d + 128) >> 8);
+    }
+  }
+}
+
+/**
+ * Write a bounding box as a JSON array.
+ *
+ * @param out The output
+ * @param bbox The bounding box
+ */
+static void headless__write_bbox(FILE* out, const struct tracker_bbox* bbox) {
+  fprintf(out, "[%d,%d,%d,%d]", bbox->bbox_x, bbox->bbox_y, bbox->bbox_w, bbox->bbox_h);
+}
+
+/**
+ * Drain pending tracker events and write them out.
+ *
+ * @param tracker The face tracker
+ * @param frame The frame number to tag the events with
+ * @param out The output
+ */
+static void headless__write_events(struct tracker* tracker, unsigned long long frame, FILE* out) {
+  struct tracker_event_record events[HEADLESS__DRAIN_BATCH];
+  size_t num;
+
+  while ((num = tracker_drain_events(tracker, events, HEADLESS__DRAIN_BATCH)) > 0) {
+    for (size_t i = 0; i < num; ++i) {
+      const struct tracker_event_record* rec = &events[i];
+
+      fprintf(out, "{\"frame\":%llu,\"seq\":%llu,\"track\":%d,", frame, rec->seq, rec->track);
+
+      switch (rec->type) {
+        case tracker_event_type_acquire:
+          fputs("\"type\":\"acquire\",\"bbox\":", out);
+          headless__write_bbox(out, &rec->bbox);
+          break;
+        case tracker_event_type_lose:
+          fputs("\"type\":\"lose\"", out);
+          break;
+        case tracker_event_type_move:
+          fputs("\"type\":\"move\",\"bbox\":", out);
+          headless__write_bbox(out, &rec->bbox);
+          fputs(",\"bbox_old\":", out);
+          headless__write_bbox(out, &rec->bbox_old);
+          break;
+        case tracker_event_type_identity:
+          fprintf(out, "\"type\":\"identity\",\"registration\":%d,\"confidence\":%g,\"version\":%d",
+            rec->registration, (double) rec->confidence, rec->version);
+          break;
+      }
+
+      fputs("}\n", out);
+    }
+  }
+
+  // Consumers on a pipe want each frame's events as soon as they exist
+  fflush(out);
+}
+
+int headless_main(int argc, char* argv[]) {
+  int width = 0;
+  int height = 0;
+  const char* output_path = NULL;
+  int robot_id = 0;
+
+  // Parse options
+  int opt;
+  while ((opt = getopt(argc, argv, "s:o:r:")) != -1) {
+    switch (opt) {
+      case 's':
+        if (sscanf(optarg, "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+          fprintf(stderr, "Bad frame size: %s\n", optarg);
+          return 2;
+        }
+        break;
+      case 'o':
+        output_path = optarg;
+        break;
+      case 'r':
+        robot_id = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr, "Usage: cozmo headless [-s WxH] [-o output] [-r robot_id] [input]\n");
+        return 2;
+    }
+  }
+
+  const char* input_path = optind < argc ? argv[optind] : "-";
+
+  // Open the output
+  // Records get standard output to themselves, so log lines move over to standard error
+  FILE* out;
+  if (output_path) {
+    out = fopen(output_path, "w");
+    if (!out) {
+      fprintf(stderr, "Unable to open output %s: %s\n", output_path, strerror(errno));
+      return 1;
+    }
+  } else {
+    out = fdopen(dup(STDOUT_FILENO), "w");
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+  }
+
+  // Open the input
+  struct headless__input input;
+  if (headless__input_open(&input, input_path)) {
+    fclose(out);
+    return 1;
+  }
+
+  // Work out the frame format
+  enum headless__format format = headless__format_rgb24;
+  if (!width) {
+    char line[256];
+    if (headless__input_line(&input, line, sizeof line) || headless__parse_y4m(line, &width, &height, &format)) {
+      headless__input_close(&input);
+      fclose(out);
+      return 1;
+    }
+  }
+
+  size_t frame_size = (size_t) width * height;
+  switch (format) {
+    case headless__format_rgb24:
+      frame_size *= 3;
+      break;
+    case headless__format_yuv420:
+      frame_size += 2 * (size_t) ((width + 1) / 2) * ((height + 1) / 2);
+      break;
+    case headless__format_mono:
+      break;
+  }
+
+  LOGI("Headless mode reading {} by {} frames from {}", _i(width), _i(height), _str(input_path));
+
+  // Stop cleanly on interrupt, so a live pipe can be cut off without losing the tail
+  struct sigaction sa = {.sa_handler = &headless__on_signal};
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  // Publish to a shared-memory state segment of our own, so a running client keeps its segment
+  // With COZMONAUT_STATE_SHM naming a segment a live process publishes to, we go without
+  const char* state_name = getenv("COZMONAUT_STATE_SHM");
+  if (state_open(state_name ? state_name : HEADLESS__STATE_NAME) != 0) {
+    LOGW("Not publishing to shared memory");
+  }
+  struct state_robot* state = state_claim(robot_id);
+
+  // Start the tracker and wait out its warm-up, so no frame goes through a cold detector
+  struct tracker* tracker = tracker_new();
+  if (!tracker) {
+    if (state) {
+      state_release(state);
+    }
+    state_close();
+    headless__input_close(&input);
+    fclose(out);
+    return 1;
+  }
+
+  tracker_set_state(tracker, state);
+  while (!tracker_ready(tracker) && !headless__stop) {
+    nanosleep(&(struct timespec) {0, 1000000}, NULL);
+  }
+
+  // YUV frames are converted into a pooled buffer
+  struct framepool_buffer* rgb = NULL;
+  if (format != headless__format_rgb24) {
+    rgb = framepool_acquire((size_t) width * height * 3);
+  }
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  // The frame loop
+  unsigned long long frames = 0;
+  while (!headless__stop) {
+    // YUV4MPEG2 frames each come with a header line
+    if (format != headless__format_rgb24) {
+      char line[256];
+      if (headless__input_line(&input, line, sizeof line)) {
+        break;
+      }
+
+      if (strncmp(line, "FRAME", 5) != 0) {
+        LOGE("Bad YUV4MPEG2 frame header");
+        break;
+      }
+    }
+
+    const char* data = headless__input_next(&input, frame_size);
+    if (!data) {
+      break;
+    }
+
+    // Submit the frame and wait for its results
+    // Unlike a live camera, a recording should not have frames skipped
+    if (rgb) {
+      headless__to_rgb(data, width, height, format, rgb->data);
+      tracker_submit_frame(tracker, width, height, rgb->data, 0);
+    } else {
+      tracker_submit_frame(tracker, width, height, (char*) data, 0);
+    }
+
+    while (tracker_frame_pending(tracker)) {
+      nanosleep(&(struct timespec) {0, 100000}, NULL);
+    }
+
+    headless__write_events(tracker, frames++, out);
+  }
+
+  // Stop the tracker
+  // This loses the remaining tracks, so their lose events close out the output
+  tracker_stop(tracker);
+  headless__write_events(tracker, frames, out);
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  double ms = (double) (now.tv_sec - start.tv_sec) * 1e3 + (double) (now.tv_nsec - start.tv_nsec) / 1e6;
+  LOGI("Headless mode processed {} frames in {} ms ({} fps)", _ull(frames), _d(ms),
+    _d(ms > 0 ? (double) frames * 1e3 / ms : 0));
+
+  // Clean up
+  tracker_delete(tracker);
+  framepool_release(rgb);
+  if (state) {
+    state_release(state);
+  }
+  state_close();
+  headless__input_close(&input);
+  fclose(out);
+
+  return 0;
+}
@@ -0,0 +1,38 @@
+/*
+ * Cozmonaut
+ * Copyright 2019 The Cozmonaut Contributors
+ */
+
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+//
+// Headless mode
+//
+// This drives a face tracker straight from C, without the robot SDK or the
+// Python VM. Frames are read from a file or pipe, either as raw RGB24 (with
+// the size given on the command line) or as a YUV4MPEG2 stream (4:2:0 or
+// mono), and every frame is run through detection in order. Tracker events
+// are written out as newline-delimited JSON records, one per line, and the
+// tracker also publishes its results to shared memory like any other robot.
+// It uses a segment of its own ("/cozmonaut-state-headless" unless
+// COZMONAUT_STATE_SHM says otherwise), so a client running alongside keeps
+// its segment.
+//
+// Usage: cozmo headless [-s WxH] [-o output] [-r robot_id] [input]
+//
+// The input defaults to standard input and the output to standard output. In
+// headless mode, log lines go to standard error instead, so the output stays
+// clean.
+//
+
+/**
+ * Run headless mode.
+ *
+ * @param argc The argument count (the first argument is the mode name)
+ * @param argv The arguments
+ * @return The process exit status
+ */
+int headless_main(int argc, char* argv[]);
+
+#endif // #ifndef HEADLESS_H
@@ -0,0 +1,122 @@
+/*
+ * Cozmonaut
+ * Copyright 2019 The Cozmonaut Contributors
+ */
+
+#include "jpegdec.h"
+#include "log.h"
+
+#ifdef COZMONAUT_HAVE_JPEG
+
+#include <setjmp.h>
+#include <stdio.h>
+
+#include <jpeglib.h>
+
+#include "tracker.h"
+
+/** A libjpeg error manager that bails out instead of exiting. */
+struct jpegdec__error {
+  /** The libjpeg error manager. */
+  struct jpeg_error_mgr mgr;
+
+  /** Where to bail out to. */
+  jmp_buf bail;
+};
+
+/**
+ * Handle a fatal libjpeg error.
+ *
+ * @param cinfo The decompressor
+ */
+static void jpegdec__error_exit(j_common_ptr cinfo) {
+  struct jpegdec__error* err = (struct jpegdec__error*) cinfo->err;
+
+  char msg[JMSG_LENGTH_MAX];
+  cinfo->err->format_message(cinfo, msg);
+  LOGW("Unable to decode JPEG frame: {}", _str(msg));
+
+  longjmp(err->bail, 1);
+}
+
+/**
+ * Drop a libjpeg warning.
+ *
+ * Corrupt-data warnings come up a lot on lossy camera links, and the frame is
+ * usually still good enough for detection.
+ *
+ * @param cinfo The decompressor
+ * @param level The message level
+ */
+static void jpegdec__emit_message(j_common_ptr cinfo, int level) {
+}
+
+int jpegdec_to_tracker(struct tracker* tracker, const void* data, size_t size, int scale, long long timestamp) {
+  struct jpeg_decompress_struct cinfo;
+  struct jpegdec__error err;
+
+  // Volatile, as these are read after a bail out
+  char* volatile frame = NULL;
+
+  cinfo.err = jpeg_std_error(&err.mgr);
+  err.mgr.error_exit = &jpegdec__error_exit;
+  err.mgr.emit_message = &jpegdec__emit_message;
+
+  if (setjmp(err.bail)) {
+    // Abandon the frame if we got that far
+    if (frame) {
+      tracker_unlock_frame(tracker, 0);
+    }
+
+    jpeg_destroy_decompress(&cinfo);
+    return 1;
+  }
+
+  jpeg_create_decompress(&cinfo);
+  jpeg_mem_src(&cinfo, (const unsigned char*) data, (unsigned long) size);
+  jpeg_read_header(&cinfo, TRUE);
+
+  // Scale down during the IDCT and go for speed over the last bit of quality
+  // The detector works on coarse features anyway
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = (unsigned int) scale;
+  cinfo.out_color_space = JCS_RGB;
+  cinfo.dct_method = JDCT_IFAST;
+  cinfo.do_fancy_upsampling = FALSE;
+  cinfo.do_block_smoothing = FALSE;
+
+  jpeg_start_decompress(&cinfo);
+
+  int width = (int) cinfo.output_width;
+  int height = (int) cinfo.output_height;
+
+  // Decode straight into a spare tracker frame buffer
+  // Detection keeps working on the previous frame until this one is submitted
+  frame = tracker_lock_frame(tracker, width, height, timestamp);
+  if (!frame) {
+    // The tracker is stopped, so there is nothing to decode into
+    jpeg_destroy_decompress(&cinfo);
+    return 0;
+  }
+
+  while (cinfo.output_scanline < cinfo.output_height) {
+    JSAMPROW row = (JSAMPROW) (frame + (size_t) cinfo.output_scanline * width * 3);
+    jpeg_read_scanlines(&cinfo, &row, 1);
+  }
+
+  tracker_unlock_frame(tracker, 1);
+  frame = NULL;
+
+  // Anything after the last scanline is of no interest, so skip finishing up
+  jpeg_destroy_decompress(&cinfo);
+  return 0;
+}
+
+#else
+
+int jpegdec_to_tracker(struct tracker* tracker, const void* data, size_t size, int scale, long long timestamp) {
+  LOGW("Unable to decode JPEG frame: cozmo was built without libjpeg");
+  return 1;
+}
+
+#endif // #ifdef COZMONAUT_HAVE_JPEG
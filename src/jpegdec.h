@@ -0,0 +1,33 @@
+/*
+ * Cozmonaut
+ * Copyright 2019 The Cozmonaut Contributors
+ */
+
+#ifndef JPEGDEC_H
+#define JPEGDEC_H
+
+#include <stddef.h>
+
+struct tracker;
+
+/**
+ * Decode a JPEG frame straight into a tracker.
+ *
+ * The frame is decoded to RGB24 in place in the tracker frame buffer, so no
+ * full-size copy is made along the way. With a scale above one, the decoder
+ * scales down in the DCT domain, which skips most of the inverse DCT work for
+ * the pixels that would be thrown away.
+ *
+ * This is only available when cozmo is built with libjpeg (see
+ * COZMONAUT_HAVE_JPEG). Otherwise, it always fails.
+ *
+ * @param tracker The face tracker
+ * @param data The JPEG data
+ * @param size The JPEG data size
+ * @param scale The downscale factor (1, 2, 4, or 8)
+ * @param timestamp The capture time in nanoseconds on the monotonic clock (or zero)
+ * @return Zero on success, otherwise nonzero
+ */
+int jpegdec_to_tracker(struct tracker* tracker, const void* data, size_t size, int scale, long long timestamp);
+
+#endif // #ifndef JPEGDEC_H
@@ -0,0 +1,88 @@
+/*
+ * Cozmonaut
+ * Copyright 2019 The Cozmonaut Contributors
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "linebuf.h"
+
+/** The initial buffer capacity. */
+#define LINEBUF__INITIAL_CAP 256
+
+/**
+ * Make room in a line buffer.
+ *
+ * @param self The line buffer
+ * @param need The required capacity
+ */
+static void linebuf__reserve(struct linebuf* self, size_t need) {
+  if (need <= self->cap) {
+    return;
+  }
+
+  // Grow geometrically so a run of small writes settles quickly
+  size_t cap = self->cap ? self->cap : LINEBUF__INITIAL_CAP;
+  while (cap < need) {
+    cap *= 2;
+  }
+
+  self->data = realloc(self->data, cap);
+  self->cap = cap;
+}
+
+void linebuf_write(struct linebuf* self, const char* str, size_t len, linebuf_lines_cb cb, void* user) {
+  // Append the text (plus room for a terminator)
+  // The buffered partial line has no newline in it, so only the new text needs scanning
+  linebuf__reserve(self, self->len + len + 1);
+  memcpy(self->data + self->len, str, len);
+
+  char* begin = self->data;
+  char* scan = self->data + self->len;
+  char* end = scan + len;
+
+  const char* lines[LINEBUF_BATCH];
+  unsigned int num = 0;
+
+  // Split off every complete line in one pass
+  char* nl;
+  while ((nl = memchr(scan, '\n', (size_t) (end - scan))) != NULL) {
+    // Terminate the line in place
+    *nl = '\0';
+    lines[num++] = begin;
+
+    // Hand off a full batch
+    if (num == LINEBUF_BATCH) {
+      cb(lines, num, user);
+      num = 0;
+    }
+
+    begin = scan = nl + 1;
+  }
+
+  // Hand off the remaining lines
+  if (num) {
+    cb(lines, num, user);
+  }
+
+  // Keep the partial line at the front of the buffer
+  self->len = (size_t) (end - begin);
+  if (begin != self->data) {
+    memmove(self->data, begin, self->len);
+  }
+}
+
+void linebuf_flush(struct linebuf* self, linebuf_lines_cb cb, void* user) {
+  if (self->len == 0) {
+    return;
+  }
+
+  // Terminate the partial line (there is always room for this)
+  self->data[self->len] = '\0';
+
+  const char* line = self->data;
+  cb(&line, 1, user);
+
+  self->len = 0;
+}
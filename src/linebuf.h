@@ -0,0 +1,69 @@
+/*
+ * Cozmonaut
+ * Copyright 2019 The Cozmonaut Contributors
+ */
+
+#ifndef LINEBUF_H
+#define LINEBUF_H
+
+#include <stddef.h>
+
+/** The most lines handed off in one batch. */
+#define LINEBUF_BATCH 32
+
+/**
+ * A line buffer.
+ *
+ * Text is appended to a growable buffer and split into lines in place. The
+ * buffer is reused across writes and never shrinks, so steady-state writes do
+ * not touch the allocator. A zero-initialized line buffer is ready to use.
+ */
+struct linebuf {
+  /** The buffer data. */
+  char* data;
+
+  /** The length of the buffered partial line. */
+  size_t len;
+
+  /** The buffer capacity. */
+  size_t cap;
+};
+
+/**
+ * A batch of complete lines.
+ *
+ * The lines are NUL-terminated, without their newlines, and only valid for the
+ * duration of the call.
+ *
+ * @param lines The lines
+ * @param num The number of lines
+ * @param user The user pointer
+ */
+typedef void (* linebuf_lines_cb)(const char* const* lines, unsigned int num, void* user);
+
+/**
+ * Write text to a line buffer.
+ *
+ * Complete lines are handed to the callback in batches of up to LINEBUF_BATCH.
+ * Any trailing partial line stays buffered for the next write.
+ *
+ * @param self The line buffer
+ * @param str The text
+ * @param len The text length
+ * @param cb The callback for complete lines
+ * @param user The user pointer for the callback
+ */
+void linebuf_write(struct linebuf* self, const char* str, size_t len, linebuf_lines_cb cb, void* user);
+
+/**
+ * Flush a line buffer.
+ *
+ * Any buffered partial line is handed to the callback as if it were complete.
+ *
+ * @param self The line buffer
+ * @param cb The callback for the line
+ * @param user The user pointer for the callback
+ */
+void linebuf_flush(struct linebuf* self, linebuf_lines_cb cb, void* user);
+
+#endif // #ifndef LINEBUF_H
@@ -0,0 +1,197 @@
+/*
+ * Cozmonaut
+ * Copyright 2019 The Cozmonaut Contributors
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include "lockprof.h"
+
+const unsigned long long lockprof_bucket_ns[LOCKPROF_BUCKETS - 1] = {
+  1000ULL,
+  4000ULL,
+  16000ULL,
+  64000ULL,
+  256000ULL,
+  1000000ULL,
+  4000000ULL,
+  16000000ULL,
+  64000000ULL,
+  256000000ULL,
+  1000000000ULL,
+};
+
+#ifdef COZMONAUT_LOCK_PROFILE
+
+/** The most profiled locks a thread can hold at once. */
+#define LOCKPROF__MAX_HELD 8
+
+/** A profiled lock held by the current thread. */
+struct lockprof__hold {
+  /** The lock. */
+  void* lock;
+
+  /** The call site that took it. */
+  struct lockprof__site* site;
+
+  /** When it was taken. */
+  unsigned long long since;
+};
+
+/** The profiled call sites reached so far (a lock-free stack). */
+static struct lockprof__site* lockprof__sites;
+
+/** The profiled locks held by the current thread, innermost last. */
+static __thread struct lockprof__hold lockprof__holds[LOCKPROF__MAX_HELD];
+
+/** The number of profiled locks held by the current thread. */
+static __thread int lockprof__num_holds;
+
+unsigned long long lockprof__now() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (unsigned long long) now.tv_sec * 1000000000ULL + (unsigned long long) now.tv_nsec;
+}
+
+/**
+ * Find the histogram bucket for a duration.
+ *
+ * @param ns The duration in nanoseconds
+ * @return The bucket index
+ */
+static int lockprof__bucket(unsigned long long ns) {
+  int bucket = 0;
+  while (bucket < LOCKPROF_BUCKETS - 1 && ns > lockprof_bucket_ns[bucket]) {
+    ++bucket;
+  }
+  return bucket;
+}
+
+/**
+ * Raise a maximum.
+ *
+ * @param max The maximum
+ * @param value The new value
+ */
+static void lockprof__raise_max(unsigned long long* max, unsigned long long value) {
+  unsigned long long old = __atomic_load_n(max, __ATOMIC_RELAXED);
+  while (value > old && !__atomic_compare_exchange_n(max, &old, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+/**
+ * Put a call site on the global list the first time it is reached.
+ *
+ * @param site The call site
+ */
+static void lockprof__register(struct lockprof__site* site) {
+  if (__atomic_load_n(&site->registered, __ATOMIC_ACQUIRE) || __atomic_exchange_n(&site->registered, 1, __ATOMIC_ACQ_REL)) {
+    return;
+  }
+
+  site->stats.lock = site->lock;
+  site->stats.file = site->file;
+  site->stats.line = site->line;
+
+  struct lockprof__site* head = __atomic_load_n(&lockprof__sites, __ATOMIC_RELAXED);
+  do {
+    site->next = head;
+  } while (!__atomic_compare_exchange_n(&lockprof__sites, &head, site, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+void lockprof__acquired(struct lockprof__site* site, void* lock, unsigned long long since, int contended) {
+  unsigned long long now = lockprof__now();
+  unsigned long long wait = now - since;
+
+  lockprof__register(site);
+
+  struct lockprof_stats* stats = &site->stats;
+  __atomic_add_fetch(&stats->acquisitions, 1, __ATOMIC_RELAXED);
+  if (contended) {
+    __atomic_add_fetch(&stats->contended, 1, __ATOMIC_RELAXED);
+  }
+  __atomic_add_fetch(&stats->wait_ns, wait, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&stats->wait_hist[lockprof__bucket(wait)], 1, __ATOMIC_RELAXED);
+  lockprof__raise_max(&stats->wait_max_ns, wait);
+
+  // Remember who took the lock, so the hold time goes to the right site
+  if (lock && lockprof__num_holds < LOCKPROF__MAX_HELD) {
+    lockprof__holds[lockprof__num_holds++] = (struct lockprof__hold) {lock, site, now};
+  }
+}
+
+void lockprof__held(struct lockprof__site* site, unsigned long long since) {
+  unsigned long long hold = lockprof__now() - since;
+
+  lockprof__register(site);
+
+  struct lockprof_stats* stats = &site->stats;
+  __atomic_add_fetch(&stats->hold_ns, hold, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&stats->hold_hist[lockprof__bucket(hold)], 1, __ATOMIC_RELAXED);
+  lockprof__raise_max(&stats->hold_max_ns, hold);
+}
+
+void lockprof__released(void* lock) {
+  // Locks are mostly released innermost first, so search from the top
+  for (int i = lockprof__num_holds - 1; i >= 0; --i) {
+    if (lockprof__holds[i].lock == lock) {
+      struct lockprof__hold hold = lockprof__holds[i];
+
+      for (int j = i + 1; j < lockprof__num_holds; ++j) {
+        lockprof__holds[j - 1] = lockprof__holds[j];
+      }
+      --lockprof__num_holds;
+
+      lockprof__held(hold.site, hold.since);
+      return;
+    }
+  }
+}
+
+void lockprof__mutex_lock(struct lockprof__site* site, pthread_mutex_t* mutex) {
+  unsigned long long since = lockprof__now();
+
+  // Only block if someone else has it
+  int contended = pthread_mutex_trylock(mutex) == EBUSY;
+  if (contended) {
+    pthread_mutex_lock(mutex);
+  }
+
+  lockprof__acquired(site, mutex, since, contended);
+}
+
+void lockprof_for_each(lockprof_visit_cb cb, void* user) {
+  for (struct lockprof__site* site = __atomic_load_n(&lockprof__sites, __ATOMIC_ACQUIRE); site; site = site->next) {
+    // Take a snapshot of the counters
+    // They are read one at a time, so they may be a few acquisitions apart
+    struct lockprof_stats stats = {
+      .lock = site->stats.lock,
+      .file = site->stats.file,
+      .line = site->stats.line,
+      .acquisitions = __atomic_load_n(&site->stats.acquisitions, __ATOMIC_RELAXED),
+      .contended = __atomic_load_n(&site->stats.contended, __ATOMIC_RELAXED),
+      .wait_ns = __atomic_load_n(&site->stats.wait_ns, __ATOMIC_RELAXED),
+      .hold_ns = __atomic_load_n(&site->stats.hold_ns, __ATOMIC_RELAXED),
+      .wait_max_ns = __atomic_load_n(&site->stats.wait_max_ns, __ATOMIC_RELAXED),
+      .hold_max_ns = __atomic_load_n(&site->stats.hold_max_ns, __ATOMIC_RELAXED),
+    };
+
+    for (int i = 0; i < LOCKPROF_BUCKETS; ++i) {
+      stats.wait_hist[i] = __atomic_load_n(&site->stats.wait_hist[i], __ATOMIC_RELAXED);
+      stats.hold_hist[i] = __atomic_load_n(&site->stats.hold_hist[i], __ATOMIC_RELAXED);
+    }
+
+    cb(&stats, user);
+  }
+}
+
+#else
+
+void lockprof_for_each(lockprof_visit_cb cb, void* user) {
+}
+
+#endif // #ifdef COZMONAUT_LOCK_PROFILE
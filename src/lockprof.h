@@ -0,0 +1,215 @@
+/*
+ * Cozmonaut
+ * Copyright 2019 The Cozmonaut Contributors
+ */
+
+#ifndef LOCKPROF_H
+#define LOCKPROF_H
+
+#include <pthread.h>
+
+//
+// Lock profiler
+//
+// Built with the COZMONAUT_LOCK_PROFILE option, the hot locks are taken
+// through the macros below, which record per call site how many times the lock
+// was taken, how many of those had to wait for another thread, and histograms
+// of the time spent waiting for it and holding it. The results are served
+// through base.lock_stats() and the metrics endpoint. Built without the option,
+// the macros are the plain pthread and Python calls.
+//
+// The GIL is profiled where our own C code takes it: its wait times are real,
+// but it has no try-lock, so an acquisition counts as contended when it waits
+// longer than a scheduler hiccup. Python hands the GIL around between our
+// acquisitions out of our sight, so hold times are instead measured around the
+// base calls that do real work with it.
+//
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** The number of histogram buckets. */
+#define LOCKPROF_BUCKETS 12
+
+/** The upper bounds of all but the last (unbounded) histogram bucket in nanoseconds. */
+extern const unsigned long long lockprof_bucket_ns[LOCKPROF_BUCKETS - 1];
+
+/** A snapshot of the statistics of one call site. */
+struct lockprof_stats {
+  /** The lock name. */
+  const char* lock;
+
+  /** The source file of the call site. */
+  const char* file;
+
+  /** The source line of the call site. */
+  int line;
+
+  /** The number of acquisitions. */
+  unsigned long long acquisitions;
+
+  /** The number of acquisitions that had to wait. */
+  unsigned long long contended;
+
+  /** The total wait time in nanoseconds. */
+  unsigned long long wait_ns;
+
+  /** The total hold time in nanoseconds. */
+  unsigned long long hold_ns;
+
+  /** The longest wait in nanoseconds. */
+  unsigned long long wait_max_ns;
+
+  /** The longest hold in nanoseconds. */
+  unsigned long long hold_max_ns;
+
+  /** The wait time histogram (counts per bucket, not cumulative). */
+  unsigned long long wait_hist[LOCKPROF_BUCKETS];
+
+  /** The hold time histogram (counts per bucket, not cumulative). */
+  unsigned long long hold_hist[LOCKPROF_BUCKETS];
+};
+
+/**
+ * A lock profile visitor.
+ *
+ * @param stats The call site statistics
+ * @param user The user pointer
+ */
+typedef void (* lockprof_visit_cb)(const struct lockprof_stats* stats, void* user);
+
+/**
+ * Visit every profiled call site that has been reached so far.
+ *
+ * This does nothing without COZMONAUT_LOCK_PROFILE.
+ *
+ * @param cb The visitor
+ * @param user The user pointer for the visitor
+ */
+void lockprof_for_each(lockprof_visit_cb cb, void* user);
+
+#ifdef COZMONAUT_LOCK_PROFILE
+
+/** A profiled call site. Counters are updated atomically. @private */
+struct lockprof__site {
+  /** The lock name. */
+  const char* lock;
+
+  /** The source file. */
+  const char* file;
+
+  /** The source line. */
+  int line;
+
+  /** Nonzero once the site is on the global list. */
+  int registered;
+
+  /** The next site on the global list. */
+  struct lockprof__site* next;
+
+  /** The statistics. */
+  struct lockprof_stats stats;
+};
+
+/** @private */
+void lockprof__mutex_lock(struct lockprof__site* site, pthread_mutex_t* mutex);
+
+/** @private */
+unsigned long long lockprof__now();
+
+/** @private */
+void lockprof__acquired(struct lockprof__site* site, void* lock, unsigned long long since, int contended);
+
+/** @private */
+void lockprof__released(void* lock);
+
+/** @private */
+void lockprof__held(struct lockprof__site* site, unsigned long long since);
+
+/** Declare the call site statistics for a lock. @private */
+#define LOCKPROF__SITE(name) \
+  static struct lockprof__site lockprof__site = {.lock = name, .file = __FILE__, .line = __LINE__}
+
+/**
+ * Lock a profiled mutex.
+ *
+ * @param mutex The mutex
+ * @param name The lock name (a string literal)
+ */
+#define LOCKPROF_MUTEX_LOCK(mutex, name) \
+  do { \
+    LOCKPROF__SITE(name); \
+    lockprof__mutex_lock(&lockprof__site, (mutex)); \
+  } while (0)
+
+/**
+ * Unlock a profiled mutex.
+ *
+ * @param mutex The mutex
+ */
+#define LOCKPROF_MUTEX_UNLOCK(mutex) \
+  do { \
+    lockprof__released(mutex); \
+    pthread_mutex_unlock(mutex); \
+  } while (0)
+
+/** Contended GIL acquisitions wait at least this long in nanoseconds. */
+#define LOCKPROF_GIL_CONTENDED_NS 50000ULL
+
+/**
+ * Ensure the GIL (profiled PyGILState_Ensure()).
+ *
+ * @param state The PyGILState_STATE to assign
+ */
+#define LOCKPROF_GIL_ENSURE(state) \
+  do { \
+    LOCKPROF__SITE("gil"); \
+    unsigned long long lockprof__since = lockprof__now(); \
+    (state) = PyGILState_Ensure(); \
+    lockprof__acquired(&lockprof__site, NULL, lockprof__since, \
+      lockprof__now() - lockprof__since >= LOCKPROF_GIL_CONTENDED_NS); \
+  } while (0)
+
+/** Release the GIL around a block (profiled Py_BEGIN_ALLOW_THREADS). */
+#define LOCKPROF_BEGIN_ALLOW_THREADS \
+  { \
+    PyThreadState* lockprof__save = PyEval_SaveThread();
+
+/** Take the GIL back after a block (profiled Py_END_ALLOW_THREADS). */
+#define LOCKPROF_END_ALLOW_THREADS \
+    LOCKPROF__SITE("gil"); \
+    unsigned long long lockprof__since = lockprof__now(); \
+    PyEval_RestoreThread(lockprof__save); \
+    lockprof__acquired(&lockprof__site, NULL, lockprof__since, \
+      lockprof__now() - lockprof__since >= LOCKPROF_GIL_CONTENDED_NS); \
+  }
+
+/** Begin a base call that holds the GIL throughout. */
+#define LOCKPROF_GIL_HOLD_BEGIN() \
+  unsigned long long lockprof__hold_since = lockprof__now()
+
+/** End a base call that holds the GIL throughout. */
+#define LOCKPROF_GIL_HOLD_END() \
+  do { \
+    LOCKPROF__SITE("gil"); \
+    lockprof__held(&lockprof__site, lockprof__hold_since); \
+  } while (0)
+
+#else
+
+#define LOCKPROF_MUTEX_LOCK(mutex, name) pthread_mutex_lock(mutex)
+#define LOCKPROF_MUTEX_UNLOCK(mutex) pthread_mutex_unlock(mutex)
+#define LOCKPROF_GIL_ENSURE(state) ((state) = PyGILState_Ensure())
+#define LOCKPROF_BEGIN_ALLOW_THREADS Py_BEGIN_ALLOW_THREADS
+#define LOCKPROF_END_ALLOW_THREADS Py_END_ALLOW_THREADS
+#define LOCKPROF_GIL_HOLD_BEGIN() do {} while (0)
+#define LOCKPROF_GIL_HOLD_END() do {} while (0)
+
+#endif // #ifdef COZMONAUT_LOCK_PROFILE
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // #ifndef LOCKPROF_H
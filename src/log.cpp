@@ -3,6 +3,9 @@
  * Copyright 2019 The Cozmonaut Contributors
  */
 
+#include <atomic>
+#include <cstdio>
+#include <ctime>
 #include <string_view>
 #include <vector>
 
@@ -11,9 +14,16 @@
 #include <fmt/time.h>
 
 #include "log.h"
+#include "trace.h"
 
 // FIXME: This entire file is a stopgap until better logging is in place
 
+/** The number of records submitted at each level. */
+static std::atomic<unsigned long long> log_counts[log_level_fatal + 1];
+
+/** The number of bytes written. */
+static std::atomic<unsigned long long> log_bytes_written;
+
 static std::string_view log_level_aligned_name(log_level level) {
   switch (level) {
     case log_level_trace:
@@ -33,9 +43,14 @@ static std::string_view log_level_aligned_name(log_level level) {
   return nullptr;
 }
 
-void log_submit(const log_record* rec) {
-  // TODO: Move all this to a logging thread with a wait-free input buffer
-
+/**
+ * Format a log record.
+ *
+ * @param out The output buffer
+ * @param rec The record
+ * @param tm The local time
+ */
+static void log_format(fmt::memory_buffer& out, const log_record* rec, const std::tm& tm) {
   // The initial argument vector
   std::vector<fmt::basic_format_arg<fmt::format_context>> args_vec;
 
@@ -95,7 +110,42 @@ void log_submit(const log_record* rec) {
   fmt::basic_format_args<fmt::format_context> args(args_vec.data(), static_cast<unsigned int>(args_vec.size()));
 
   // TODO: Allow different log formats and outputs
+  fmt::format_to(out, "[{:%Y-%m-%d %H:%m:%S}] ({}:{}) {}: ", tm, rec->src_file, rec->src_line,
+    log_level_aligned_name(rec->level));
+  fmt::vformat_to(out, rec->msg_fmt, args);
+  out.push_back('\n');
+}
+
+void log_submit(const log_record* rec) {
+  log_submit_batch(rec, 1);
+}
+
+void log_submit_batch(const log_record* recs, unsigned int num) {
+  // TODO: Move all this to a logging thread with a wait-free input buffer
+
+  trace_begin("log_submit");
+
   auto time = std::time(nullptr);
-  fmt::print("[{:%Y-%m-%d %H:%m:%S}] ({}:{}) {}: {}\n", *std::localtime(&time), rec->src_file, rec->src_line,
-    log_level_aligned_name(rec->level), fmt::vformat(rec->msg_fmt, args));
+  auto tm = *std::localtime(&time);
+
+  // Format the whole batch up front
+  fmt::memory_buffer out;
+  for (unsigned int i = 0; i < num; ++i) {
+    log_format(out, &recs[i], tm);
+    log_counts[recs[i].level].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Write it out in one go
+  std::fwrite(out.data(), 1, out.size(), stdout);
+  log_bytes_written.fetch_add(out.size(), std::memory_order_relaxed);
+
+  trace_end();
+}
+
+unsigned long long log_count(log_level level) {
+  return log_counts[level].load(std::memory_order_relaxed);
+}
+
+unsigned long long log_bytes() {
+  return log_bytes_written.load(std::memory_order_relaxed);
 }
@@ -89,6 +89,36 @@ extern "C" {
  */
 void log_submit(const struct log_record* rec);
 
+/**
+ * Submit a batch of log records.
+ *
+ * The records are written out together in order, which is cheaper than
+ * submitting them one at a time.
+ *
+ * @param recs The records
+ * @param num The number of records
+ */
+void log_submit_batch(const struct log_record* recs, unsigned int num);
+
+/**
+ * Count the log records submitted so far at a level.
+ *
+ * This takes no locks and can be called from any thread.
+ *
+ * @param level The log level
+ * @return The number of records
+ */
+unsigned long long log_count(enum log_level level);
+
+/**
+ * Count the bytes of log output written so far.
+ *
+ * This takes no locks and can be called from any thread.
+ *
+ * @return The number of bytes
+ */
+unsigned long long log_bytes();
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
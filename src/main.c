@@ -3,23 +3,63 @@
  * Copyright 2019 The Cozmonaut Contributors
  */
 
+#include <stdint.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "client.h"
+#include "headless.h"
+#include "metrics.h"
 #include "service.h"
+#include "trace.h"
+#include "tracker.h"
 
-int main() {
-  // Start the client service
-  service_start(SERVICE_CLIENT);
+int main(int argc, char* argv[]) {
+  // Tracing has to be on before any thread we want to see starts
+  trace_init();
+
+  // Headless mode drives a tracker from C alone, with no services
+  if (argc > 1 && strcmp(argv[1], "headless") == 0) {
+    return headless_main(argc - 1, argv + 1);
+  }
+
+  // The services to run, with dependencies listed before their dependents
+  // Each waits only for its own dependencies, so the client waits for metrics but not the tracker
+  struct service* const services[] = {
+    SERVICE_METRICS,
+    SERVICE_TRACKER,
+    SERVICE_CLIENT,
+    NULL,
+  };
+
+  // Start the services
+  // The Python VM comes up on this thread while the detector loads on another
+  service_start_all(services);
+
+  // Load generator mode runs its scaling test to completion and exits
+  if (argc > 1 && strcmp(argv[1], "loadgen") == 0) {
+    service_post(SERVICE_CLIENT, client_call_select, (void*) client_op_loadgen, argv + 2);
+    service_post(SERVICE_CLIENT, client_call_start, NULL, NULL);
+
+    // Wait for the test to finish
+    void* ret = NULL;
+    service_call(SERVICE_CLIENT, client_call_join, NULL, NULL, &ret);
+
+    // Stop the services
+    service_stop_all(services);
+
+    return (int) (intptr_t) ret;
+  }
 
   // Start interactive mode
-  service_call(SERVICE_CLIENT, client_call_select, (void*) client_op_interact, NULL, NULL);
-  service_call(SERVICE_CLIENT, client_call_start, NULL, NULL, NULL);
+  // The client runs these in order on its own thread
+  service_post(SERVICE_CLIENT, client_call_select, (void*) client_op_interact, NULL);
+  service_post(SERVICE_CLIENT, client_call_start, NULL, NULL);
 
   do {
     sleep(1);
   } while (1);
 
-  // Stop the client service
-  service_stop(SERVICE_CLIENT);
+  // Stop the services
+  service_stop_all(services);
 }
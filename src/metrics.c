@@ -0,0 +1,447 @@
+/*
+ * Cozmonaut
+ * Copyright 2019 The Cozmonaut Contributors
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "affinity.h"
+#include "lockprof.h"
+#include "log.h"
+#include "metrics.h"
+#include "service.h"
+
+/** The most collectors that can be registered. */
+#define METRICS__MAX_COLLECTORS 16
+
+/** How often the server checks whether it should stop in milliseconds. */
+#define METRICS__POLL_MS 250
+
+struct metrics_out {
+  /** The buffer data. */
+  char* data;
+
+  /** The buffer length. */
+  size_t len;
+
+  /** The buffer capacity. */
+  size_t cap;
+};
+
+/** A registered collector. */
+struct metrics__collector {
+  /** The collector. */
+  metrics_collect_cb cb;
+
+  /** The user pointer. */
+  void* user;
+};
+
+/** The collector mutex. Held for the whole of each scrape. */
+static pthread_mutex_t metrics__mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** The registered collectors. */
+static struct metrics__collector metrics__collectors[METRICS__MAX_COLLECTORS];
+
+/** The number of registered collectors. */
+static int metrics__num_collectors;
+
+/** The listening socket (-1 if not listening). */
+static int metrics__fd = -1;
+
+/** The server thread. */
+static pthread_t metrics__thread;
+
+/** The server kill switch. */
+static volatile int metrics__kill;
+
+/** The scrape buffer. Reused across scrapes, and only touched on the server thread. */
+static struct metrics_out metrics__out;
+
+void metrics_add_collector(metrics_collect_cb cb, void* user) {
+  pthread_mutex_lock(&metrics__mutex);
+
+  if (metrics__num_collectors < METRICS__MAX_COLLECTORS) {
+    metrics__collectors[metrics__num_collectors++] = (struct metrics__collector) {cb, user};
+  } else {
+    LOGW("Too many metrics collectors");
+  }
+
+  pthread_mutex_unlock(&metrics__mutex);
+}
+
+void metrics_remove_collector(metrics_collect_cb cb, void* user) {
+  pthread_mutex_lock(&metrics__mutex);
+
+  for (int i = 0; i < metrics__num_collectors; ++i) {
+    if (metrics__collectors[i].cb == cb && metrics__collectors[i].user == user) {
+      metrics__collectors[i] = metrics__collectors[--metrics__num_collectors];
+      break;
+    }
+  }
+
+  pthread_mutex_unlock(&metrics__mutex);
+}
+
+void metrics_printf(struct metrics_out* out, const char* fmt, ...) {
+  va_list args;
+
+  do {
+    va_start(args, fmt);
+    int len = vsnprintf(out->data + out->len, out->cap - out->len, fmt, args);
+    va_end(args);
+
+    if (len < 0) {
+      return;
+    }
+
+    // Done if it fit
+    if (out->len + (size_t) len < out->cap) {
+      out->len += (size_t) len;
+      return;
+    }
+
+    // Otherwise, grow the buffer and go again
+    out->cap = out->cap ? 2 * out->cap + (size_t) len : 4096 + (size_t) len;
+    out->data = realloc(out->data, out->cap);
+  } while (1);
+}
+
+void metrics_family(struct metrics_out* out, const char* name, const char* type, const char* help) {
+  metrics_printf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/**
+ * Collect the CPU time of each thread in the process.
+ *
+ * @param out The scrape
+ */
+static void metrics__collect_threads(struct metrics_out* out) {
+  DIR* dir = opendir("/proc/self/task");
+  if (!dir) {
+    return;
+  }
+
+  metrics_family(out, "cozmonaut_thread_cpu_seconds_total", "counter", "CPU time used by each thread.");
+
+  double tick = (double) sysconf(_SC_CLK_TCK);
+
+  struct dirent* entry;
+  while ((entry = readdir(dir))) {
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+
+    // Skip names that would not fit rather than opening a truncated path
+    char path[PATH_MAX];
+    int path_len = snprintf(path, sizeof path, "/proc/self/task/%s/stat", entry->d_name);
+    if (path_len < 0 || (size_t) path_len >= sizeof path) {
+      continue;
+    }
+
+    FILE* file = fopen(path, "r");
+    if (!file) {
+      continue;
+    }
+
+    char stat[512];
+    size_t len = fread(stat, 1, sizeof stat - 1, file);
+    fclose(file);
+    stat[len] = '\0';
+
+    // The thread name is in parentheses and may itself contain spaces or parentheses
+    char* name = strchr(stat, '(');
+    char* name_end = strrchr(stat, ')');
+    if (!name || !name_end) {
+      continue;
+    }
+    *name_end = '\0';
+    ++name;
+
+    // Skip ahead to utime and stime (fields 14 and 15, counting the name as field 2)
+    unsigned long utime;
+    unsigned long stime;
+    if (sscanf(name_end + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) {
+      continue;
+    }
+
+    // Keep the label value clean
+    for (char* c = name; *c; ++c) {
+      if (*c == '"' || *c == '\\') {
+        *c = '_';
+      }
+    }
+
+    metrics_printf(out, "cozmonaut_thread_cpu_seconds_total{thread=\"%s\",tid=\"%s\"} %.2f\n", name, entry->d_name,
+      (double) (utime + stime) / tick);
+  }
+
+  closedir(dir);
+}
+
+/**
+ * Collect the log counters.
+ *
+ * @param out The scrape
+ */
+static void metrics__collect_log(struct metrics_out* out) {
+  static const char* const levels[] = {"trace", "debug", "info", "warn", "error", "fatal"};
+
+  metrics_family(out, "cozmonaut_log_records_total", "counter", "Log records submitted by level.");
+  for (int level = log_level_trace; level <= log_level_fatal; ++level) {
+    metrics_printf(out, "cozmonaut_log_records_total{level=\"%s\"} %llu\n", levels[level], log_count(level));
+  }
+
+  metrics_family(out, "cozmonaut_log_bytes_total", "counter", "Bytes of log output written.");
+  metrics_printf(out, "cozmonaut_log_bytes_total %llu\n", log_bytes());
+}
+
+#ifdef COZMONAUT_LOCK_PROFILE
+
+/** State for writing out lock profile histograms. */
+struct metrics__lock_ctx {
+  /** The scrape. */
+  struct metrics_out* out;
+
+  /** The metric name being written. */
+  const char* name;
+
+  /** Nonzero for hold times, zero for wait times. */
+  int hold;
+};
+
+/**
+ * Write out one lock profile call site.
+ *
+ * @param stats The call site statistics
+ * @param user The lock profile state
+ */
+static void metrics__lock_visit(const struct lockprof_stats* stats, void* user) {
+  struct metrics__lock_ctx* ctx = user;
+
+  // Name the site by file base name and line
+  const char* file = strrchr(stats->file, '/');
+  file = file ? file + 1 : stats->file;
+
+  // Counters only come with the wait time histograms
+  if (!ctx->name) {
+    metrics_printf(ctx->out, "cozmonaut_lock_contended_total{lock=\"%s\",site=\"%s:%d\"} %llu\n", stats->lock, file,
+      stats->line, stats->contended);
+    return;
+  }
+
+  const unsigned long long* hist = ctx->hold ? stats->hold_hist : stats->wait_hist;
+
+  // Prometheus buckets are cumulative
+  unsigned long long count = 0;
+  for (int i = 0; i < LOCKPROF_BUCKETS; ++i) {
+    count += hist[i];
+
+    if (i < LOCKPROF_BUCKETS - 1) {
+      metrics_printf(ctx->out, "%s_bucket{lock=\"%s\",site=\"%s:%d\",le=\"%g\"} %llu\n", ctx->name, stats->lock, file,
+        stats->line, (double) lockprof_bucket_ns[i] / 1e9, count);
+    } else {
+      metrics_printf(ctx->out, "%s_bucket{lock=\"%s\",site=\"%s:%d\",le=\"+Inf\"} %llu\n", ctx->name, stats->lock, file,
+        stats->line, count);
+    }
+  }
+
+  metrics_printf(ctx->out, "%s_sum{lock=\"%s\",site=\"%s:%d\"} %.9f\n", ctx->name, stats->lock, file, stats->line,
+    (double) (ctx->hold ? stats->hold_ns : stats->wait_ns) / 1e9);
+  metrics_printf(ctx->out, "%s_count{lock=\"%s\",site=\"%s:%d\"} %llu\n", ctx->name, stats->lock, file, stats->line,
+    count);
+}
+
+#endif // #ifdef COZMONAUT_LOCK_PROFILE
+
+/**
+ * Collect the lock profile.
+ *
+ * This writes nothing unless built with COZMONAUT_LOCK_PROFILE.
+ *
+ * @param out The scrape
+ */
+static void metrics__collect_locks(struct metrics_out* out) {
+#ifdef COZMONAUT_LOCK_PROFILE
+  struct metrics__lock_ctx ctx = {out, NULL, 0};
+
+  metrics_family(out, "cozmonaut_lock_contended_total", "counter", "Lock acquisitions that had to wait.");
+  lockprof_for_each(&metrics__lock_visit, &ctx);
+
+  ctx.name = "cozmonaut_lock_wait_seconds";
+  metrics_family(out, ctx.name, "histogram", "Time spent waiting for locks.");
+  lockprof_for_each(&metrics__lock_visit, &ctx);
+
+  ctx.name = "cozmonaut_lock_hold_seconds";
+  ctx.hold = 1;
+  metrics_family(out, ctx.name, "histogram", "Time spent holding locks.");
+  lockprof_for_each(&metrics__lock_visit, &ctx);
+#endif
+}
+
+/**
+ * Serve one request.
+ *
+ * @param fd The client socket
+ */
+static void metrics__serve(int fd) {
+  // Don't let a stuck client hold up the server
+  struct timeval timeout = {1, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+
+  // The request line is all we look at
+  char req[1024];
+  ssize_t len = recv(fd, req, sizeof req - 1, 0);
+  if (len <= 0) {
+    return;
+  }
+  req[len] = '\0';
+
+  if (strncmp(req, "GET /metrics", 12) != 0 && strncmp(req, "GET / ", 6) != 0) {
+    static const char not_found[] = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+    send(fd, not_found, sizeof not_found - 1, MSG_NOSIGNAL);
+    return;
+  }
+
+  // Run the collectors
+  struct metrics_out* out = &metrics__out;
+  out->len = 0;
+
+  pthread_mutex_lock(&metrics__mutex);
+
+  for (int i = 0; i < metrics__num_collectors; ++i) {
+    metrics__collectors[i].cb(out, metrics__collectors[i].user);
+  }
+
+  pthread_mutex_unlock(&metrics__mutex);
+
+  metrics__collect_threads(out);
+  metrics__collect_log(out);
+  metrics__collect_locks(out);
+
+  // Send the response
+  char head[128];
+  int head_len = snprintf(head, sizeof head,
+    "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %lu\r\n\r\n",
+    (unsigned long) out->len);
+  send(fd, head, (size_t) head_len, MSG_NOSIGNAL | MSG_MORE);
+
+  for (size_t sent = 0; sent < out->len;) {
+    ssize_t num = send(fd, out->data + sent, out->len - sent, MSG_NOSIGNAL);
+    if (num <= 0) {
+      break;
+    }
+    sent += (size_t) num;
+  }
+}
+
+/**
+ * The server thread.
+ *
+ * @param arg Unused
+ * @return Unused
+ */
+static void* metrics__thread_main(void* arg) {
+  affinity_apply(affinity_role_io, "cz-metrics");
+
+  while (!metrics__kill) {
+    struct pollfd pfd = {.fd = metrics__fd, .events = POLLIN};
+    if (poll(&pfd, 1, METRICS__POLL_MS) <= 0) {
+      continue;
+    }
+
+    int fd = accept(metrics__fd, NULL, NULL);
+    if (fd < 0) {
+      continue;
+    }
+
+    metrics__serve(fd);
+    close(fd);
+  }
+
+  return NULL;
+}
+
+void metrics_on_start(struct service* svc) {
+  const char* port_str = getenv("COZMONAUT_METRICS_PORT");
+  if (!port_str) {
+    LOGD("Metrics endpoint is off (set COZMONAUT_METRICS_PORT to turn it on)");
+    return;
+  }
+
+  int port = atoi(port_str);
+  if (port <= 0 || port > 65535) {
+    LOGE("Bad metrics port: {}", _str(port_str));
+    return;
+  }
+
+  // Listen on localhost only
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    LOGE("Unable to create metrics socket: {}", _str(strerror(errno)));
+    return;
+  }
+
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+
+  struct sockaddr_in addr = {
+    .sin_family = AF_INET,
+    .sin_port = htons((unsigned short) port),
+    .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+  };
+  if (bind(fd, (struct sockaddr*) &addr, sizeof addr) < 0 || listen(fd, 8) < 0) {
+    LOGE("Unable to listen for metrics on port {}: {}", _i(port), _str(strerror(errno)));
+    close(fd);
+    return;
+  }
+
+  // Spawn server thread
+  metrics__fd = fd;
+  metrics__kill = 0;
+  int err = pthread_create(&metrics__thread, NULL, &metrics__thread_main, NULL);
+  if (err) {
+    LOGE("Unable to spawn metrics thread: {}", _str(strerror(err)));
+    metrics__fd = -1;
+    close(fd);
+    return;
+  }
+
+  LOGI("Serving metrics on http://127.0.0.1:{}/metrics", _i(port));
+}
+
+void metrics_on_stop(struct service* svc) {
+  if (metrics__fd < 0) {
+    return;
+  }
+
+  // Wait for server thread to die
+  metrics__kill = 1;
+  pthread_join(metrics__thread, NULL);
+
+  close(metrics__fd);
+  metrics__fd = -1;
+
+  free(metrics__out.data);
+  metrics__out = (struct metrics_out) {0};
+}
+
+struct service metrics_service = {
+  .name = "metrics",
+  .on_start = &metrics_on_start,
+  .on_stop = &metrics_on_stop,
+};
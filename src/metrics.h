@@ -0,0 +1,73 @@
+/*
+ * Cozmonaut
+ * Copyright 2019 The Cozmonaut Contributors
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+//
+// Metrics endpoint
+//
+// With the COZMONAUT_METRICS_PORT environment variable set, the metrics
+// service serves runtime counters over HTTP on that port on localhost, in the
+// Prometheus text format, from its own thread. Each scrape runs the registered
+// collectors, which write out their metrics. Collectors must only read
+// lock-free counters, so a scrape never holds up the pipeline. Per-thread CPU
+// time and log counters are always collected.
+//
+
+/** A metrics scrape in progress. */
+struct metrics_out;
+
+/**
+ * A metrics collector.
+ *
+ * @param out The scrape to write to
+ * @param user The user pointer
+ */
+typedef void (* metrics_collect_cb)(struct metrics_out* out, void* user);
+
+/**
+ * Register a metrics collector.
+ *
+ * @param cb The collector
+ * @param user The user pointer for the collector
+ */
+void metrics_add_collector(metrics_collect_cb cb, void* user);
+
+/**
+ * Unregister a metrics collector.
+ *
+ * When this returns, the collector is no longer running.
+ *
+ * @param cb The collector
+ * @param user The user pointer for the collector
+ */
+void metrics_remove_collector(metrics_collect_cb cb, void* user);
+
+/**
+ * Write the header of a metric family.
+ *
+ * @param out The scrape
+ * @param name The metric name
+ * @param type The metric type ("counter", "gauge", or "histogram")
+ * @param help The help text
+ */
+void metrics_family(struct metrics_out* out, const char* name, const char* type, const char* help);
+
+/**
+ * Write formatted text to a scrape.
+ *
+ * @param out The scrape
+ * @param fmt The printf-style format
+ */
+void metrics_printf(struct metrics_out* out, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/** The metrics service. */
+extern struct service metrics_service;
+
+/** The metrics service, for service lists and dependencies. */
+#define SERVICE_METRICS (&metrics_service)
+
+#endif // #ifndef METRICS_H
@@ -0,0 +1,73 @@
+/*
+ * Cozmonaut
+ * Copyright 2019 The Cozmonaut Contributors
+ */
+
+#include <time.h>
+
+#include <pthread.h>
+
+#include <spdyface/dlib_ffd_detector.h>
+
+#include "log.h"
+#include "models.h"
+
+/** The model cache mutex. Never held during detection. */
+static pthread_mutex_t models__mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** The idle face detectors. */
+static SFDetector models__idle_detectors[MODELS_MAX_IDLE_DETECTORS];
+
+/** The number of idle face detectors. */
+static int models__num_idle_detectors;
+
+SFDetector models_acquire_detector() {
+  // Reuse an idle detector if there is one
+  pthread_mutex_lock(&models__mutex);
+  if (models__num_idle_detectors > 0) {
+    SFDetector detector = models__idle_detectors[--models__num_idle_detectors];
+    pthread_mutex_unlock(&models__mutex);
+    return detector;
+  }
+  pthread_mutex_unlock(&models__mutex);
+
+  // Otherwise, load one outside the lock, as this is the slow part
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  SFDetector detector;
+  sfDlibFFDDetectorCreate((SFDlibFFDDetector*) &detector);
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  LOGI("Face detector loaded after {} ms",
+    _d((double) (now.tv_sec - start.tv_sec) * 1e3 + (double) (now.tv_nsec - start.tv_nsec) / 1e6));
+
+  return detector;
+}
+
+void models_release_detector(SFDetector detector) {
+  // Keep the detector for the next user if there is room
+  pthread_mutex_lock(&models__mutex);
+  if (models__num_idle_detectors < MODELS_MAX_IDLE_DETECTORS) {
+    models__idle_detectors[models__num_idle_detectors++] = detector;
+    pthread_mutex_unlock(&models__mutex);
+    return;
+  }
+  pthread_mutex_unlock(&models__mutex);
+
+  sfDlibFFDDetectorDestroy((SFDlibFFDDetector) &detector);
+  LOGD("Face detector unloaded");
+}
+
+void models_flush_detectors() {
+  pthread_mutex_lock(&models__mutex);
+
+  while (models__num_idle_detectors > 0) {
+    SFDetector detector = models__idle_detectors[--models__num_idle_detectors];
+    sfDlibFFDDetectorDestroy((SFDlibFFDDetector) &detector);
+    LOGD("Face detector unloaded");
+  }
+
+  pthread_mutex_unlock(&models__mutex);
+}
@@ -0,0 +1,49 @@
+/*
+ * Cozmonaut
+ * Copyright 2019 The Cozmonaut Contributors
+ */
+
+#ifndef MODELS_H
+#define MODELS_H
+
+#include <spdyface.h>
+
+//
+// Model cache
+//
+// spdyface builds its face detector from weights compiled into the library,
+// so the weights themselves are read-only data shared by the whole process.
+// What each detector adds on top is its own scanning state, which is not safe
+// to use from several threads at once. Every tracker therefore runs its own
+// detector, and detection needs no lock. Loading a detector is slow, though,
+// so detectors are handed back here when a tracker is done with them and
+// reused by the next one instead of being loaded again.
+//
+
+/** The most idle detectors kept around for reuse. */
+#define MODELS_MAX_IDLE_DETECTORS 2
+
+/**
+ * Acquire a face detector for exclusive use.
+ *
+ * This reuses an idle detector if there is one, and otherwise loads a new one.
+ *
+ * @return The detector
+ */
+SFDetector models_acquire_detector();
+
+/**
+ * Release a face detector.
+ *
+ * The detector is kept for reuse, or destroyed if enough already are.
+ *
+ * @param detector The detector
+ */
+void models_release_detector(SFDetector detector);
+
+/**
+ * Destroy all idle face detectors.
+ */
+void models_flush_detectors();
+
+#endif // #ifndef MODELS_H
@@ -0,0 +1,270 @@
+/*
+ * Cozmonaut
+ * Copyright 2019 The Cozmonaut Contributors
+ */
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "registry.h"
+
+/** A registry entry. */
+struct registry__entry {
+  /** The key. */
+  int key;
+
+  /** The value. */
+  void* value;
+};
+
+/** An immutable registry snapshot. */
+struct registry__snapshot {
+  /** The number of entries. */
+  size_t num;
+
+  /** The entries, sorted by key. */
+  struct registry__entry entries[];
+};
+
+struct registry {
+  /** The current snapshot. */
+  _Atomic(struct registry__snapshot*) snapshot;
+
+  /** The snapshot generation. Starts at one, so zeroed handles never match. */
+  atomic_ulong generation;
+
+  /** The read epoch. Only its parity matters to readers. */
+  atomic_uint epoch;
+
+  /** The number of readers in each epoch parity. */
+  atomic_uint readers[2];
+
+  /** The writer mutex. */
+  pthread_mutex_t write_mutex;
+
+  /** The value destructor. */
+  registry_free_cb free_cb;
+
+  /** The user pointer for the value destructor. */
+  void* user;
+};
+
+/**
+ * Allocate a snapshot.
+ *
+ * @param num The number of entries
+ * @return The snapshot
+ */
+static struct registry__snapshot* registry__snapshot_new(size_t num) {
+  struct registry__snapshot* snapshot = malloc(sizeof(struct registry__snapshot) + num * sizeof(struct registry__entry));
+  snapshot->num = num;
+  return snapshot;
+}
+
+/**
+ * Find the index of a key in a snapshot.
+ *
+ * @param snapshot The snapshot
+ * @param key The key
+ * @param [out] index The index of the key, or where it would be inserted
+ * @return Nonzero if the key is present, otherwise zero
+ */
+static int registry__search(const struct registry__snapshot* snapshot, int key, size_t* index) {
+  size_t lo = 0;
+  size_t hi = snapshot->num;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (snapshot->entries[mid].key < key) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  *index = lo;
+  return lo < snapshot->num && snapshot->entries[lo].key == key;
+}
+
+/**
+ * Wait for every read section that might see an old snapshot to end.
+ *
+ * Readers register under the parity of the epoch they entered in. Flipping the
+ * epoch sends new readers to the other counter, so once the old counter drains
+ * nobody can still hold a snapshot from before the flip.
+ *
+ * @param self The registry
+ */
+static void registry__synchronize(struct registry* self) {
+  unsigned int epoch = atomic_fetch_add(&self->epoch, 1);
+
+  while (atomic_load(&self->readers[epoch & 1])) {
+    sched_yield();
+  }
+}
+
+/**
+ * Publish a new snapshot and retire the old one.
+ *
+ * Call this with the writer mutex held.
+ *
+ * @param self The registry
+ * @param snapshot The new snapshot
+ */
+static void registry__publish(struct registry* self, struct registry__snapshot* snapshot) {
+  struct registry__snapshot* old = atomic_exchange(&self->snapshot, snapshot);
+  atomic_fetch_add(&self->generation, 1);
+
+  // Nobody can be reading the old snapshot after this
+  registry__synchronize(self);
+  free(old);
+}
+
+struct registry* registry_new(registry_free_cb free_cb, void* user) {
+  // Allocate instance memory
+  struct registry* self = calloc(1, sizeof(struct registry));
+
+  atomic_init(&self->snapshot, registry__snapshot_new(0));
+  atomic_init(&self->generation, 1);
+  atomic_init(&self->epoch, 0);
+  atomic_init(&self->readers[0], 0);
+  atomic_init(&self->readers[1], 0);
+  pthread_mutex_init(&self->write_mutex, NULL);
+  self->free_cb = free_cb;
+  self->user = user;
+
+  return self;
+}
+
+void registry_delete(struct registry* self) {
+  struct registry__snapshot* snapshot = atomic_load(&self->snapshot);
+
+  // Free the remaining values
+  for (size_t i = 0; i < snapshot->num; ++i) {
+    self->free_cb(snapshot->entries[i].value, self->user);
+  }
+
+  free(snapshot);
+  pthread_mutex_destroy(&self->write_mutex);
+
+  // Free instance memory
+  free(self);
+}
+
+int registry_add(struct registry* self, int key, void* value) {
+  // Lock the writer mutex
+  pthread_mutex_lock(&self->write_mutex);
+
+  struct registry__snapshot* old = atomic_load(&self->snapshot);
+
+  size_t index;
+  if (registry__search(old, key, &index)) {
+    // Unlock the writer mutex
+    pthread_mutex_unlock(&self->write_mutex);
+
+    return 1;
+  }
+
+  // Copy the table with the new entry spliced in
+  struct registry__snapshot* snapshot = registry__snapshot_new(old->num + 1);
+  memcpy(snapshot->entries, old->entries, index * sizeof(struct registry__entry));
+  snapshot->entries[index] = (struct registry__entry) {
+    .key = key,
+    .value = value,
+  };
+  memcpy(snapshot->entries + index + 1, old->entries + index, (old->num - index) * sizeof(struct registry__entry));
+
+  registry__publish(self, snapshot);
+
+  // Unlock the writer mutex
+  pthread_mutex_unlock(&self->write_mutex);
+
+  return 0;
+}
+
+int registry_remove(struct registry* self, int key) {
+  // Lock the writer mutex
+  pthread_mutex_lock(&self->write_mutex);
+
+  struct registry__snapshot* old = atomic_load(&self->snapshot);
+
+  size_t index;
+  if (!registry__search(old, key, &index)) {
+    // Unlock the writer mutex
+    pthread_mutex_unlock(&self->write_mutex);
+
+    return 1;
+  }
+
+  void* value = old->entries[index].value;
+
+  // Copy the table with the entry cut out
+  struct registry__snapshot* snapshot = registry__snapshot_new(old->num - 1);
+  memcpy(snapshot->entries, old->entries, index * sizeof(struct registry__entry));
+  memcpy(snapshot->entries + index, old->entries + index + 1, (old->num - index - 1) * sizeof(struct registry__entry));
+
+  // Once this returns, no reader can still see the value
+  registry__publish(self, snapshot);
+
+  // Unlock the writer mutex
+  pthread_mutex_unlock(&self->write_mutex);
+
+  self->free_cb(value, self->user);
+  return 0;
+}
+
+unsigned int registry_read_lock(struct registry* self) {
+  while (1) {
+    unsigned int epoch = atomic_load(&self->epoch);
+    atomic_fetch_add(&self->readers[epoch & 1], 1);
+
+    // If a writer flipped the epoch in the meantime, it may not have seen us
+    if (atomic_load(&self->epoch) == epoch) {
+      return epoch;
+    }
+
+    atomic_fetch_sub(&self->readers[epoch & 1], 1);
+  }
+}
+
+void registry_read_unlock(struct registry* self, unsigned int token) {
+  atomic_fetch_sub(&self->readers[token & 1], 1);
+}
+
+void* registry_find(struct registry* self, int key) {
+  const struct registry__snapshot* snapshot = atomic_load(&self->snapshot);
+
+  size_t index;
+  if (!registry__search(snapshot, key, &index)) {
+    return NULL;
+  }
+
+  return snapshot->entries[index].value;
+}
+
+void registry_for_each(struct registry* self, registry_visit_cb cb, void* user) {
+  const struct registry__snapshot* snapshot = atomic_load(&self->snapshot);
+
+  for (size_t i = 0; i < snapshot->num; ++i) {
+    cb(snapshot->entries[i].key, snapshot->entries[i].value, user);
+  }
+}
+
+void* registry_handle_find(struct registry* self, struct registry_handle* handle, int key) {
+  unsigned long generation = atomic_load(&self->generation);
+
+  // Reuse the cached value if nothing has changed
+  if (handle->generation == generation && handle->key == key) {
+    return handle->value;
+  }
+
+  // The generation is read first, so a concurrent change just refreshes us again next time
+  handle->key = key;
+  handle->generation = generation;
+  handle->value = registry_find(self, key);
+  return handle->value;
+}
@@ -0,0 +1,162 @@
+/*
+ * Cozmonaut
+ * Copyright 2019 The Cozmonaut Contributors
+ */
+
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+/**
+ * A registry.
+ *
+ * This maps integer keys (robot IDs) to values. Reads are lock-free and may
+ * come from any thread, while writes are serialized and copy-on-write: every
+ * add or remove publishes a fresh snapshot of the whole table. A removed value
+ * is handed to the free callback only after every read section that might
+ * still see it has ended.
+ *
+ * Reads happen inside read sections:
+ *
+ *   unsigned int token = registry_read_lock(registry);
+ *   void* value = registry_find(registry, key);
+ *   ... use value ...
+ *   registry_read_unlock(registry, token);
+ *
+ * Read sections must be short, must not nest, and must not block on anything
+ * a writer might hold. In particular, a writer must never be inside a read
+ * section, as it waits for all of them to end.
+ */
+struct registry;
+
+/**
+ * A cached registry lookup.
+ *
+ * Keep one of these per thread (e.g. in thread-local storage) for a key that
+ * is looked up over and over. While the registry is unchanged, resolving the
+ * handle is a single load and compare. A zero-initialized handle is ready to
+ * use.
+ */
+struct registry_handle {
+  /** The cached key. */
+  int key;
+
+  /** The registry generation the cached value belongs to. */
+  unsigned long generation;
+
+  /** The cached value (nullable). */
+  void* value;
+};
+
+/**
+ * A registry value destructor.
+ *
+ * @param value The value
+ * @param user The user pointer
+ */
+typedef void (* registry_free_cb)(void* value, void* user);
+
+/**
+ * Create a registry.
+ *
+ * @param free_cb The value destructor
+ * @param user The user pointer for the value destructor
+ * @return The registry
+ */
+struct registry* registry_new(registry_free_cb free_cb, void* user);
+
+/**
+ * Destroy a registry.
+ *
+ * All remaining values are handed to the free callback. There must be no
+ * readers left.
+ *
+ * @param self The registry
+ */
+void registry_delete(struct registry* self);
+
+/**
+ * Add a value.
+ *
+ * @param self The registry
+ * @param key The key
+ * @param value The value
+ * @return Zero on success, otherwise nonzero if the key is taken
+ */
+int registry_add(struct registry* self, int key, void* value);
+
+/**
+ * Remove a value.
+ *
+ * This waits for in-flight read sections to end and then hands the value to
+ * the free callback on the calling thread.
+ *
+ * @param self The registry
+ * @param key The key
+ * @return Zero on success, otherwise nonzero if the key is unknown
+ */
+int registry_remove(struct registry* self, int key);
+
+/**
+ * Enter a read section.
+ *
+ * @param self The registry
+ * @return The token to pass to registry_read_unlock()
+ */
+unsigned int registry_read_lock(struct registry* self);
+
+/**
+ * Leave a read section.
+ *
+ * @param self The registry
+ * @param token The token from registry_read_lock()
+ */
+void registry_read_unlock(struct registry* self, unsigned int token);
+
+/**
+ * Look up a value.
+ *
+ * Only call this inside a read section. The value stays valid until the
+ * section ends.
+ *
+ * @param self The registry
+ * @param key The key
+ * @return The value, or NULL if the key is unknown
+ */
+void* registry_find(struct registry* self, int key);
+
+/**
+ * A registry visitor.
+ *
+ * @param key The key
+ * @param value The value
+ * @param user The user pointer
+ */
+typedef void (* registry_visit_cb)(int key, void* value, void* user);
+
+/**
+ * Visit every value in key order.
+ *
+ * Only call this inside a read section. The values stay valid until the
+ * section ends.
+ *
+ * @param self The registry
+ * @param cb The visitor
+ * @param user The user pointer for the visitor
+ */
+void registry_for_each(struct registry* self, registry_visit_cb cb, void* user);
+
+/**
+ * Look up a value through a cached handle.
+ *
+ * Only call this inside a read section. The handle is refreshed if the key or
+ * the registry has changed since it was last resolved. The value stays valid
+ * until the section ends.
+ *
+ * @param self The registry
+ * @param handle The handle
+ * @param key The key
+ * @return The value, or NULL if the key is unknown
+ */
+void* registry_handle_find(struct registry* self, struct registry_handle* handle, int key);
+
+#endif // #ifndef REGISTRY_H
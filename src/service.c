@@ -3,38 +3,559 @@
  * Copyright 2019 The Cozmonaut Contributors
  */
 
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <time.h>
+
+#include "affinity.h"
 #include "log.h"
 #include "service.h"
 
-void service_start(struct service* svc) {
+/** A message in a service mailbox. */
+struct service__message {
+  /** The next message in the queue. */
+  _Atomic(struct service__message*) next;
+
+  /** The function number. */
+  int fn;
+
+  /** An argument. */
+  void* arg1;
+
+  /** An argument. */
+  void* arg2;
+
+  /** The future to complete (nullable). */
+  struct service_future* future;
+
+  /** Nonzero if this message tells the worker to exit. */
+  int stop;
+};
+
+struct service_future {
+  /** Posted once the call has finished. */
+  sem_t done;
+
+  /** The call result. */
+  int result;
+
+  /** The value returned through the call's ret argument. */
+  void* ret;
+};
+
+/**
+ * A service mailbox.
+ *
+ * This is an intrusive multi-producer, single-consumer queue after Dmitry
+ * Vyukov's design. Producers only ever swap the head pointer, so posting never
+ * takes a lock. The consumer is the worker thread, which sleeps on a counting
+ * semaphore while the queue is empty.
+ */
+struct service_mailbox {
+  /** The most recently pushed message. Shared by producers. */
+  _Atomic(struct service__message*) head;
+
+  /** The oldest message. Only touched by the worker. */
+  struct service__message* tail;
+
+  /** The stub message that keeps the queue from ever being empty. */
+  struct service__message stub;
+
+  /** The number of messages posted but not yet taken. */
+  sem_t pending;
+
+  /** The worker thread. */
+  pthread_t worker;
+};
+
+/** The service state mutex. */
+static pthread_mutex_t service__mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Signaled whenever a service starts. */
+static pthread_cond_t service__cond = PTHREAD_COND_INITIALIZER;
+
+/**
+ * Invoke a service call on the current thread.
+ *
+ * @param svc The service definition
+ * @param fn The function number
+ * @param arg1 An argument
+ * @param arg2 An argument
+ * @param ret An argument designed for return
+ * @return Zero on success, otherwise nonzero
+ */
+static int service__invoke(struct service* svc, int fn, void* arg1, void* arg2, void** ret) {
+  if (!svc->call) {
+    LOGW("No call interface on {}", _str(svc->name));
+    return 1;
+  }
+
+  int res = svc->call(svc, fn, arg1, arg2, ret);
+  if (res) {
+    LOGE("Service call {} on {} failed with code {}", _i(fn), _str(svc->name), _i(res));
+  }
+
+  return res;
+}
+
+/**
+ * Push a message onto a mailbox.
+ *
+ * @param mailbox The mailbox
+ * @param msg The message
+ */
+static void service__push(struct service_mailbox* mailbox, struct service__message* msg) {
+  atomic_store_explicit(&msg->next, NULL, memory_order_relaxed);
+
+  // Claim our place in line, then link the previous message to us
+  struct service__message* prev = atomic_exchange_explicit(&mailbox->head, msg, memory_order_acq_rel);
+  atomic_store_explicit(&prev->next, msg, memory_order_release);
+}
+
+/**
+ * Pop a message off of a mailbox.
+ *
+ * This may come up empty while a producer is midway through a push.
+ *
+ * @param mailbox The mailbox
+ * @return The message, or NULL if none is ready
+ */
+static struct service__message* service__pop(struct service_mailbox* mailbox) {
+  struct service__message* tail = mailbox->tail;
+  struct service__message* next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+  // Skip over the stub
+  if (tail == &mailbox->stub) {
+    if (!next) {
+      return NULL;
+    }
+
+    mailbox->tail = next;
+    tail = next;
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+  }
+
+  if (next) {
+    mailbox->tail = next;
+    return tail;
+  }
+
+  // The tail is the last message unless a push is in flight
+  if (tail != atomic_load_explicit(&mailbox->head, memory_order_acquire)) {
+    return NULL;
+  }
+
+  // Put the stub back behind the last message so it can be taken
+  service__push(mailbox, &mailbox->stub);
+
+  next = atomic_load_explicit(&tail->next, memory_order_acquire);
+  if (next) {
+    mailbox->tail = next;
+    return tail;
+  }
+
+  return NULL;
+}
+
+/**
+ * Post a message to a mailbox.
+ *
+ * @param mailbox The mailbox
+ * @param msg The message
+ */
+static void service__post(struct service_mailbox* mailbox, struct service__message* msg) {
+  service__push(mailbox, msg);
+  sem_post(&mailbox->pending);
+}
+
+/**
+ * Main function for a service worker thread.
+ *
+ * @param arg The service definition
+ * @return Not used
+ */
+static void* service__worker_main(void* arg) {
+  struct service* svc = arg;
+  struct service_mailbox* mailbox = svc->mailbox;
+
+  // Name the worker after its service
+  char name[16];
+  snprintf(name, sizeof name, "cz-%s", svc->name);
+  affinity_apply(affinity_role_io, name);
+
+  LOGD("Service {} worker is online", _str(svc->name));
+
+  while (1) {
+    // Sleep until something is posted
+    while (sem_wait(&mailbox->pending) < 0 && errno == EINTR) {
+    }
+
+    // The message was counted, so it shows up as soon as its push completes
+    struct service__message* msg;
+    while (!(msg = service__pop(mailbox))) {
+      sched_yield();
+    }
+
+    if (msg->stop) {
+      free(msg);
+      break;
+    }
+
+    void* ret = NULL;
+    int res = service__invoke(svc, msg->fn, msg->arg1, msg->arg2, &ret);
+
+    // Hand the reply back to whoever is waiting
+    if (msg->future) {
+      msg->future->result = res;
+      msg->future->ret = ret;
+      sem_post(&msg->future->done);
+    }
+
+    free(msg);
+  }
+
+  LOGD("Service {} worker is offline", _str(svc->name));
+  return NULL;
+}
+
+/**
+ * Get the milliseconds elapsed since a point in time.
+ *
+ * @param start The point in time (monotonic clock)
+ * @return The elapsed milliseconds
+ */
+static double service__elapsed_ms(const struct timespec* start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double) (now.tv_sec - start->tv_sec) * 1e3 + (double) (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/**
+ * Wait for the dependencies of a service to be running.
+ *
+ * @param svc The service definition
+ */
+static void service__wait_deps(struct service* svc) {
+  if (!svc->deps) {
+    return;
+  }
+
+  pthread_mutex_lock(&service__mutex);
+
+  for (struct service* const* dep = svc->deps; *dep; ++dep) {
+    while (!(*dep)->running) {
+      pthread_cond_wait(&service__cond, &service__mutex);
+    }
+  }
+
+  pthread_mutex_unlock(&service__mutex);
+}
+
+/**
+ * Start a service whose dependencies are running.
+ *
+ * @param svc The service definition
+ */
+static void service__start_one(struct service* svc) {
   LOGD("Request to start {}", _str(svc->name));
 
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
   if (svc->on_start) {
     svc->on_start(svc);
-    LOGT("Service {} has started", _str(svc->name));
   } else {
     LOGW("No start callback on {}", _str(svc->name));
   }
+
+  // Open the mailbox for asynchronous services
+  if (svc->async) {
+    struct service_mailbox* mailbox = calloc(1, sizeof(struct service_mailbox));
+    atomic_init(&mailbox->head, &mailbox->stub);
+    atomic_init(&mailbox->stub.next, NULL);
+    mailbox->tail = &mailbox->stub;
+    sem_init(&mailbox->pending, 0, 0);
+
+    svc->mailbox = mailbox;
+    int err = pthread_create(&mailbox->worker, NULL, &service__worker_main, svc);
+
+    // Without a worker, calls run on the caller's thread like a synchronous service
+    if (err) {
+      LOGE("Unable to spawn the {} worker: {}", _str(svc->name), _str(strerror(err)));
+
+      svc->mailbox = NULL;
+      sem_destroy(&mailbox->pending);
+      free(mailbox);
+    }
+  }
+
+  // Let dependents go
+  pthread_mutex_lock(&service__mutex);
+  svc->running = 1;
+  pthread_cond_broadcast(&service__cond);
+  pthread_mutex_unlock(&service__mutex);
+
+  LOGI("Service {} has started after {} ms", _str(svc->name), _d(service__elapsed_ms(&start)));
+}
+
+/**
+ * Main function for a service start-up thread.
+ *
+ * @param arg The service definition
+ * @return Not used
+ */
+static void* service__start_main(void* arg) {
+  struct service* svc = arg;
+
+  service__wait_deps(svc);
+  service__start_one(svc);
+
+  return NULL;
+}
+
+/**
+ * Find a service in a list.
+ *
+ * @param svcs The service definitions (NULL-terminated)
+ * @param svc The service definition
+ * @return The index of the service, or -1 if it is not listed
+ */
+static long service__find(struct service* const* svcs, struct service* svc) {
+  for (long i = 0; svcs[i]; ++i) {
+    if (svcs[i] == svc) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+/** Marks a service to be started on the calling thread. */
+#define SERVICE__MARK_INLINE 1
+
+/** Marks a service already walked by service__start_inline(). */
+#define SERVICE__MARK_VISITED 2
+
+/**
+ * Start the services of a list that go on the calling thread, in dependency order.
+ *
+ * This walks through the dependencies that have start-up threads of their own
+ * as well, since those may in turn wait on one of ours.
+ *
+ * @param svcs The service definitions (NULL-terminated)
+ * @param marks The service marks (SERVICE__MARK_*)
+ * @param i The index of the service to start
+ */
+static void service__start_inline(struct service* const* svcs, unsigned char* marks, long i) {
+  if (marks[i] & SERVICE__MARK_VISITED) {
+    return;
+  }
+
+  marks[i] |= SERVICE__MARK_VISITED;
+
+  // Get the listed dependencies going first
+  if (svcs[i]->deps) {
+    for (struct service* const* dep = svcs[i]->deps; *dep; ++dep) {
+      long j = service__find(svcs, *dep);
+      if (j >= 0) {
+        service__start_inline(svcs, marks, j);
+      }
+    }
+  }
+
+  if (marks[i] & SERVICE__MARK_INLINE) {
+    service__start_main(svcs[i]);
+  }
+}
+
+void service_start(struct service* svc) {
+  if (service_running(svc)) {
+    return;
+  }
+
+  // Start dependencies first
+  if (svc->deps) {
+    for (struct service* const* dep = svc->deps; *dep; ++dep) {
+      service_start(*dep);
+    }
+  }
+
+  service__start_one(svc);
+}
+
+void service_start_all(struct service* const* svcs) {
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  // Start outside dependencies up front, as nobody else will
+  for (struct service* const* svc = svcs; *svc; ++svc) {
+    if ((*svc)->deps) {
+      for (struct service* const* dep = (*svc)->deps; *dep; ++dep) {
+        if (service__find(svcs, *dep) < 0) {
+          service_start(*dep);
+        }
+      }
+    }
+  }
+
+  size_t num = 0;
+  while (svcs[num]) {
+    ++num;
+  }
+
+  pthread_t* threads = calloc(num, sizeof(pthread_t));
+  unsigned char* marks = calloc(num, 1);
+
+  // Give every other service its own start-up thread
+  // Each one waits for its own dependencies, so they finish in dependency order
+  for (size_t i = 0; i < num; ++i) {
+    if (svcs[i]->main_thread) {
+      marks[i] = SERVICE__MARK_INLINE;
+      continue;
+    }
+
+    // Failing that, the service starts on this thread with the main thread ones
+    int err = pthread_create(&threads[i], NULL, &service__start_main, svcs[i]);
+    if (err) {
+      LOGE("Unable to spawn the {} start-up thread: {}", _str(svcs[i]->name), _str(strerror(err)));
+      marks[i] = SERVICE__MARK_INLINE;
+    }
+  }
+
+  // Start the services that go on this thread while the others come up
+  for (size_t i = 0; i < num; ++i) {
+    service__start_inline(svcs, marks, (long) i);
+  }
+
+  for (size_t i = 0; i < num; ++i) {
+    if (!(marks[i] & SERVICE__MARK_INLINE)) {
+      pthread_join(threads[i], NULL);
+    }
+  }
+
+  free(marks);
+  free(threads);
+
+  LOGI("All {} services have started after {} ms", _ul(num), _d(service__elapsed_ms(&start)));
 }
 
 void service_stop(struct service* svc) {
   LOGD("Request to stop {}", _str(svc->name));
 
+  pthread_mutex_lock(&service__mutex);
+  svc->running = 0;
+  pthread_mutex_unlock(&service__mutex);
+
+  // Close the mailbox after everything already posted has run
+  if (svc->mailbox) {
+    struct service_mailbox* mailbox = svc->mailbox;
+
+    struct service__message* msg = calloc(1, sizeof(struct service__message));
+    msg->stop = 1;
+    service__post(mailbox, msg);
+    pthread_join(mailbox->worker, NULL);
+
+    svc->mailbox = NULL;
+    sem_destroy(&mailbox->pending);
+    free(mailbox);
+  }
+
   if (svc->on_stop) {
     svc->on_stop(svc);
     LOGT("Service {} has stopped", _str(svc->name));
   } else {
-    LOGW("No start callback on {}", _str(svc->name));
+    LOGW("No stop callback on {}", _str(svc->name));
   }
 }
 
+void service_stop_all(struct service* const* svcs) {
+  size_t num = 0;
+  while (svcs[num]) {
+    ++num;
+  }
+
+  while (num--) {
+    service_stop(svcs[num]);
+  }
+}
+
+int service_running(struct service* svc) {
+  pthread_mutex_lock(&service__mutex);
+  int running = svc->running;
+  pthread_mutex_unlock(&service__mutex);
+
+  return running;
+}
+
 void service_call(struct service* svc, int fn, void* arg1, void* arg2, void** ret) {
-  if (svc->call) {
-    int res = svc->call(svc, fn, arg1, arg2, ret);
-    if (res) {
-      LOGE("Service call {} on {} failed with code {}", _i(fn), _str(svc->name), _i(res));
-    }
-  } else {
-    LOGW("No call interface on {}", _str(svc->name));
+  // Run inline if there is no worker, or if we are the worker (waiting on ourselves would deadlock)
+  if (!svc->mailbox || pthread_equal(pthread_self(), svc->mailbox->worker)) {
+    service__invoke(svc, fn, arg1, arg2, ret);
+    return;
+  }
+
+  service_future_wait(service_request(svc, fn, arg1, arg2), ret);
+}
+
+void service_post(struct service* svc, int fn, void* arg1, void* arg2) {
+  if (!svc->mailbox) {
+    void* ret = NULL;
+    service__invoke(svc, fn, arg1, arg2, &ret);
+    return;
+  }
+
+  struct service__message* msg = calloc(1, sizeof(struct service__message));
+  msg->fn = fn;
+  msg->arg1 = arg1;
+  msg->arg2 = arg2;
+  service__post(svc->mailbox, msg);
+}
+
+struct service_future* service_request(struct service* svc, int fn, void* arg1, void* arg2) {
+  struct service_future* fut = calloc(1, sizeof(struct service_future));
+  sem_init(&fut->done, 0, 0);
+
+  // Without a worker, the reply is in before we return
+  if (!svc->mailbox) {
+    fut->result = service__invoke(svc, fn, arg1, arg2, &fut->ret);
+    sem_post(&fut->done);
+    return fut;
   }
+
+  struct service__message* msg = calloc(1, sizeof(struct service__message));
+  msg->fn = fn;
+  msg->arg1 = arg1;
+  msg->arg2 = arg2;
+  msg->future = fut;
+  service__post(svc->mailbox, msg);
+
+  return fut;
+}
+
+int service_future_done(struct service_future* fut) {
+  int value;
+  sem_getvalue(&fut->done, &value);
+  return value > 0;
+}
+
+int service_future_wait(struct service_future* fut, void** ret) {
+  while (sem_wait(&fut->done) < 0 && errno == EINTR) {
+  }
+
+  int result = fut->result;
+  if (ret) {
+    *ret = fut->ret;
+  }
+
+  sem_destroy(&fut->done);
+  free(fut);
+
+  return result;
 }
@@ -6,6 +6,12 @@
 #ifndef SERVICE_H
 #define SERVICE_H
 
+/** A service mailbox. */
+struct service_mailbox;
+
+/** A pending reply to a service request. */
+struct service_future;
+
 /** A service definition. */
 struct service {
   /** The service name. */
@@ -36,15 +42,65 @@ struct service {
    * @return Zero on success, otherwise nonzero
    */
   int (* call)(struct service* svc, int fn, void* arg1, void* arg2, void** ret);
+
+  /**
+   * Nonzero to run calls on the service's own worker thread.
+   *
+   * Such a service gets a mailbox when it starts. Calls posted to it are run
+   * one at a time, in the order they were posted, on the worker thread, so
+   * the call callback needs no locking of its own. Otherwise, or if the
+   * worker could not be spawned, calls run on the caller's thread.
+   */
+  int async;
+
+  /**
+   * The services this one needs running before it starts (nullable).
+   *
+   * This is a NULL-terminated array. Dependencies must not form a cycle.
+   */
+  struct service* const* deps;
+
+  /**
+   * Nonzero to start on the thread that calls service_start_all().
+   *
+   * Such a service does not get a start-up thread of its own. This is for
+   * services whose start and stop callbacks must run on the process main
+   * thread, such as the one that brings up the Python VM (Python delivers
+   * signals only to the thread that initialized it). Stop such a service from
+   * the same thread.
+   */
+  int main_thread;
+
+  /** The mailbox (nullable). This is managed by the service framework. */
+  struct service_mailbox* mailbox;
+
+  /** Nonzero while the service is running. This is managed by the service framework. */
+  int running;
 };
 
 /**
  * Start a service.
  *
+ * Any dependencies that are not yet running are started first, one at a time.
+ * Starting a running service does nothing.
+ *
  * @param svc The service definition
  */
 void service_start(struct service* svc);
 
+/**
+ * Start several services in parallel.
+ *
+ * Each service is started on its own thread as soon as its dependencies are
+ * running, so independent services come up side by side. Services marked
+ * main_thread are started on the calling thread instead, in dependency order,
+ * while the others come up. So is a service whose start-up thread could not be
+ * spawned. This returns once all of them are running.
+ *
+ * @param svcs The service definitions (NULL-terminated)
+ */
+void service_start_all(struct service* const* svcs);
+
 /**
  * Stop a service.
  *
@@ -53,7 +109,25 @@ void service_start(struct service* svc);
 void service_stop(struct service* svc);
 
 /**
- * Call a service.
+ * Stop several services.
+ *
+ * They are stopped one at a time in the reverse of the given order, so list
+ * dependencies before their dependents.
+ *
+ * @param svcs The service definitions (NULL-terminated)
+ */
+void service_stop_all(struct service* const* svcs);
+
+/**
+ * Check whether a service is running.
+ *
+ * @param svc The service definition
+ * @return Nonzero if the service is running, otherwise zero
+ */
+int service_running(struct service* svc);
+
+/**
+ * Call a service and wait for it to finish.
  *
  * @param svc The service definition
  * @param fn The function number
@@ -63,4 +137,47 @@ void service_stop(struct service* svc);
  */
 void service_call(struct service* svc, int fn, void* arg1, void* arg2, void** ret);
 
+/**
+ * Call a service without waiting.
+ *
+ * This never blocks on an asynchronous service. Failures are logged.
+ *
+ * @param svc The service definition
+ * @param fn The function number
+ * @param arg1 An argument
+ * @param arg2 An argument
+ */
+void service_post(struct service* svc, int fn, void* arg1, void* arg2);
+
+/**
+ * Call a service and collect the reply later.
+ *
+ * This never blocks on an asynchronous service. The future must be passed to
+ * service_future_wait() exactly once.
+ *
+ * @param svc The service definition
+ * @param fn The function number
+ * @param arg1 An argument
+ * @param arg2 An argument
+ * @return The future
+ */
+struct service_future* service_request(struct service* svc, int fn, void* arg1, void* arg2);
+
+/**
+ * Check whether a reply is in.
+ *
+ * @param fut The future
+ * @return Nonzero if the call has finished, otherwise zero
+ */
+int service_future_done(struct service_future* fut);
+
+/**
+ * Wait for a reply and free the future.
+ *
+ * @param fut The future
+ * @param [out] ret The value returned through the call's ret argument (nullable)
+ * @return The call result (zero on success, otherwise nonzero)
+ */
+int service_future_wait(struct service_future* fut, void** ret);
+
 #endif // #ifndef SERVICE_H
@@ -0,0 +1,135 @@
+/*
+ * Cozmonaut
+ * Copyright 2019 The Cozmonaut Contributors
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+
+#include <pthread.h>
+
+#include "slab.h"
+
+/** The object alignment. */
+#define SLAB__ALIGN 16
+
+/** A chunk of objects. */
+struct slab__chunk {
+  /** The next chunk. */
+  struct slab__chunk* next;
+};
+
+/** A free object. */
+struct slab__free {
+  /** The next free object. */
+  struct slab__free* next;
+};
+
+struct slab {
+  /** The slab mutex. */
+  pthread_mutex_t mutex;
+
+  /** The object size (rounded up to the alignment). */
+  size_t obj_size;
+
+  /** The number of objects in each chunk. */
+  size_t chunk_objs;
+
+  /** The chunks. */
+  struct slab__chunk* chunks;
+
+  /** The free objects. */
+  struct slab__free* free;
+};
+
+/**
+ * Carve a new chunk into free objects.
+ *
+ * Call this with the slab mutex held.
+ *
+ * @param self The slab
+ * @return Zero on success, otherwise nonzero
+ */
+static int slab__grow(struct slab* self) {
+  // The chunk header takes up the first slot to keep objects aligned
+  size_t header = (sizeof(struct slab__chunk) + SLAB__ALIGN - 1) / SLAB__ALIGN * SLAB__ALIGN;
+  void* mem;
+  if (posix_memalign(&mem, SLAB__ALIGN, header + self->obj_size * self->chunk_objs) != 0) {
+    return 1;
+  }
+
+  struct slab__chunk* chunk = mem;
+  chunk->next = self->chunks;
+  self->chunks = chunk;
+
+  // Thread the objects onto the free list in address order
+  char* objs = (char*) chunk + header;
+  for (size_t i = self->chunk_objs; i-- > 0;) {
+    struct slab__free* obj = (struct slab__free*) (objs + i * self->obj_size);
+    obj->next = self->free;
+    self->free = obj;
+  }
+
+  return 0;
+}
+
+struct slab* slab_new(size_t obj_size, size_t chunk_objs) {
+  // Allocate instance memory
+  struct slab* self = calloc(1, sizeof(struct slab));
+  if (!self) {
+    return NULL;
+  }
+
+  pthread_mutex_init(&self->mutex, NULL);
+
+  // Make room for the free list link and keep every object aligned
+  if (obj_size < sizeof(struct slab__free)) {
+    obj_size = sizeof(struct slab__free);
+  }
+  self->obj_size = (obj_size + SLAB__ALIGN - 1) / SLAB__ALIGN * SLAB__ALIGN;
+  self->chunk_objs = chunk_objs;
+
+  return self;
+}
+
+void slab_delete(struct slab* self) {
+  // Free all chunks
+  while (self->chunks) {
+    struct slab__chunk* next = self->chunks->next;
+    free(self->chunks);
+    self->chunks = next;
+  }
+
+  pthread_mutex_destroy(&self->mutex);
+
+  // Free instance memory
+  free(self);
+}
+
+void* slab_alloc(struct slab* self) {
+  pthread_mutex_lock(&self->mutex);
+
+  if (!self->free && slab__grow(self) != 0) {
+    pthread_mutex_unlock(&self->mutex);
+    return NULL;
+  }
+
+  struct slab__free* obj = self->free;
+  self->free = obj->next;
+
+  pthread_mutex_unlock(&self->mutex);
+
+  return obj;
+}
+
+void slab_free(struct slab* self, void* obj) {
+  struct slab__free* node = obj;
+
+  pthread_mutex_lock(&self->mutex);
+
+  node->next = self->free;
+  self->free = node;
+
+  pthread_mutex_unlock(&self->mutex);
+}
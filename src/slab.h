@@ -0,0 +1,58 @@
+/*
+ * Cozmonaut
+ * Copyright 2019 The Cozmonaut Contributors
+ */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+
+/**
+ * A slab allocator.
+ *
+ * This hands out fixed-size objects carved from large chunks. Freed objects go
+ * onto a free list and are handed out again before any new chunk is carved,
+ * so in steady state allocation never reaches the general allocator. Chunks
+ * are only returned when the slab is destroyed. Objects are aligned to 16
+ * bytes. The slab is safe to use from several threads.
+ */
+struct slab;
+
+/**
+ * Create a slab.
+ *
+ * @param obj_size The object size
+ * @param chunk_objs The number of objects to carve from each chunk
+ * @return The slab, or NULL on failure
+ */
+struct slab* slab_new(size_t obj_size, size_t chunk_objs);
+
+/**
+ * Destroy a slab.
+ *
+ * All objects from the slab become invalid.
+ *
+ * @param self The slab
+ */
+void slab_delete(struct slab* self);
+
+/**
+ * Allocate an object.
+ *
+ * The object memory is not cleared.
+ *
+ * @param self The slab
+ * @return The object, or NULL if a new chunk was needed and could not be had
+ */
+void* slab_alloc(struct slab* self);
+
+/**
+ * Free an object.
+ *
+ * @param self The slab
+ * @param obj The object
+ */
+void slab_free(struct slab* self, void* obj);
+
+#endif // #ifndef SLAB_H
@@ -0,0 +1,216 @@
+/*
+ * Cozmonaut
+ * Copyright 2019 The Cozmonaut Contributors
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "state.h"
+
+/** The mapped segment. */
+static struct state_segment* state__segment;
+
+/** The segment name. */
+static char state__name[256];
+
+/** The slot claim mutex. */
+static pthread_mutex_t state__mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Enter the write side of a seqlock.
+ *
+ * @param seq The sequence counter
+ */
+static void state__write_begin(unsigned int* seq) {
+  // Make the counter odd before touching the data
+  __atomic_store_n(seq, __atomic_load_n(seq, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * Leave the write side of a seqlock.
+ *
+ * @param seq The sequence counter
+ */
+static void state__write_end(unsigned int* seq) {
+  // Make the counter even after the data is in place
+  __atomic_store_n(seq, __atomic_load_n(seq, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Get the current wall time for update timestamps.
+ *
+ * @return Milliseconds since the epoch
+ */
+static long long state__time() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Check whether a mapped segment is published by another live process.
+ *
+ * @param segment The segment
+ * @return Nonzero if it is, otherwise zero
+ */
+static int state__owned_elsewhere(const struct state_segment* segment) {
+  if (__atomic_load_n(&segment->magic, __ATOMIC_ACQUIRE) != STATE_MAGIC) {
+    return 0;
+  }
+
+  // A process we may not signal is still alive
+  pid_t pid = segment->pid;
+  return pid > 0 && pid != getpid() && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+int state_open(const char* name) {
+  // Create or reuse the segment
+  int fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    LOGE("Unable to open state segment {}: {}", _str(name), _str(strerror(errno)));
+    return 1;
+  }
+
+  // Leave the segment alone if another process is still publishing to it
+  struct stat st;
+  if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(struct state_segment)) {
+    void* addr = mmap(NULL, sizeof(struct state_segment), PROT_READ, MAP_SHARED, fd, 0);
+    if (addr != MAP_FAILED) {
+      const struct state_segment* segment = addr;
+      int owned = state__owned_elsewhere(segment);
+      pid_t pid = segment->pid;
+      munmap(addr, sizeof(struct state_segment));
+
+      if (owned) {
+        LOGE("State segment {} is in use by process {}", _str(name), _i(pid));
+        close(fd);
+        return 1;
+      }
+    }
+  }
+
+  // Size it for our layout
+  if (ftruncate(fd, sizeof(struct state_segment)) < 0) {
+    LOGE("Unable to size state segment {}: {}", _str(name), _str(strerror(errno)));
+    close(fd);
+    shm_unlink(name);
+    return 1;
+  }
+
+  // Map it
+  void* addr = mmap(NULL, sizeof(struct state_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    LOGE("Unable to map state segment {}: {}", _str(name), _str(strerror(errno)));
+    shm_unlink(name);
+    return 1;
+  }
+
+  struct state_segment* segment = addr;
+
+  // Wipe anything a previous process left behind
+  __atomic_store_n(&segment->magic, 0, __ATOMIC_RELAXED);
+  memset(segment, 0, sizeof(struct state_segment));
+
+  // Fill in the header and publish the magic number last
+  segment->version = STATE_VERSION;
+  segment->size = sizeof(struct state_segment);
+  segment->pid = getpid();
+  __atomic_store_n(&segment->magic, STATE_MAGIC, __ATOMIC_RELEASE);
+
+  strncpy(state__name, name, sizeof state__name - 1);
+  state__segment = segment;
+
+  LOGI("Publishing robot state to shared memory {}", _str(name));
+  return 0;
+}
+
+void state_close() {
+  if (!state__segment) {
+    return;
+  }
+
+  // Tell readers we are gone
+  __atomic_store_n(&state__segment->magic, 0, __ATOMIC_RELEASE);
+
+  munmap(state__segment, sizeof(struct state_segment));
+  shm_unlink(state__name);
+  state__segment = NULL;
+}
+
+struct state_robot* state_claim(int robot_id) {
+  if (!state__segment) {
+    return NULL;
+  }
+
+  struct state_robot* slot = NULL;
+
+  pthread_mutex_lock(&state__mutex);
+
+  // Find a free slot
+  for (int i = 0; i < STATE_MAX_ROBOTS; ++i) {
+    struct state_robot* candidate = &state__segment->robots[i];
+    if (!__atomic_load_n(&candidate->in_use, __ATOMIC_RELAXED)) {
+      slot = candidate;
+      break;
+    }
+  }
+
+  if (slot) {
+    // Reset slot and then mark it in use
+    state__write_begin(&slot->monitor_seq);
+    memset(&slot->monitor, 0, sizeof slot->monitor);
+    state__write_end(&slot->monitor_seq);
+    state__write_begin(&slot->tracker_seq);
+    memset(&slot->tracker, 0, sizeof slot->tracker);
+    state__write_end(&slot->tracker_seq);
+    slot->robot_id = robot_id;
+    __atomic_store_n(&slot->in_use, 1, __ATOMIC_RELEASE);
+  } else {
+    LOGW("No room to publish state for robot {}", _i(robot_id));
+  }
+
+  pthread_mutex_unlock(&state__mutex);
+
+  return slot;
+}
+
+void state_release(struct state_robot* slot) {
+  pthread_mutex_lock(&state__mutex);
+
+  // Hide the slot from readers before anyone can reuse it
+  __atomic_store_n(&slot->in_use, 0, __ATOMIC_RELEASE);
+
+  pthread_mutex_unlock(&state__mutex);
+}
+
+struct state_monitor* state_monitor_begin(struct state_robot* slot) {
+  state__write_begin(&slot->monitor_seq);
+  return &slot->monitor;
+}
+
+void state_monitor_end(struct state_robot* slot) {
+  slot->monitor.timestamp = state__time();
+  state__write_end(&slot->monitor_seq);
+}
+
+struct state_tracker* state_tracker_begin(struct state_robot* slot) {
+  state__write_begin(&slot->tracker_seq);
+  return &slot->tracker;
+}
+
+void state_tracker_end(struct state_robot* slot) {
+  slot->tracker.timestamp = state__time();
+  state__write_end(&slot->tracker_seq);
+}
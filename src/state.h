@@ -0,0 +1,201 @@
+/*
+ * Cozmonaut
+ * Copyright 2019 The Cozmonaut Contributors
+ */
+
+#ifndef STATE_H
+#define STATE_H
+
+//
+// Shared-memory robot state
+//
+// The process publishes the latest Monitor readings and tracker results for
+// each robot into a POSIX shared-memory segment. External tools map the same
+// segment read-only (see state_reader.h) and read it without any syscalls.
+//
+// Every robot slot has two sections, one for monitor data and one for tracker
+// data, and each is guarded by its own seqlock. A seqlock is a counter that is
+// odd while its writer is mid-update. Readers copy the section out and retry if
+// the counter was odd or changed across the copy. Each section has exactly one
+// writer (the Python thread for the monitor, the detection thread for the
+// tracker), so writers never wait on anything.
+//
+// This layout is shared with programs outside this build, so it only uses
+// fixed-size plain types. Sequence counters are accessed with the compiler's
+// __atomic builtins rather than C11 _Atomic types, as the latter do not have a
+// guaranteed representation.
+//
+
+/** The segment magic number ("CZST"). */
+#define STATE_MAGIC 0x54535a43u
+
+/** The segment layout version. */
+#define STATE_VERSION 1u
+
+/** The default segment name. */
+#define STATE_DEFAULT_NAME "/cozmonaut-state"
+
+/** The maximum number of robots in the segment. */
+#define STATE_MAX_ROBOTS 16
+
+/** The maximum number of faces per robot in the segment. */
+#define STATE_MAX_FACES 24
+
+/** Published monitor readings. */
+struct state_monitor {
+  /** The time of the last update in milliseconds since the epoch. */
+  long long timestamp;
+
+  /** The battery voltage. */
+  double battery;
+
+  /** The accelerometer reading (x, y, z). */
+  double accelerometer[3];
+
+  /** The gyroscope reading (x, y, z). */
+  double gyroscope[3];
+
+  /** The wheel speeds (left, right). */
+  double wheel_speeds[2];
+};
+
+/** A published face. */
+struct state_face {
+  /** The track number, or -1 if the face is not associated with a track. */
+  int track;
+
+  /** The bounding box top-left x-coordinate. */
+  int bbox_x;
+
+  /** The bounding box top-left y-coordinate. */
+  int bbox_y;
+
+  /** The bounding box width. */
+  int bbox_w;
+
+  /** The bounding box height. */
+  int bbox_h;
+};
+
+/** Published tracker results. */
+struct state_tracker {
+  /** The time of the last update in milliseconds since the epoch. */
+  long long timestamp;
+
+  /** The number of frames the detector has processed. */
+  unsigned long long frames;
+
+  /** The detection rate in frames per second. */
+  double fps;
+
+  /** The number of faces in the last processed frame. */
+  int num_faces;
+
+  /** The faces in the last processed frame. */
+  struct state_face faces[STATE_MAX_FACES];
+};
+
+/** A robot slot in the segment. */
+struct state_robot {
+  /** Nonzero if the slot is in use. */
+  unsigned int in_use;
+
+  /** The robot ID. */
+  int robot_id;
+
+  /** The monitor section seqlock counter. */
+  unsigned int monitor_seq;
+
+  /** The monitor section. */
+  struct state_monitor monitor;
+
+  /** The tracker section seqlock counter. */
+  unsigned int tracker_seq;
+
+  /** The tracker section. */
+  struct state_tracker tracker;
+};
+
+/** The shared-memory segment. */
+struct state_segment {
+  /** The segment magic number. Written last during setup. */
+  unsigned int magic;
+
+  /** The segment layout version. */
+  unsigned int version;
+
+  /** The size of this structure. */
+  unsigned int size;
+
+  /** The ID of the publishing process. */
+  int pid;
+
+  /** The robot slots. */
+  struct state_robot robots[STATE_MAX_ROBOTS];
+};
+
+/**
+ * Create and map the state segment.
+ *
+ * A segment of the same name left behind by a process that is gone is reused
+ * and wiped. A segment still published by a live process is left alone, and
+ * this fails instead.
+ *
+ * @param name The segment name
+ * @return Zero on success, otherwise nonzero
+ */
+int state_open(const char* name);
+
+/**
+ * Unmap and remove the state segment.
+ */
+void state_close();
+
+/**
+ * Claim a robot slot in the state segment.
+ *
+ * @param robot_id The robot ID
+ * @return The slot, or NULL if the segment is not open or is full
+ */
+struct state_robot* state_claim(int robot_id);
+
+/**
+ * Release a robot slot in the state segment.
+ *
+ * Readers stop seeing the robot, and the slot may be claimed again.
+ *
+ * @param slot The robot slot
+ */
+void state_release(struct state_robot* slot);
+
+/**
+ * Begin an update to the monitor section of a robot slot.
+ *
+ * @param slot The robot slot
+ * @return The monitor section to write to
+ */
+struct state_monitor* state_monitor_begin(struct state_robot* slot);
+
+/**
+ * Finish an update to the monitor section of a robot slot.
+ *
+ * @param slot The robot slot
+ */
+void state_monitor_end(struct state_robot* slot);
+
+/**
+ * Begin an update to the tracker section of a robot slot.
+ *
+ * @param slot The robot slot
+ * @return The tracker section to write to
+ */
+struct state_tracker* state_tracker_begin(struct state_robot* slot);
+
+/**
+ * Finish an update to the tracker section of a robot slot.
+ *
+ * @param slot The robot slot
+ */
+void state_tracker_end(struct state_robot* slot);
+
+#endif // #ifndef STATE_H
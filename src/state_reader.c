@@ -0,0 +1,137 @@
+/*
+ * Cozmonaut
+ * Copyright 2019 The Cozmonaut Contributors
+ */
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "state_reader.h"
+
+/** The most times to try for a consistent copy before giving up. */
+#define STATE_READER__MAX_TRIES 1000
+
+struct state_reader {
+  /** The mapped segment. */
+  const struct state_segment* segment;
+};
+
+/**
+ * Copy a seqlock-guarded section.
+ *
+ * @param seq The sequence counter
+ * @param src The section
+ * @param dst The destination
+ * @param size The section size
+ * @return Zero on success, otherwise nonzero if no consistent copy could be had
+ */
+static int state_reader__read(const unsigned int* seq, const void* src, void* dst, size_t size) {
+  for (int tries = 0; tries < STATE_READER__MAX_TRIES; ++tries) {
+    // Come back later if a write is in progress
+    // A publisher that died mid-write leaves the counter odd for good, so don't wait on it forever
+    unsigned int before = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+    if (before & 1) {
+      sched_yield();
+      continue;
+    }
+
+    memcpy(dst, src, size);
+
+    // Retry if a write overlapped the copy
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(seq, __ATOMIC_RELAXED) == before) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/**
+ * Find the slot for a robot.
+ *
+ * @param self The state reader
+ * @param robot_id The robot ID
+ * @return The slot, or NULL if not found
+ */
+static const struct state_robot* state_reader__find(struct state_reader* self, int robot_id) {
+  for (int i = 0; i < STATE_MAX_ROBOTS; ++i) {
+    const struct state_robot* slot = &self->segment->robots[i];
+    if (__atomic_load_n(&slot->in_use, __ATOMIC_ACQUIRE) && slot->robot_id == robot_id) {
+      return slot;
+    }
+  }
+
+  return NULL;
+}
+
+struct state_reader* state_reader_open(const char* name) {
+  int fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  void* addr = mmap(NULL, sizeof(struct state_segment), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    return NULL;
+  }
+
+  const struct state_segment* segment = addr;
+
+  // Refuse segments from an incompatible build
+  if (__atomic_load_n(&segment->magic, __ATOMIC_ACQUIRE) != STATE_MAGIC || segment->version != STATE_VERSION
+    || segment->size != sizeof(struct state_segment)) {
+    munmap(addr, sizeof(struct state_segment));
+    return NULL;
+  }
+
+  struct state_reader* self = calloc(1, sizeof(struct state_reader));
+  self->segment = segment;
+  return self;
+}
+
+void state_reader_close(struct state_reader* self) {
+  munmap((void*) self->segment, sizeof(struct state_segment));
+  free(self);
+}
+
+int state_reader_live(struct state_reader* self) {
+  return __atomic_load_n(&self->segment->magic, __ATOMIC_ACQUIRE) == STATE_MAGIC;
+}
+
+int state_reader_robots(struct state_reader* self, int* robot_ids, int max) {
+  int count = 0;
+
+  for (int i = 0; i < STATE_MAX_ROBOTS && count < max; ++i) {
+    const struct state_robot* slot = &self->segment->robots[i];
+    if (__atomic_load_n(&slot->in_use, __ATOMIC_ACQUIRE)) {
+      robot_ids[count++] = slot->robot_id;
+    }
+  }
+
+  return count;
+}
+
+int state_reader_monitor(struct state_reader* self, int robot_id, struct state_monitor* monitor) {
+  const struct state_robot* slot = state_reader__find(self, robot_id);
+  if (!slot) {
+    return 1;
+  }
+
+  return state_reader__read(&slot->monitor_seq, &slot->monitor, monitor, sizeof(struct state_monitor)) ? 2 : 0;
+}
+
+int state_reader_tracker(struct state_reader* self, int robot_id, struct state_tracker* tracker) {
+  const struct state_robot* slot = state_reader__find(self, robot_id);
+  if (!slot) {
+    return 1;
+  }
+
+  return state_reader__read(&slot->tracker_seq, &slot->tracker, tracker, sizeof(struct state_tracker)) ? 2 : 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * Cozmonaut
+ * Copyright 2019 The Cozmonaut Contributors
+ */
+
+#ifndef STATE_READER_H
+#define STATE_READER_H
+
+#include "state.h"
+
+//
+// State reader library
+//
+// This is the read side of the shared-memory robot state (see state.h). It is
+// built as a small static library for external monitoring tools to link. After
+// the segment is mapped, reads are plain memory accesses with no syscalls, and
+// they never block the publishing process.
+//
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** A state reader. */
+struct state_reader;
+
+/**
+ * Map a state segment for reading.
+ *
+ * @param name The segment name (e.g. STATE_DEFAULT_NAME)
+ * @return The state reader, or NULL on failure
+ */
+struct state_reader* state_reader_open(const char* name);
+
+/**
+ * Unmap a state segment.
+ *
+ * @param self The state reader
+ */
+void state_reader_close(struct state_reader* self);
+
+/**
+ * Check whether the publisher is still attached to the segment.
+ *
+ * @param self The state reader
+ * @return Nonzero if the segment is live, otherwise zero
+ */
+int state_reader_live(struct state_reader* self);
+
+/**
+ * List the robots in the segment.
+ *
+ * @param self The state reader
+ * @param [out] robot_ids The robot IDs
+ * @param max The capacity of robot_ids
+ * @return The number of robot IDs written
+ */
+int state_reader_robots(struct state_reader* self, int* robot_ids, int max);
+
+/**
+ * Read the monitor section for a robot.
+ *
+ * @param self The state reader
+ * @param robot_id The robot ID
+ * @param [out] monitor A consistent copy of the monitor section
+ * @return Zero on success, 1 if the robot is unknown, or 2 if the section stayed mid-update (the
+ *         publisher may have died while writing it); monitor is unspecified unless this succeeds
+ */
+int state_reader_monitor(struct state_reader* self, int robot_id, struct state_monitor* monitor);
+
+/**
+ * Read the tracker section for a robot.
+ *
+ * @param self The state reader
+ * @param robot_id The robot ID
+ * @param [out] tracker A consistent copy of the tracker section
+ * @return Zero on success, 1 if the robot is unknown, or 2 if the section stayed mid-update (the
+ *         publisher may have died while writing it); tracker is unspecified unless this succeeds
+ */
+int state_reader_tracker(struct state_reader* self, int robot_id, struct state_tracker* tracker);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // #ifndef STATE_READER_H
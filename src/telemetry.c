@@ -0,0 +1,845 @@
+/*
+ * Cozmonaut
+ * Copyright 2019 The Cozmonaut Contributors
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "telemetry.h"
+
+/** The file magic number ("CZTL"). */
+#define TELEMETRY__FILE_MAGIC 0x4c545a43u
+
+/** The block magic number ("TBLK"). */
+#define TELEMETRY__BLOCK_MAGIC 0x4b4c4254u
+
+/** The file format version. */
+#define TELEMETRY__VERSION 2u
+
+/** The payload capacity of a block in bytes. */
+#define TELEMETRY__BLOCK_CAPACITY 4096
+
+/** The payload room to leave for one more sample (worst case is under 40 bytes). */
+#define TELEMETRY__BLOCK_SLACK 64
+
+/** The longest a block may stay open before it is flushed (in milliseconds). */
+#define TELEMETRY__BLOCK_MAX_AGE 60000
+
+/** The header at the start of every archive file. */
+struct telemetry__file_header {
+  /** The file magic number. */
+  uint32_t magic;
+
+  /** The file format version. */
+  uint32_t version;
+
+  /** The channel stored in the file. */
+  uint32_t channel;
+
+  /** The number of values per sample. */
+  uint32_t num_values;
+};
+
+/** The header in front of every block. */
+struct telemetry__block_header {
+  /** The block magic number. */
+  uint32_t magic;
+
+  /** The number of samples in the block. */
+  uint32_t num_samples;
+
+  /** The timestamp of the first sample (the others are coded relative to it). */
+  int64_t time_first;
+
+  /** The earliest sample timestamp. */
+  int64_t time_min;
+
+  /** The latest sample timestamp. */
+  int64_t time_max;
+
+  /** The size of the payload following this header. */
+  uint32_t payload_size;
+
+  /** Reserved. Always zero. */
+  uint32_t reserved;
+};
+
+/** A bit stream over a block payload. */
+struct telemetry__bits {
+  /** The payload data. */
+  unsigned char* data;
+
+  /** The payload size in bytes. */
+  size_t size;
+
+  /** The current byte position. */
+  size_t byte_pos;
+
+  /** The current bit position within the current byte (MSB first). */
+  int bit_pos;
+};
+
+/** The compression state of one value column. */
+struct telemetry__column {
+  /** The bits of the previous value. */
+  uint64_t value_last;
+
+  /** The leading zero count of the previous meaningful XOR window. */
+  int leading_last;
+
+  /** The trailing zero count of the previous meaningful XOR window. */
+  int trailing_last;
+};
+
+/** The state of one channel in an archive. */
+struct telemetry__series {
+  /** The archive file descriptor, or -1 if the channel is unavailable. */
+  int fd;
+
+  /** The number of values per sample. */
+  int num_values;
+
+  /** The open block payload. */
+  unsigned char payload[TELEMETRY__BLOCK_CAPACITY];
+
+  /** The payload bit stream. */
+  struct telemetry__bits bits;
+
+  /** The number of samples in the open block. */
+  uint32_t num_samples;
+
+  /** The timestamp of the first sample in the open block. */
+  int64_t time_first;
+
+  /** The timestamp of the last sample in the open block. */
+  int64_t time_last;
+
+  /** The earliest timestamp in the open block (the wall clock can go backwards). */
+  int64_t time_min;
+
+  /** The latest timestamp in the open block. */
+  int64_t time_max;
+
+  /** The last timestamp delta in the open block. */
+  int64_t delta_last;
+
+  /** The value columns. */
+  struct telemetry__column columns[TELEMETRY_MAX_VALUES];
+};
+
+struct telemetry {
+  /** The robot ID. */
+  int robot_id;
+
+  /** The per-channel series. */
+  struct telemetry__series series[telemetry_channel__count];
+};
+
+int telemetry_channel_num_values(enum telemetry_channel channel) {
+  switch (channel) {
+    case telemetry_channel_battery:
+      return 1;
+    case telemetry_channel_accelerometer:
+      return 3;
+    case telemetry_channel_gyroscope:
+      return 3;
+    case telemetry_channel_wheel_speeds:
+      return 2;
+    default:
+      return 0;
+  }
+}
+
+const char* telemetry_channel_name(enum telemetry_channel channel) {
+  switch (channel) {
+    case telemetry_channel_battery:
+      return "battery";
+    case telemetry_channel_accelerometer:
+      return "accelerometer";
+    case telemetry_channel_gyroscope:
+      return "gyroscope";
+    case telemetry_channel_wheel_speeds:
+      return "wheel_speeds";
+    default:
+      return NULL;
+  }
+}
+
+long long telemetry_time() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Write bits to a bit stream.
+ *
+ * The caller must ensure there is room. Bits are written MSB first.
+ *
+ * @param s The bit stream
+ * @param value The bits, right-aligned
+ * @param n The number of bits (up to 64)
+ */
+static void telemetry__put_bits(struct telemetry__bits* s, uint64_t value, int n) {
+  while (n > 0) {
+    // Fill as much of the current byte as we can
+    int room = 8 - s->bit_pos;
+    int take = n < room ? n : room;
+    unsigned int chunk = (unsigned int) (value >> (n - take)) & ((1u << take) - 1);
+    s->data[s->byte_pos] |= (unsigned char) (chunk << (room - take));
+
+    // Advance
+    n -= take;
+    s->bit_pos += take;
+    if (s->bit_pos == 8) {
+      s->bit_pos = 0;
+      ++s->byte_pos;
+    }
+  }
+}
+
+/**
+ * Read bits from a bit stream.
+ *
+ * @param s The bit stream
+ * @param n The number of bits (up to 64)
+ * @param [out] value The bits, right-aligned
+ * @return Zero on success, otherwise nonzero if the stream ran dry
+ */
+static int telemetry__get_bits(struct telemetry__bits* s, int n, uint64_t* value) {
+  uint64_t result = 0;
+
+  while (n > 0) {
+    if (s->byte_pos >= s->size) {
+      return 1;
+    }
+
+    // Drain as much of the current byte as we can
+    int room = 8 - s->bit_pos;
+    int take = n < room ? n : room;
+    unsigned int chunk = ((unsigned int) s->data[s->byte_pos] >> (room - take)) & ((1u << take) - 1);
+    result = (result << take) | chunk;
+
+    // Advance
+    n -= take;
+    s->bit_pos += take;
+    if (s->bit_pos == 8) {
+      s->bit_pos = 0;
+      ++s->byte_pos;
+    }
+  }
+
+  *value = result;
+  return 0;
+}
+
+/**
+ * Count leading zero bits.
+ *
+ * @param x A nonzero value
+ * @return The count
+ */
+static int telemetry__clz(uint64_t x) {
+  return __builtin_clzll(x);
+}
+
+/**
+ * Count trailing zero bits.
+ *
+ * @param x A nonzero value
+ * @return The count
+ */
+static int telemetry__ctz(uint64_t x) {
+  return __builtin_ctzll(x);
+}
+
+/**
+ * Reinterpret a double as its bits.
+ *
+ * @param x The double
+ * @return The bits
+ */
+static uint64_t telemetry__double_bits(double x) {
+  uint64_t bits;
+  memcpy(&bits, &x, sizeof bits);
+  return bits;
+}
+
+/**
+ * Reinterpret bits as a double.
+ *
+ * @param bits The bits
+ * @return The double
+ */
+static double telemetry__bits_double(uint64_t bits) {
+  double x;
+  memcpy(&x, &bits, sizeof x);
+  return x;
+}
+
+/**
+ * Encode a timestamp delta-of-delta.
+ *
+ * @param s The bit stream
+ * @param dod The delta-of-delta
+ */
+static void telemetry__put_dod(struct telemetry__bits* s, int64_t dod) {
+  if (dod == 0) {
+    telemetry__put_bits(s, 0x0, 1);
+  } else if (dod >= -63 && dod <= 64) {
+    telemetry__put_bits(s, 0x2, 2);
+    telemetry__put_bits(s, (uint64_t) (dod + 63), 7);
+  } else if (dod >= -255 && dod <= 256) {
+    telemetry__put_bits(s, 0x6, 3);
+    telemetry__put_bits(s, (uint64_t) (dod + 255), 9);
+  } else if (dod >= -2047 && dod <= 2048) {
+    telemetry__put_bits(s, 0xe, 4);
+    telemetry__put_bits(s, (uint64_t) (dod + 2047), 12);
+  } else {
+    telemetry__put_bits(s, 0xf, 4);
+    telemetry__put_bits(s, (uint64_t) dod, 64);
+  }
+}
+
+/**
+ * Decode a timestamp delta-of-delta.
+ *
+ * @param s The bit stream
+ * @param [out] dod The delta-of-delta
+ * @return Zero on success, otherwise nonzero
+ */
+static int telemetry__get_dod(struct telemetry__bits* s, int64_t* dod) {
+  // Count the prefix ones (up to four)
+  int prefix = 0;
+  uint64_t bit;
+  do {
+    if (telemetry__get_bits(s, 1, &bit)) {
+      return 1;
+    }
+    if (!bit) {
+      break;
+    }
+  } while (++prefix < 4);
+
+  uint64_t raw;
+  switch (prefix) {
+    case 0:
+      *dod = 0;
+      return 0;
+    case 1:
+      if (telemetry__get_bits(s, 7, &raw)) {
+        return 1;
+      }
+      *dod = (int64_t) raw - 63;
+      return 0;
+    case 2:
+      if (telemetry__get_bits(s, 9, &raw)) {
+        return 1;
+      }
+      *dod = (int64_t) raw - 255;
+      return 0;
+    case 3:
+      if (telemetry__get_bits(s, 12, &raw)) {
+        return 1;
+      }
+      *dod = (int64_t) raw - 2047;
+      return 0;
+    default:
+      if (telemetry__get_bits(s, 64, &raw)) {
+        return 1;
+      }
+      *dod = (int64_t) raw;
+      return 0;
+  }
+}
+
+/**
+ * Encode a value against its column.
+ *
+ * @param s The bit stream
+ * @param col The value column
+ * @param value The value bits
+ */
+static void telemetry__put_value(struct telemetry__bits* s, struct telemetry__column* col, uint64_t value) {
+  uint64_t diff = value ^ col->value_last;
+  col->value_last = value;
+
+  // Identical values cost a single bit
+  if (diff == 0) {
+    telemetry__put_bits(s, 0x0, 1);
+    return;
+  }
+
+  int leading = telemetry__clz(diff);
+  int trailing = telemetry__ctz(diff);
+
+  // The leading count must fit in five bits
+  if (leading > 31) {
+    leading = 31;
+  }
+
+  if (col->leading_last >= 0 && leading >= col->leading_last && trailing >= col->trailing_last) {
+    // The meaningful bits fit in the previous window, so reuse it
+    int len = 64 - col->leading_last - col->trailing_last;
+    telemetry__put_bits(s, 0x2, 2);
+    telemetry__put_bits(s, diff >> col->trailing_last, len);
+  } else {
+    // Open a new window
+    int len = 64 - leading - trailing;
+    telemetry__put_bits(s, 0x3, 2);
+    telemetry__put_bits(s, (uint64_t) leading, 5);
+    telemetry__put_bits(s, (uint64_t) (len - 1), 6);
+    telemetry__put_bits(s, diff >> trailing, len);
+
+    col->leading_last = leading;
+    col->trailing_last = trailing;
+  }
+}
+
+/**
+ * Decode a value against its column.
+ *
+ * @param s The bit stream
+ * @param col The value column
+ * @param [out] value The value bits
+ * @return Zero on success, otherwise nonzero
+ */
+static int telemetry__get_value(struct telemetry__bits* s, struct telemetry__column* col, uint64_t* value) {
+  uint64_t bit;
+  if (telemetry__get_bits(s, 1, &bit)) {
+    return 1;
+  }
+
+  // Identical to the previous value
+  if (!bit) {
+    *value = col->value_last;
+    return 0;
+  }
+
+  if (telemetry__get_bits(s, 1, &bit)) {
+    return 1;
+  }
+
+  // Read a new window if one follows
+  if (bit) {
+    uint64_t leading, len;
+    if (telemetry__get_bits(s, 5, &leading) || telemetry__get_bits(s, 6, &len)) {
+      return 1;
+    }
+    // The window must fit in 64 bits, or the shift below is undefined
+    int trailing = 64 - (int) leading - ((int) len + 1);
+    if (trailing < 0) {
+      return 1;
+    }
+
+    col->leading_last = (int) leading;
+    col->trailing_last = trailing;
+  } else if (col->leading_last < 0) {
+    // Corrupt stream (reused a window that was never opened)
+    return 1;
+  }
+
+  uint64_t meaningful;
+  if (telemetry__get_bits(s, 64 - col->leading_last - col->trailing_last, &meaningful)) {
+    return 1;
+  }
+
+  col->value_last ^= meaningful << col->trailing_last;
+  *value = col->value_last;
+  return 0;
+}
+
+/**
+ * Write a whole buffer set to a file descriptor.
+ *
+ * @param fd The file descriptor
+ * @param iov The buffers
+ * @param iovcnt The number of buffers
+ * @return Zero on success, otherwise nonzero
+ */
+static int telemetry__writev_all(int fd, struct iovec* iov, int iovcnt) {
+  while (iovcnt > 0) {
+    ssize_t n = writev(fd, iov, iovcnt);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return 1;
+    }
+
+    // Skip fully-written buffers and trim a partially-written one
+    while (iovcnt > 0 && (size_t) n >= iov->iov_len) {
+      n -= iov->iov_len;
+      ++iov;
+      --iovcnt;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = (char*) iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Reset a series for a fresh block.
+ *
+ * @param series The series
+ */
+static void telemetry__series_reset(struct telemetry__series* series) {
+  memset(series->payload, 0, sizeof series->payload);
+  series->bits = (struct telemetry__bits) {
+    .data = series->payload,
+    .size = sizeof series->payload,
+  };
+  series->num_samples = 0;
+  series->time_first = 0;
+  series->time_last = 0;
+  series->time_min = 0;
+  series->time_max = 0;
+  series->delta_last = 0;
+
+  for (int i = 0; i < TELEMETRY_MAX_VALUES; ++i) {
+    series->columns[i] = (struct telemetry__column) {
+      .leading_last = -1,
+    };
+  }
+}
+
+/**
+ * Append the open block of a series to its file and start a new one.
+ *
+ * @param series The series
+ */
+static void telemetry__series_flush(struct telemetry__series* series) {
+  if (series->fd < 0 || series->num_samples == 0) {
+    return;
+  }
+
+  // The payload size rounded up to a whole byte
+  size_t payload_size = series->bits.byte_pos + (series->bits.bit_pos ? 1 : 0);
+
+  struct telemetry__block_header header = {
+    .magic = TELEMETRY__BLOCK_MAGIC,
+    .num_samples = series->num_samples,
+    .time_first = series->time_first,
+    .time_min = series->time_min,
+    .time_max = series->time_max,
+    .payload_size = (uint32_t) payload_size,
+  };
+
+  struct iovec iov[2] = {
+    {.iov_base = &header, .iov_len = sizeof header},
+    {.iov_base = series->payload, .iov_len = payload_size},
+  };
+
+  // Append header and payload together
+  if (telemetry__writev_all(series->fd, iov, 2)) {
+    LOGE("Unable to append telemetry block: {}", _str(strerror(errno)));
+  }
+
+  telemetry__series_reset(series);
+}
+
+/**
+ * Validate an archive file and cut off any torn block at its end.
+ *
+ * A crash while appending can leave a partial block behind. Appending after it
+ * would make every later block unreachable, so we truncate it first.
+ *
+ * @param fd The file descriptor
+ * @param channel The expected channel
+ * @return Zero on success, otherwise nonzero
+ */
+static int telemetry__recover(int fd, enum telemetry_channel channel) {
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    return 1;
+  }
+
+  // A brand new file just needs its header
+  if (st.st_size == 0) {
+    struct telemetry__file_header header = {
+      .magic = TELEMETRY__FILE_MAGIC,
+      .version = TELEMETRY__VERSION,
+      .channel = (uint32_t) channel,
+      .num_values = (uint32_t) telemetry_channel_num_values(channel),
+    };
+    struct iovec iov = {.iov_base = &header, .iov_len = sizeof header};
+    return telemetry__writev_all(fd, &iov, 1);
+  }
+
+  // Check the existing header
+  struct telemetry__file_header header;
+  if (pread(fd, &header, sizeof header, 0) != sizeof header || header.magic != TELEMETRY__FILE_MAGIC
+    || header.version != TELEMETRY__VERSION || header.channel != (uint32_t) channel) {
+    return 1;
+  }
+
+  // Walk the block headers to find the end of the last whole block
+  off_t end = sizeof header;
+  struct telemetry__block_header block;
+  while (pread(fd, &block, sizeof block, end) == sizeof block && block.magic == TELEMETRY__BLOCK_MAGIC) {
+    off_t next = end + (off_t) sizeof block + block.payload_size;
+    if (next > st.st_size) {
+      break;
+    }
+    end = next;
+  }
+
+  if (end != st.st_size) {
+    LOGW("Truncating torn telemetry block ({} bytes)", _ll((long long) (st.st_size - end)));
+    if (ftruncate(fd, end) < 0) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+struct telemetry* telemetry_open(const char* dir, int robot_id) {
+  // Allocate instance memory
+  struct telemetry* self = calloc(1, sizeof(struct telemetry));
+  self->robot_id = robot_id;
+
+  int opened = 0;
+
+  for (int i = 0; i < telemetry_channel__count; ++i) {
+    struct telemetry__series* series = &self->series[i];
+    series->num_values = telemetry_channel_num_values((enum telemetry_channel) i);
+    telemetry__series_reset(series);
+
+    // Build the file path
+    char path[4096];
+    snprintf(path, sizeof path, "%s/robot-%d-%s.tlm", dir, robot_id, telemetry_channel_name((enum telemetry_channel) i));
+
+    // Open the file for appending
+    series->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (series->fd < 0) {
+      LOGE("Unable to open telemetry archive {}: {}", _str(path), _str(strerror(errno)));
+      continue;
+    }
+
+    // Make sure we can append to it
+    if (telemetry__recover(series->fd, (enum telemetry_channel) i)) {
+      LOGE("Telemetry archive {} is unusable", _str(path));
+      close(series->fd);
+      series->fd = -1;
+      continue;
+    }
+
+    ++opened;
+  }
+
+  // Give up if no channel is usable
+  if (!opened) {
+    free(self);
+    return NULL;
+  }
+
+  LOGD("Telemetry archive for robot {} is open in {}", _i(robot_id), _str(dir));
+  return self;
+}
+
+void telemetry_close(struct telemetry* self) {
+  // Flush whatever is still buffered
+  telemetry_flush(self);
+
+  for (int i = 0; i < telemetry_channel__count; ++i) {
+    if (self->series[i].fd >= 0) {
+      close(self->series[i].fd);
+    }
+  }
+
+  // Free instance memory
+  free(self);
+}
+
+void telemetry_record(struct telemetry* self, enum telemetry_channel channel, long long timestamp,
+  const double* values) {
+  struct telemetry__series* series = &self->series[channel];
+
+  // Drop samples for unavailable channels
+  if (series->fd < 0) {
+    return;
+  }
+
+  // Close the open block if it is full or has been open too long
+  if (series->num_samples > 0 && (series->bits.byte_pos + TELEMETRY__BLOCK_SLACK > series->bits.size
+    || timestamp - series->time_first > TELEMETRY__BLOCK_MAX_AGE)) {
+    telemetry__series_flush(series);
+  }
+
+  if (series->num_samples == 0) {
+    // The first timestamp goes in the block header
+    series->time_first = timestamp;
+    series->time_min = timestamp;
+    series->time_max = timestamp;
+  } else {
+    // Later timestamps are stored as a delta-of-delta
+    int64_t delta = timestamp - series->time_last;
+    telemetry__put_dod(&series->bits, delta - series->delta_last);
+    series->delta_last = delta;
+
+    if (timestamp < series->time_min) {
+      series->time_min = timestamp;
+    }
+    if (timestamp > series->time_max) {
+      series->time_max = timestamp;
+    }
+  }
+  series->time_last = timestamp;
+
+  // Values are XOR'd against their predecessors (the first against zero)
+  for (int i = 0; i < series->num_values; ++i) {
+    telemetry__put_value(&series->bits, &series->columns[i], telemetry__double_bits(values[i]));
+  }
+
+  ++series->num_samples;
+}
+
+void telemetry_flush(struct telemetry* self) {
+  for (int i = 0; i < telemetry_channel__count; ++i) {
+    telemetry__series_flush(&self->series[i]);
+  }
+}
+
+/**
+ * Decode a block and report samples in a time window.
+ *
+ * @param header The block header
+ * @param payload The block payload
+ * @param num_values The number of values per sample
+ * @param time_begin The window start timestamp
+ * @param time_end The window end timestamp
+ * @param cb The callback
+ * @param user The user pointer
+ * @param [out] stop Set nonzero if the callback asked to stop
+ * @return Zero on success, otherwise nonzero
+ */
+static int telemetry__scan_block(const struct telemetry__block_header* header, unsigned char* payload,
+  int num_values, long long time_begin, long long time_end, telemetry_scan_cb cb, void* user, int* stop) {
+  struct telemetry__bits bits = {
+    .data = payload,
+    .size = header->payload_size,
+  };
+
+  struct telemetry__column columns[TELEMETRY_MAX_VALUES];
+  for (int i = 0; i < TELEMETRY_MAX_VALUES; ++i) {
+    columns[i] = (struct telemetry__column) {
+      .leading_last = -1,
+    };
+  }
+
+  int64_t time = header->time_first;
+  int64_t delta = 0;
+
+  for (uint32_t n = 0; n < header->num_samples; ++n) {
+    // Decode timestamp
+    if (n > 0) {
+      int64_t dod;
+      if (telemetry__get_dod(&bits, &dod)) {
+        return 1;
+      }
+      delta += dod;
+      time += delta;
+    }
+
+    // Decode values
+    struct telemetry_sample sample = {
+      .timestamp = time,
+    };
+    for (int i = 0; i < num_values; ++i) {
+      uint64_t value;
+      if (telemetry__get_value(&bits, &columns[i], &value)) {
+        return 1;
+      }
+      sample.values[i] = telemetry__bits_double(value);
+    }
+
+    // Report the sample if it is in the window
+    if (time >= time_begin && time <= time_end) {
+      if (cb(&sample, num_values, user)) {
+        *stop = 1;
+        return 0;
+      }
+    }
+  }
+
+  return 0;
+}
+
+int telemetry_scan(const char* path, long long time_begin, long long time_end, telemetry_scan_cb cb, void* user) {
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    LOGE("Unable to open telemetry archive {}: {}", _str(path), _str(strerror(errno)));
+    return 1;
+  }
+
+  // Check the file header
+  struct telemetry__file_header header;
+  if (fread(&header, sizeof header, 1, file) != 1 || header.magic != TELEMETRY__FILE_MAGIC
+    || header.version != TELEMETRY__VERSION || header.num_values > TELEMETRY_MAX_VALUES) {
+    LOGE("Not a telemetry archive: {}", _str(path));
+    fclose(file);
+    return 1;
+  }
+
+  unsigned char* payload = NULL;
+  size_t payload_cap = 0;
+
+  int result = 0;
+  int stop = 0;
+
+  struct telemetry__block_header block;
+  while (!stop && fread(&block, sizeof block, 1, file) == 1) {
+    if (block.magic != TELEMETRY__BLOCK_MAGIC) {
+      LOGE("Corrupt telemetry block in {}", _str(path));
+      result = 1;
+      break;
+    }
+
+    // Skip blocks outside the window without reading their payloads
+    // Blocks are usually in time order, but wall clock adjustments can break that, so keep going
+    if (block.time_max < time_begin || block.time_min > time_end) {
+      if (fseeko(file, block.payload_size, SEEK_CUR) < 0) {
+        result = 1;
+        break;
+      }
+      continue;
+    }
+
+    // Grow the payload buffer as needed
+    if (block.payload_size > payload_cap) {
+      payload_cap = block.payload_size;
+      payload = realloc(payload, payload_cap);
+    }
+
+    // A short read here means the writer was cut off mid-block
+    if (fread(payload, 1, block.payload_size, file) != block.payload_size) {
+      break;
+    }
+
+    if (telemetry__scan_block(&block, payload, (int) header.num_values, time_begin, time_end, cb, user, &stop)) {
+      LOGE("Corrupt telemetry block in {}", _str(path));
+      result = 1;
+      break;
+    }
+  }
+
+  free(payload);
+  fclose(file);
+  return result;
+}
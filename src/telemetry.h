@@ -0,0 +1,139 @@
+/*
+ * Cozmonaut
+ * Copyright 2019 The Cozmonaut Contributors
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+/** The maximum number of values in one telemetry sample. */
+#define TELEMETRY_MAX_VALUES 3
+
+/** A telemetry channel. */
+enum telemetry_channel {
+  /** Battery voltage (one value). */
+  telemetry_channel_battery,
+
+  /** Accelerometer reading (three values: x, y, and z). */
+  telemetry_channel_accelerometer,
+
+  /** Gyroscope reading (three values: x, y, and z). */
+  telemetry_channel_gyroscope,
+
+  /** Wheel speeds (two values: left and right). */
+  telemetry_channel_wheel_speeds,
+
+  /** @private */
+  telemetry_channel__count,
+};
+
+/** A decoded telemetry sample. */
+struct telemetry_sample {
+  /** The sample timestamp in milliseconds since the epoch. */
+  long long timestamp;
+
+  /** The sample values. Only the first few are used, per the channel. */
+  double values[TELEMETRY_MAX_VALUES];
+};
+
+/**
+ * A telemetry archive for one robot.
+ *
+ * Each channel is stored in its own append-only file. Samples are encoded in
+ * the style of Facebook's Gorilla: timestamps are stored as delta-of-deltas,
+ * and values are stored XOR'd against their predecessors. Samples accumulate
+ * in memory until a block fills up, and then the whole block is appended to
+ * the file behind a small header that records its time span. This lets a
+ * reader skip over blocks outside of a time window without decoding them.
+ */
+struct telemetry;
+
+/**
+ * A telemetry scan callback.
+ *
+ * @param sample The sample
+ * @param num_values The number of values in the sample
+ * @param user The user pointer
+ * @return Zero to continue scanning, otherwise nonzero to stop
+ */
+typedef int (* telemetry_scan_cb)(const struct telemetry_sample* sample, int num_values, void* user);
+
+/**
+ * Get the number of values in samples on a channel.
+ *
+ * @param channel The channel
+ * @return The number of values
+ */
+int telemetry_channel_num_values(enum telemetry_channel channel);
+
+/**
+ * Get the name of a channel.
+ *
+ * @param channel The channel
+ * @return The channel name
+ */
+const char* telemetry_channel_name(enum telemetry_channel channel);
+
+/**
+ * Get the current time as a telemetry timestamp.
+ *
+ * @return Milliseconds since the epoch
+ */
+long long telemetry_time();
+
+/**
+ * Open the telemetry archive for a robot.
+ *
+ * The archive files are created in the given directory if they do not exist
+ * yet. Otherwise, new samples are appended to the existing files.
+ *
+ * @param dir The archive directory
+ * @param robot_id The robot ID
+ * @return The telemetry archive, or NULL on failure
+ */
+struct telemetry* telemetry_open(const char* dir, int robot_id);
+
+/**
+ * Close a telemetry archive.
+ *
+ * Any buffered samples are flushed to disk first.
+ *
+ * @param self The telemetry archive
+ */
+void telemetry_close(struct telemetry* self);
+
+/**
+ * Record a telemetry sample.
+ *
+ * This is not thread-safe. Each archive should only be fed from one thread.
+ *
+ * @param self The telemetry archive
+ * @param channel The channel
+ * @param timestamp The sample timestamp (see telemetry_time)
+ * @param values The sample values
+ */
+void telemetry_record(struct telemetry* self, enum telemetry_channel channel, long long timestamp,
+  const double* values);
+
+/**
+ * Flush buffered samples to disk.
+ *
+ * @param self The telemetry archive
+ */
+void telemetry_flush(struct telemetry* self);
+
+/**
+ * Scan an archive file for samples in a time window.
+ *
+ * Blocks lying entirely outside the window are skipped without decoding.
+ *
+ * @param path The archive file path
+ * @param time_begin The window start timestamp (inclusive)
+ * @param time_end The window end timestamp (inclusive)
+ * @param cb The callback to invoke for each sample in the window
+ * @param user The user pointer for the callback
+ * @return Zero on success, otherwise nonzero
+ */
+int telemetry_scan(const char* path, long long time_begin, long long time_end, telemetry_scan_cb cb, void* user);
+
+#endif // #ifndef TELEMETRY_H
@@ -0,0 +1,434 @@
+/*
+ * Cozmonaut
+ * Copyright 2019 The Cozmonaut Contributors
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "affinity.h"
+#include "log.h"
+#include "trace.h"
+
+/** The number of events kept per thread. */
+#define TRACE__RING_EVENTS 8192
+
+/** The number of buckets in the name table. */
+#define TRACE__NAME_BUCKETS 256
+
+/** A trace event. */
+struct trace__event {
+  /** The time in nanoseconds on the monotonic clock. */
+  long long ts;
+
+  /** The span name. */
+  const char* name;
+
+  /** The event phase ('B' or 'E'). */
+  char phase;
+};
+
+/** A per-thread event ring. */
+struct trace__ring {
+  /** The next ring in the global list. */
+  struct trace__ring* next;
+
+  /** The owning thread ID. */
+  int tid;
+
+  /** Nonzero while a thread owns this ring. */
+  int owned;
+
+  /** The number of events written. Only the owning thread writes this. */
+  unsigned long long head;
+
+  /** The events. */
+  struct trace__event events[TRACE__RING_EVENTS];
+};
+
+/** An interned name. */
+struct trace__name {
+  /** The next name in the bucket. */
+  struct trace__name* next;
+
+  /** The name. */
+  char str[];
+};
+
+int trace__enabled;
+
+/** The trace file path. */
+static const char* trace__path;
+
+/** The ring list mutex. Only taken when a thread traces for the first time and while a dump copies a ring. */
+static pthread_mutex_t trace__rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** All rings ever made. Rings are recycled, never freed, so a dump can show threads that have exited. */
+static struct trace__ring* trace__rings;
+
+/** The ring of the current thread. */
+static __thread struct trace__ring* trace__ring_self;
+
+/** The key whose destructor gives back a thread's ring. */
+static pthread_key_t trace__ring_key;
+
+/** The name table mutex. */
+static pthread_mutex_t trace__names_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** The name table. */
+static struct trace__name* trace__names[TRACE__NAME_BUCKETS];
+
+/** The semaphore the signal handler posts to ask for a dump. */
+static sem_t trace__dump_sem;
+
+/** The dumper thread. */
+static pthread_t trace__dump_thread;
+
+/** The dump mutex. Keeps concurrent dumps from clobbering the same file. */
+static pthread_mutex_t trace__dump_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Give back a thread's ring when the thread exits.
+ *
+ * @param arg The ring
+ */
+static void trace__ring_release(void* arg) {
+  struct trace__ring* ring = arg;
+  __atomic_store_n(&ring->owned, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Get the ring of the current thread, setting one up if needed.
+ *
+ * @return The ring
+ */
+static struct trace__ring* trace__ring_get() {
+  struct trace__ring* ring = trace__ring_self;
+  if (ring) {
+    return ring;
+  }
+
+  pthread_mutex_lock(&trace__rings_mutex);
+
+  // Recycle the ring of a thread that has exited (its events stay in dumps until then)
+  for (ring = trace__rings; ring; ring = ring->next) {
+    if (!__atomic_load_n(&ring->owned, __ATOMIC_ACQUIRE)) {
+      break;
+    }
+  }
+
+  // Otherwise, make a new one
+  if (!ring) {
+    ring = calloc(1, sizeof(struct trace__ring));
+    if (!ring) {
+      pthread_mutex_unlock(&trace__rings_mutex);
+      return NULL;
+    }
+
+    ring->next = trace__rings;
+    trace__rings = ring;
+  }
+
+  // Start a recycled ring empty, so the last owner's events are not put down to this thread
+  __atomic_store_n(&ring->tid, (int) syscall(SYS_gettid), __ATOMIC_RELAXED);
+  __atomic_store_n(&ring->head, 0, __ATOMIC_RELAXED);
+  ring->owned = 1;
+
+  pthread_mutex_unlock(&trace__rings_mutex);
+
+  trace__ring_self = ring;
+  pthread_setspecific(trace__ring_key, ring);
+  return ring;
+}
+
+/**
+ * Record an event on the current thread.
+ *
+ * @param name The span name
+ * @param phase The event phase
+ */
+static void trace__record(const char* name, char phase) {
+  struct trace__ring* ring = trace__ring_get();
+  if (!ring) {
+    return;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  unsigned long long head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+
+  // Dumpers may read the slot while we overwrite it, so it is written with relaxed atomics
+  struct trace__event* event = &ring->events[head % TRACE__RING_EVENTS];
+  __atomic_store_n(&event->ts, (long long) now.tv_sec * 1000000000LL + now.tv_nsec, __ATOMIC_RELAXED);
+  __atomic_store_n(&event->name, name, __ATOMIC_RELAXED);
+  __atomic_store_n(&event->phase, phase, __ATOMIC_RELAXED);
+
+  // Publish the event to dumpers
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void trace__begin(const char* name) {
+  trace__record(name, 'B');
+}
+
+void trace__end() {
+  trace__record(NULL, 'E');
+}
+
+const char* trace_intern(const char* name) {
+  // Hash the name (FNV-1a)
+  unsigned int hash = 2166136261u;
+  for (const char* c = name; *c; ++c) {
+    hash = (hash ^ (unsigned char) *c) * 16777619u;
+  }
+
+  struct trace__name** bucket = &trace__names[hash % TRACE__NAME_BUCKETS];
+
+  pthread_mutex_lock(&trace__names_mutex);
+
+  struct trace__name* entry;
+  for (entry = *bucket; entry; entry = entry->next) {
+    if (strcmp(entry->str, name) == 0) {
+      break;
+    }
+  }
+
+  if (!entry) {
+    size_t len = strlen(name);
+
+    entry = malloc(sizeof(struct trace__name) + len + 1);
+    if (entry) {
+      memcpy(entry->str, name, len + 1);
+      entry->next = *bucket;
+      *bucket = entry;
+    }
+  }
+
+  pthread_mutex_unlock(&trace__names_mutex);
+
+  return entry ? entry->str : "?";
+}
+
+/**
+ * Write a JSON string.
+ *
+ * @param file The file
+ * @param str The string
+ */
+static void trace__write_string(FILE* file, const char* str) {
+  fputc('"', file);
+
+  for (const char* c = str; *c; ++c) {
+    if (*c == '"' || *c == '\\') {
+      fputc('\\', file);
+      fputc(*c, file);
+    } else if ((unsigned char) *c < 0x20) {
+      fprintf(file, "\\u%04x", (unsigned char) *c);
+    } else {
+      fputc(*c, file);
+    }
+  }
+
+  fputc('"', file);
+}
+
+/**
+ * Write the events of one ring.
+ *
+ * @param file The file
+ * @param ring The ring
+ * @param pid The process ID
+ * @param copy Scratch space for TRACE__RING_EVENTS events
+ * @param first Nonzero if nothing has been written yet (updated)
+ */
+static void trace__write_ring(FILE* file, struct trace__ring* ring, int pid, struct trace__event* copy, int* first) {
+  // Keep the ring from being recycled (and its head reset) while we copy it
+  pthread_mutex_lock(&trace__rings_mutex);
+
+  int tid = __atomic_load_n(&ring->tid, __ATOMIC_RELAXED);
+
+  // Copy out the newest events while the owning thread carries on
+  unsigned long long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  unsigned long long begin = head > TRACE__RING_EVENTS ? head - TRACE__RING_EVENTS : 0;
+
+  for (unsigned long long i = begin; i < head; ++i) {
+    struct trace__event* event = &ring->events[i % TRACE__RING_EVENTS];
+    copy[i - begin].ts = __atomic_load_n(&event->ts, __ATOMIC_RELAXED);
+    copy[i - begin].name = __atomic_load_n(&event->name, __ATOMIC_RELAXED);
+    copy[i - begin].phase = __atomic_load_n(&event->phase, __ATOMIC_RELAXED);
+  }
+
+  // Throw away any the owning thread may have overwritten in the meantime
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  unsigned long long head_after = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+  unsigned long long valid = head_after >= TRACE__RING_EVENTS ? head_after - TRACE__RING_EVENTS + 1 : 0;
+
+  pthread_mutex_unlock(&trace__rings_mutex);
+
+  // Name the thread after its current name, if it is still around
+  char path[64];
+  snprintf(path, sizeof path, "/proc/self/task/%d/comm", tid);
+
+  char name[32] = "";
+  FILE* comm = fopen(path, "r");
+  if (comm) {
+    if (fgets(name, sizeof name, comm)) {
+      name[strcspn(name, "\n")] = '\0';
+    }
+    fclose(comm);
+  }
+
+  if (name[0]) {
+    fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":", *first ? "" : ",",
+      pid, tid);
+    trace__write_string(file, name);
+    fputs("}}", file);
+    *first = 0;
+  }
+
+  for (unsigned long long i = begin < valid ? valid : begin; i < head; ++i) {
+    struct trace__event* event = &copy[i - begin];
+
+    fprintf(file, "%s\n{\"ph\":\"%c\",\"ts\":%lld.%03lld,\"pid\":%d,\"tid\":%d", *first ? "" : ",", event->phase,
+      event->ts / 1000, event->ts % 1000, pid, tid);
+    if (event->name) {
+      fputs(",\"name\":", file);
+      trace__write_string(file, event->name);
+    }
+    fputc('}', file);
+    *first = 0;
+  }
+}
+
+int trace_dump(const char* path) {
+  if (!path) {
+    path = trace__path;
+  }
+
+  if (!path) {
+    LOGE("No trace file to dump to (set COZMONAUT_TRACE)");
+    return 1;
+  }
+
+  struct trace__event* copy = malloc(TRACE__RING_EVENTS * sizeof(struct trace__event));
+  if (!copy) {
+    return 1;
+  }
+
+  pthread_mutex_lock(&trace__dump_mutex);
+
+  FILE* file = fopen(path, "w");
+  if (!file) {
+    LOGE("Unable to open trace file {}: {}", _str(path), _str(strerror(errno)));
+    pthread_mutex_unlock(&trace__dump_mutex);
+    free(copy);
+    return 1;
+  }
+
+  // Take a snapshot of the ring list (rings are never freed, so they stay valid after we let go)
+  pthread_mutex_lock(&trace__rings_mutex);
+  struct trace__ring* rings = trace__rings;
+  pthread_mutex_unlock(&trace__rings_mutex);
+
+  int pid = (int) getpid();
+  int first = 1;
+
+  fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", file);
+
+  for (struct trace__ring* ring = rings; ring; ring = ring->next) {
+    trace__write_ring(file, ring, pid, copy, &first);
+  }
+
+  fputs("\n]}\n", file);
+
+  int err = ferror(file);
+  if (fclose(file) != 0) {
+    err = 1;
+  }
+
+  pthread_mutex_unlock(&trace__dump_mutex);
+  free(copy);
+
+  if (err) {
+    LOGE("Unable to write trace file {}", _str(path));
+    return 1;
+  }
+
+  LOGI("Dumped trace to {}", _str(path));
+  return 0;
+}
+
+/**
+ * Ask for a dump from a signal handler.
+ *
+ * @param signum Unused
+ */
+static void trace__on_signal(int signum) {
+  // This is all that is safe to do here
+  sem_post(&trace__dump_sem);
+}
+
+/**
+ * The dumper thread.
+ *
+ * @param arg Unused
+ * @return Unused
+ */
+static void* trace__dump_main(void* arg) {
+  affinity_apply(affinity_role_io, "cz-trace");
+
+  while (1) {
+    if (sem_wait(&trace__dump_sem) < 0) {
+      continue;
+    }
+
+    trace_dump(NULL);
+  }
+
+  return NULL;
+}
+
+/**
+ * Dump at exit.
+ */
+static void trace__on_exit() {
+  trace_dump(NULL);
+}
+
+void trace_init() {
+  const char* path = getenv("COZMONAUT_TRACE");
+  if (!path || !*path) {
+    return;
+  }
+
+  trace__path = path;
+  pthread_key_create(&trace__ring_key, &trace__ring_release);
+
+  // Spawn dumper thread
+  sem_init(&trace__dump_sem, 0, 0);
+  pthread_create(&trace__dump_thread, NULL, &trace__dump_main, NULL);
+  pthread_detach(trace__dump_thread);
+
+  // Dump on SIGUSR2
+  struct sigaction action = {0};
+  action.sa_handler = &trace__on_signal;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  sigaction(SIGUSR2, &action, NULL);
+
+  atexit(&trace__on_exit);
+
+  __atomic_store_n(&trace__enabled, 1, __ATOMIC_RELEASE);
+
+  LOGI("Tracing to {} (send SIGUSR2 to dump)", _str(path));
+}
@@ -0,0 +1,87 @@
+/*
+ * Cozmonaut
+ * Copyright 2019 The Cozmonaut Contributors
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+//
+// Timeline tracing
+//
+// With the COZMONAUT_TRACE environment variable set to a file path, threads
+// record the begin and end of named spans into their own ring buffers. The
+// rings are dumped to that path as a Chrome trace-event JSON file (viewable in
+// chrome://tracing or Perfetto) on SIGUSR2, on request, or at exit. Each ring
+// keeps the most recent spans, so a dump shows the last few seconds leading up
+// to it. When tracing is off, a span costs one predictable branch.
+//
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Nonzero while tracing is on. @private */
+extern int trace__enabled;
+
+/**
+ * Turn tracing on if COZMONAUT_TRACE is set.
+ *
+ * This also installs the SIGUSR2 handler. Call this once, early on.
+ */
+void trace_init();
+
+/**
+ * Record the begin of a span on this thread.
+ *
+ * @param name The span name (must outlive the trace, so use a string literal
+ *   or trace_intern())
+ */
+void trace__begin(const char* name);
+
+/**
+ * Record the end of the innermost span on this thread.
+ */
+void trace__end();
+
+/**
+ * Begin a span on this thread.
+ *
+ * @param name The span name (a string literal or interned string)
+ */
+static inline void trace_begin(const char* name) {
+  if (trace__enabled) {
+    trace__begin(name);
+  }
+}
+
+/**
+ * End the innermost span on this thread.
+ */
+static inline void trace_end() {
+  if (trace__enabled) {
+    trace__end();
+  }
+}
+
+/**
+ * Intern a span name.
+ *
+ * @param name The span name
+ * @return A copy of the name that lives as long as the process
+ */
+const char* trace_intern(const char* name);
+
+/**
+ * Dump all rings to a Chrome trace file.
+ *
+ * @param path The file path, or NULL for the COZMONAUT_TRACE path
+ * @return Zero on success, otherwise nonzero
+ */
+int trace_dump(const char* path);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // #ifndef TRACE_H
@@ -3,23 +3,101 @@
  * Copyright 2019 The Cozmonaut Contributors
  */
 
+#include <errno.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <pthread.h>
 
 #include <spdyface.h>
-#include <spdyface/dlib_ffd_detector.h>
 
+#include "affinity.h"
 #include "cozmo_image.h"
+#include "framepool.h"
+#include "framering.h"
+#include "lockprof.h"
 #include "log.h"
+#include "models.h"
+#include "service.h"
+#include "slab.h"
+#include "state.h"
+#include "trace.h"
 #include "tracker.h"
 
+/** The number of frames a track may go unmatched before it is lost. */
+#define TRACKER__GRACE_FRAMES 5
+
+/** The minimum overlap (intersection over union) for a face to continue a track. */
+#define TRACKER__MATCH_IOU 0.3
+
+/** The frame sizes to warm up for if COZMONAUT_WARMUP_SIZES is not set (Cozmo's camera). */
+#define TRACKER__WARMUP_SIZES "320x240"
+
+/** The number of synthetic frames to run at each warm-up size. */
+#define TRACKER__WARMUP_PASSES 2
+
+/** The largest frame width or height taken from a frame ring. */
+#define TRACKER__RING_MAX_DIM 8192
+
+/** The most acquire, lose and identity events kept pending. */
+#define TRACKER__EVENT_CAPACITY 1024
+
+/** The type of a queue slot whose event was taken out of order. */
+#define TRACKER__EVENT_TAKEN (-1)
+
+/** The number of event objects carved at once for each event type. */
+#define TRACKER__EVENT_SLAB_CHUNK 64
+
 static void* tracker__thd_detection_main(void* arg);
 
 static void* tracker__thd_recognition_main(void* arg);
 
+static void tracker__push_event(struct tracker* self, struct tracker_event_record rec);
+
+/**
+ * A processed frame, as handed from detection to recognition.
+ *
+ * The frame data is immutable while the handle holds its reference, so
+ * recognition can crop faces out of it at its own pace while detection moves
+ * on to the next frame.
+ */
+struct tracker__frame {
+  /** The frame buffer. The handle owns a reference to it. */
+  struct framepool_buffer* buf;
+
+  /** The frame width. */
+  int width;
+
+  /** The frame height. */
+  int height;
+
+  /** The capture time of the frame. */
+  long long timestamp;
+
+  /** The number of faces found in the frame. */
+  int face_count;
+
+  /** The face bounding boxes. */
+  struct tracker_bbox face_bboxes[24];
+
+  /** The track numbers of the faces (-1 for none). */
+  int face_tracks[24];
+};
+
+/** The newest face crop of a track. */
+struct tracker__face {
+  /** The track number (zero for none). */
+  int track;
+
+  /** The capture time of the frame the crop came from. */
+  long long timestamp;
+
+  /** The crop (interleaved RGB8). */
+  unsigned char pixels[3 * TRACKER_FACE_SIZE * TRACKER_FACE_SIZE];
+};
+
 struct tracker {
   /** The detection thread. */
   pthread_t thd_detection;
@@ -33,6 +111,21 @@ struct tracker {
   /** The recognition loop kill switch. */
   volatile int recognition_kill;
 
+  /** The recognition mutex. */
+  pthread_mutex_t recognition_mutex;
+
+  /** The newest frame waiting for recognition. Guarded by the recognition mutex. */
+  struct tracker__frame recognition_frame;
+
+  /** Nonzero while a frame waits for recognition. Guarded by the recognition mutex. */
+  int recognition_pending;
+
+  /** The face crop mutex. */
+  pthread_mutex_t face_mutex;
+
+  /** The newest face crops, one per recently seen track. Guarded by the face crop mutex. */
+  struct tracker__face faces[TRACKER_MAX_TRACKS];
+
   /** The frame mutex. */
   pthread_mutex_t frame_mutex;
 
@@ -42,23 +135,58 @@ struct tracker {
   /** The frame height. */
   int frame_height;
 
-  /** The frame data. */
-  char* frame_data;
+  /** The frame data (nullable). */
+  struct framepool_buffer* frame_data;
+
+  /**
+   * The frame fill mutex.
+   *
+   * A producer holds this from tracker_lock_frame() to tracker_unlock_frame()
+   * while it fills in the spare frame data. Detection never takes it.
+   */
+  pthread_mutex_t fill_mutex;
 
-  /** The secondary frame data. */
-  char* frame_data_secondary;
+  /** The spare frame data being filled in (nullable). Guarded by the fill mutex. */
+  struct framepool_buffer* frame_spare;
+
+  /** The width of the frame being filled in. Guarded by the fill mutex. */
+  int fill_width;
+
+  /** The height of the frame being filled in. Guarded by the fill mutex. */
+  int fill_height;
+
+  /** The capture time of the frame being filled in. Guarded by the fill mutex. */
+  long long fill_timestamp;
+
+  /** The secondary frame data (nullable). Only touched on the detection thread, but may be shared with recognition. */
+  struct framepool_buffer* frame_data_secondary;
+
+  /** The capture time of the frame. Guarded by the frame mutex. */
+  long long frame_timestamp;
 
   /** The frame flag. */
   volatile int frame_flag;
 
+  /** Nonzero while the detection thread works on a frame. Set under the frame mutex. */
+  int frame_busy;
+
+  /** The shared-memory frame ring (nullable). Set once under the frame mutex. */
+  struct framering* ring;
+
+  /** The spdyface images over the ring slots (nullable). Only touched on the detection thread. */
+  SFCozmoImage ring_images[FRAMERING_MAX_SLOTS];
+
+  /** The frame sizes of the ring slot images. */
+  int ring_image_sizes[FRAMERING_MAX_SLOTS][2];
+
   /** The spdyface context. */
   SFContext sf_context;
 
-  /** The spdyface detector. */
+  /** The spdyface detector (see models.h). */
   SFDetector sf_detector;
 
-  /** The spdyface frame image. */
-  SFCozmoImage sf_image;
+  /** Nonzero once the detector is warmed up. */
+  int ready;
 
   /** The number of faces detected in the last frame. */
   int last_frame_face_count;
@@ -66,39 +194,320 @@ struct tracker {
   /** The face bounding boxes of the last frame. */
   struct tracker_bbox last_frame_face_bboxes[24];
 
+  /** The capture time of the current frame. */
+  long long this_frame_timestamp;
+
   /** The number of faces detected in the current frame. */
   int this_frame_face_count;
 
   /** The face bounding boxes of the current frame. */
   struct tracker_bbox this_frame_face_bboxes[24];
+
+  /** The track numbers of the faces in the current frame (-1 for none). */
+  int this_frame_face_tracks[24];
+
+  /** The track table mutex. */
+  pthread_mutex_t track_mutex;
+
+  /** The track table. */
+  struct tracker_track tracks[TRACKER_MAX_TRACKS];
+
+  /** The number of consecutive frames each track has gone unmatched. */
+  int track_misses[TRACKER_MAX_TRACKS];
+
+  /** The last track number handed out. */
+  int track_last;
+
+  /** The event queue mutex. */
+  pthread_mutex_t event_mutex;
+
+  /** The pending acquire, lose and identity events (a ring buffer in sequence order, with holes where events were taken). */
+  struct tracker_event_record events[TRACKER__EVENT_CAPACITY];
+
+  /** The index of the oldest pending event. This is never a hole. */
+  size_t event_head;
+
+  /** The number of ring slots in use from the head on, holes included. */
+  size_t event_span;
+
+  /** The number of pending events in the ring. */
+  size_t event_count;
+
+  /** The pending move event of each track slot (zero sequence number for none). */
+  struct tracker_event_record event_moves[TRACKER_MAX_TRACKS];
+
+  /** The number of pending move events. */
+  size_t event_move_count;
+
+  /** The last event sequence number handed out. */
+  unsigned long long event_seq;
+
+  /** Nonzero once the tracker is stopped. Guarded by the frame mutex. */
+  int stopped;
+
+  /** The shared-memory state slot (nullable). Guarded by the frame mutex. */
+  struct state_robot* state;
+
+  /** The counters (see tracker_get_stats). Only written on the detection thread, except where noted. */
+  struct tracker_stats stats;
+
+  /** The number of frames the frame ring has dropped or skipped, as of the last ring frame. */
+  unsigned long long ring_dropped;
+
+  /** The time the last detection finished. */
+  struct timespec last_detect_time;
+
+  /** The frame latency deadline in nanoseconds (zero for none). Accessed atomically. */
+  long long deadline_ns;
 };
 
+/**
+ * The hidden header in front of every event object.
+ *
+ * This is padded to 16 bytes so the event after it keeps the slab alignment.
+ */
+struct tracker__event_header {
+  /** The slab the object came from. */
+  struct slab* slab;
+
+  /** The number of references. */
+  int refs;
+};
+
+/** The size of the hidden event header. */
+#define TRACKER__EVENT_HEADER_SIZE ((sizeof(struct tracker__event_header) + 15) / 16 * 16)
+
+/** The event object slabs, one per event type. Shared by all trackers. */
+static struct slab* tracker__event_slabs[4];
+
+/** The event object slab initializer. */
+static pthread_once_t tracker__event_slabs_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Create the event object slabs.
+ */
+static void tracker__init_event_slabs() {
+  tracker__event_slabs[tracker_event_type_acquire] =
+    slab_new(TRACKER__EVENT_HEADER_SIZE + sizeof(struct tracker_event_acquire), TRACKER__EVENT_SLAB_CHUNK);
+  tracker__event_slabs[tracker_event_type_lose] =
+    slab_new(TRACKER__EVENT_HEADER_SIZE + sizeof(struct tracker_event_lose), TRACKER__EVENT_SLAB_CHUNK);
+  tracker__event_slabs[tracker_event_type_move] =
+    slab_new(TRACKER__EVENT_HEADER_SIZE + sizeof(struct tracker_event_move), TRACKER__EVENT_SLAB_CHUNK);
+  tracker__event_slabs[tracker_event_type_identity] =
+    slab_new(TRACKER__EVENT_HEADER_SIZE + sizeof(struct tracker_event_identity), TRACKER__EVENT_SLAB_CHUNK);
+
+  for (size_t type = 0; type < sizeof tracker__event_slabs / sizeof tracker__event_slabs[0]; ++type) {
+    if (!tracker__event_slabs[type]) {
+      LOGF("Unable to create the event object slabs");
+      abort();
+    }
+  }
+}
+
+/**
+ * Get the hidden header of an event object.
+ *
+ * @param evt The event
+ * @return The header
+ */
+static struct tracker__event_header* tracker__event_header(const void* evt) {
+  return (struct tracker__event_header*) ((char*) evt - TRACKER__EVENT_HEADER_SIZE);
+}
+
+/**
+ * Allocate an event object.
+ *
+ * The object comes from the slab for its type with one reference. This
+ * aborts if the slab cannot grow, like running out of frame memory does.
+ *
+ * @param type The event type
+ * @return The event
+ */
+static void* tracker__event_new(int type) {
+  struct tracker__event_header* header = slab_alloc(tracker__event_slabs[type]);
+  if (!header) {
+    LOGF("Unable to allocate an event object");
+    abort();
+  }
+
+  header->slab = tracker__event_slabs[type];
+  header->refs = 1;
+  return (char*) header + TRACKER__EVENT_HEADER_SIZE;
+}
+
+/**
+ * Release what a tracker holds once its threads are gone.
+ *
+ * @param self The face tracker
+ */
+static void tracker__release(struct tracker* self) {
+  // Lock the frame mutex
+  LOCKPROF_MUTEX_LOCK(&self->frame_mutex, "frame_mutex");
+
+  // Refuse further frames
+  self->stopped = 1;
+  self->state = NULL;
+  __atomic_store_n(&self->ready, 0, __ATOMIC_RELEASE);
+
+  // Return frame data to the pool for other trackers
+  framepool_release(self->frame_data);
+  framepool_release(self->frame_data_secondary);
+  self->frame_data = NULL;
+  self->frame_data_secondary = NULL;
+  self->frame_width = 0;
+  self->frame_height = 0;
+
+  // Unlock the frame mutex
+  LOCKPROF_MUTEX_UNLOCK(&self->frame_mutex);
+
+  // Return the spare frame data, once any producer filling it in is done
+  LOCKPROF_MUTEX_LOCK(&self->fill_mutex, "fill_mutex");
+  framepool_release(self->frame_spare);
+  self->frame_spare = NULL;
+  LOCKPROF_MUTEX_UNLOCK(&self->fill_mutex);
+
+  // Drop the frame recognition never got to
+  if (self->recognition_pending) {
+    framepool_release(self->recognition_frame.buf);
+    self->recognition_frame.buf = NULL;
+    self->recognition_pending = 0;
+  }
+
+  // Close the frame ring
+  // Nobody reads it anymore, and the capture side sees the segment go away
+  if (self->ring) {
+    for (int i = 0; i < FRAMERING_MAX_SLOTS; ++i) {
+      sfCozmoImageDestroy(self->ring_images[i]);
+      self->ring_images[i] = NULL;
+    }
+
+    framering_close(self->ring);
+    self->ring = NULL;
+  }
+
+  // Destroy spdyface context
+  sfDestroy(self->sf_context);
+
+  // Hand the spdyface detector back for the next tracker
+  models_release_detector(self->sf_detector);
+
+  // Lock the track mutex
+  LOCKPROF_MUTEX_LOCK(&self->track_mutex, "track_mutex");
+
+  // Lose all active tracks
+  for (int t = 0; t < TRACKER_MAX_TRACKS; ++t) {
+    if (self->tracks[t].active) {
+      self->tracks[t].active = 0;
+      tracker__push_event(self, (struct tracker_event_record) {
+        .type = tracker_event_type_lose,
+        .track = self->tracks[t].number,
+        .bbox = {
+          .timestamp = self->tracks[t].bbox.timestamp,
+        },
+      });
+    }
+  }
+
+  // Unlock the track mutex
+  LOCKPROF_MUTEX_UNLOCK(&self->track_mutex);
+}
+
+/**
+ * Free a tracker once it is released.
+ *
+ * @param self The face tracker
+ */
+static void tracker__free(struct tracker* self) {
+  // Destroy mutexes
+  pthread_mutex_destroy(&self->face_mutex);
+  pthread_mutex_destroy(&self->recognition_mutex);
+  pthread_mutex_destroy(&self->event_mutex);
+  pthread_mutex_destroy(&self->track_mutex);
+  pthread_mutex_destroy(&self->fill_mutex);
+  pthread_mutex_destroy(&self->frame_mutex);
+
+  // Free instance memory
+  free(self);
+}
+
 struct tracker* tracker_new() {
   // Allocate instance memory
   struct tracker* self = calloc(1, sizeof(struct tracker));
 
   // Initialize frame mutex
-  pthread_mutex_init(&self->frame_mutex, NULL);
+  affinity_mutex_init(&self->frame_mutex);
+
+  // Initialize fill mutex
+  pthread_mutex_init(&self->fill_mutex, NULL);
+
+  // Initialize track mutex
+  affinity_mutex_init(&self->track_mutex);
+
+  // Initialize event mutex
+  affinity_mutex_init(&self->event_mutex);
+
+  // Initialize recognition mutex
+  affinity_mutex_init(&self->recognition_mutex);
+
+  // Initialize face crop mutex
+  affinity_mutex_init(&self->face_mutex);
+
+  // Make sure the event object slabs are there
+  pthread_once(&tracker__event_slabs_once, &tracker__init_event_slabs);
 
   // Create spdyface context
   sfCreate(&self->sf_context);
 
-  // Create spdyface detector
-  sfDlibFFDDetectorCreate((SFDlibFFDDetector*) &self->sf_detector);
-
-  // Use spdyface detector
+  // Use a spdyface detector of our own
+  // This reuses an idle one when there is one (see models.h)
+  self->sf_detector = models_acquire_detector();
   sfUseDetector(self->sf_context, self->sf_detector);
 
+  // Hold frames to the default deadline, if there is one
+  const char* deadline_ms = getenv("COZMONAUT_FRAME_DEADLINE_MS");
+  if (deadline_ms) {
+    self->deadline_ns = (long long) (atof(deadline_ms) * 1e6);
+  }
+
   // Spawn detection thread
-  pthread_create(&self->thd_detection, NULL, &tracker__thd_detection_main, self);
+  int err = pthread_create(&self->thd_detection, NULL, &tracker__thd_detection_main, self);
+  if (err) {
+    LOGE("Unable to spawn tracker detection thread: {}", _str(strerror(err)));
+
+    tracker__release(self);
+    tracker__free(self);
+    return NULL;
+  }
 
   // Spawn recognition thread
-  pthread_create(&self->thd_recognition, NULL, &tracker__thd_recognition_main, self);
+  err = pthread_create(&self->thd_recognition, NULL, &tracker__thd_recognition_main, self);
+  if (err) {
+    LOGE("Unable to spawn tracker recognition thread: {}", _str(strerror(err)));
+
+    // Take the detection thread back down
+    self->detection_kill = 1;
+    pthread_join(self->thd_detection, NULL);
+
+    tracker__release(self);
+    tracker__free(self);
+    return NULL;
+  }
 
   return self;
 }
 
 void tracker_delete(struct tracker* self) {
+  // Make sure the threads are gone
+  tracker_stop(self);
+
+  tracker__free(self);
+}
+
+void tracker_stop(struct tracker* self) {
+  if (self->stopped) {
+    return;
+  }
+
   // Set kill switches
   self->detection_kill = 1;
   self->recognition_kill = 1;
@@ -109,18 +518,338 @@ void tracker_delete(struct tracker* self) {
   // Wait for recognition thread to die
   pthread_join(self->thd_recognition, NULL);
 
-  // Destroy spdyface context
-  sfDestroy(self->sf_context);
+  tracker__release(self);
+
+  LOGI("Tracker {} is stopped", _ul((size_t) self));
+}
+
+/**
+ * Update the frame counter and detection rate.
+ *
+ * @param self The face tracker
+ */
+static void tracker__update_rate(struct tracker* self) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  // Smooth the instantaneous rate over roughly the last ten frames
+  // Counters are stored atomically, as the metrics thread reads them without locking
+  if (self->stats.frames > 0) {
+    double dt = (double) (now.tv_sec - self->last_detect_time.tv_sec)
+      + (double) (now.tv_nsec - self->last_detect_time.tv_nsec) / 1e9;
+    if (dt > 0) {
+      double fps = self->stats.fps ? 0.9 * self->stats.fps + 0.1 / dt : 1 / dt;
+      __atomic_store(&self->stats.fps, &fps, __ATOMIC_RELAXED);
+    }
+  }
 
-  // Destroy spdyface detector
-  sfDlibFFDDetectorDestroy((SFDlibFFDDetector) &self->sf_detector);
+  __atomic_store_n(&self->stats.frames, self->stats.frames + 1, __ATOMIC_RELAXED);
+  self->last_detect_time = now;
+}
 
-  // Free frame data
-  free(self->frame_data);
-  free(self->frame_data_secondary);
+/**
+ * Get the monotonic time in nanoseconds.
+ *
+ * @return The time
+ */
+static unsigned long long tracker__now_ns() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (unsigned long long) now.tv_sec * 1000000000ull + (unsigned long long) now.tv_nsec;
+}
 
-  // Free instance memory
-  free(self);
+/**
+ * Add to a stage time counter.
+ *
+ * @param counter The counter
+ * @param since When the stage started (from tracker__now_ns)
+ * @return The current time, to start the next stage with
+ */
+static unsigned long long tracker__add_stage_time(unsigned long long* counter, unsigned long long since) {
+  unsigned long long now = tracker__now_ns();
+  __atomic_store_n(counter, *counter + (now - since), __ATOMIC_RELAXED);
+  return now;
+}
+
+/**
+ * Publish the current frame results to the shared-memory state slot.
+ *
+ * @param self The face tracker
+ * @param slot The state slot
+ */
+static void tracker__publish_state(struct tracker* self, struct state_robot* slot) {
+  struct state_tracker* state = state_tracker_begin(slot);
+
+  state->frames = self->stats.frames;
+  state->fps = self->stats.fps;
+  state->num_faces = self->this_frame_face_count;
+
+  for (int i = 0; i < self->this_frame_face_count; ++i) {
+    const struct tracker_bbox* bbox = &self->this_frame_face_bboxes[i];
+    state->faces[i] = (struct state_face) {
+      .track = self->this_frame_face_tracks[i],
+      .bbox_x = bbox->bbox_x,
+      .bbox_y = bbox->bbox_y,
+      .bbox_w = bbox->bbox_w,
+      .bbox_h = bbox->bbox_h,
+    };
+  }
+
+  state_tracker_end(slot);
+}
+
+/**
+ * Compute the overlap of two bounding boxes.
+ *
+ * @param a A bounding box
+ * @param b A bounding box
+ * @return The intersection over union
+ */
+static double tracker__iou(const struct tracker_bbox* a, const struct tracker_bbox* b) {
+  int x0 = a->bbox_x > b->bbox_x ? a->bbox_x : b->bbox_x;
+  int y0 = a->bbox_y > b->bbox_y ? a->bbox_y : b->bbox_y;
+  int x1 = a->bbox_x + a->bbox_w < b->bbox_x + b->bbox_w ? a->bbox_x + a->bbox_w : b->bbox_x + b->bbox_w;
+  int y1 = a->bbox_y + a->bbox_h < b->bbox_y + b->bbox_h ? a->bbox_y + a->bbox_h : b->bbox_y + b->bbox_h;
+
+  if (x1 <= x0 || y1 <= y0) {
+    return 0;
+  }
+
+  double intersection = (double) (x1 - x0) * (y1 - y0);
+  double area_a = (double) a->bbox_w * a->bbox_h;
+  double area_b = (double) b->bbox_w * b->bbox_h;
+  return intersection / (area_a + area_b - intersection);
+}
+
+/**
+ * Remove the oldest event from the ring, along with any holes behind it.
+ *
+ * The event mutex must be held, and the ring must not be empty.
+ *
+ * @param self The face tracker
+ */
+static void tracker__pop_event(struct tracker* self) {
+  do {
+    self->event_head = (self->event_head + 1) % TRACKER__EVENT_CAPACITY;
+    --self->event_span;
+  } while (self->event_span && self->events[self->event_head].type == TRACKER__EVENT_TAKEN);
+}
+
+/**
+ * Queue an acquire, lose or identity event.
+ *
+ * If the queue is full, the oldest pending event is dropped to make room.
+ *
+ * @param self The face tracker
+ * @param rec The event (the sequence number is filled in)
+ */
+static void tracker__push_event(struct tracker* self, struct tracker_event_record rec) {
+  // Lock the event mutex
+  LOCKPROF_MUTEX_LOCK(&self->event_mutex, "event_mutex");
+
+  // Drop the oldest event if nobody is keeping up
+  if (self->event_span == TRACKER__EVENT_CAPACITY) {
+    tracker__pop_event(self);
+    --self->event_count;
+  }
+
+  size_t slot = (self->event_head + self->event_span) % TRACKER__EVENT_CAPACITY;
+  rec.seq = ++self->event_seq;
+  self->events[slot] = rec;
+  ++self->event_span;
+  ++self->event_count;
+
+  // Unlock the event mutex
+  LOCKPROF_MUTEX_UNLOCK(&self->event_mutex);
+}
+
+/**
+ * Queue a move event.
+ *
+ * Moves are kept apart from the ring, one per track slot, so a burst of them
+ * can never push out acquire or lose events. While a track's move is pending,
+ * later moves are folded into it: it takes the newest box but keeps its old
+ * box and sequence number. A move still pending when its slot goes to another
+ * track is dropped.
+ *
+ * @param self The face tracker
+ * @param t The track slot
+ * @param rec The event (the sequence number is filled in)
+ */
+static void tracker__push_move(struct tracker* self, int t, struct tracker_event_record rec) {
+  // Lock the event mutex
+  LOCKPROF_MUTEX_LOCK(&self->event_mutex, "event_mutex");
+
+  struct tracker_event_record* pending = &self->event_moves[t];
+  if (pending->seq && pending->track == rec.track) {
+    pending->bbox = rec.bbox;
+  } else {
+    if (!pending->seq) {
+      ++self->event_move_count;
+    }
+
+    rec.seq = ++self->event_seq;
+    *pending = rec;
+  }
+
+  // Unlock the event mutex
+  LOCKPROF_MUTEX_UNLOCK(&self->event_mutex);
+}
+
+/**
+ * Take the oldest pending event of a type.
+ *
+ * Events taken from the middle of the ring leave a hole, which goes away once
+ * the events before it do, so this is constant time when the oldest event is
+ * the one wanted.
+ *
+ * @param self The face tracker
+ * @param type The event type
+ * @param track The track number, or zero for any track
+ * @param [out] rec The event
+ * @return Nonzero if an event was taken, otherwise zero
+ */
+static int tracker__take_event(struct tracker* self, int type, int track, struct tracker_event_record* rec) {
+  int found = 0;
+
+  // Lock the event mutex
+  LOCKPROF_MUTEX_LOCK(&self->event_mutex, "event_mutex");
+
+  if (type == tracker_event_type_move) {
+    // Look through the track slots for the oldest matching move
+    struct tracker_event_record* oldest = NULL;
+    for (int t = 0; t < TRACKER_MAX_TRACKS; ++t) {
+      struct tracker_event_record* pending = &self->event_moves[t];
+      if (pending->seq && (!track || pending->track == track) && (!oldest || pending->seq < oldest->seq)) {
+        oldest = pending;
+      }
+    }
+
+    if (oldest) {
+      *rec = *oldest;
+      oldest->seq = 0;
+      --self->event_move_count;
+      found = 1;
+    }
+  } else {
+    for (size_t i = 0; i < self->event_span; ++i) {
+      struct tracker_event_record* candidate = &self->events[(self->event_head + i) % TRACKER__EVENT_CAPACITY];
+      if (candidate->type != type || (track && candidate->track != track)) {
+        continue;
+      }
+
+      *rec = *candidate;
+      found = 1;
+      --self->event_count;
+
+      // Leave a hole, unless this was the oldest event
+      if (i == 0) {
+        tracker__pop_event(self);
+      } else {
+        candidate->type = TRACKER__EVENT_TAKEN;
+      }
+      break;
+    }
+  }
+
+  // Unlock the event mutex
+  LOCKPROF_MUTEX_UNLOCK(&self->event_mutex);
+
+  return found;
+}
+
+/**
+ * Match the faces in the current frame to tracks.
+ *
+ * Each face continues the unmatched track it overlaps the most, or else starts
+ * a new track. Tracks that go unmatched for too long are lost.
+ *
+ * @param self The face tracker
+ */
+static void tracker__update_tracks(struct tracker* self) {
+  int matched[TRACKER_MAX_TRACKS] = {0};
+
+  // Lock the track mutex
+  LOCKPROF_MUTEX_LOCK(&self->track_mutex, "track_mutex");
+
+  for (int i = 0; i < self->this_frame_face_count; ++i) {
+    const struct tracker_bbox* bbox = &self->this_frame_face_bboxes[i];
+
+    // Find the best-overlapping unmatched track
+    int best = -1;
+    double best_iou = TRACKER__MATCH_IOU;
+    for (int t = 0; t < TRACKER_MAX_TRACKS; ++t) {
+      if (self->tracks[t].active && !matched[t]) {
+        double iou = tracker__iou(bbox, &self->tracks[t].bbox);
+        if (iou >= best_iou) {
+          best = t;
+          best_iou = iou;
+        }
+      }
+    }
+
+    // Otherwise, start a new track in a free slot
+    if (best < 0) {
+      for (int t = 0; t < TRACKER_MAX_TRACKS; ++t) {
+        if (!self->tracks[t].active) {
+          best = t;
+          self->tracks[t] = (struct tracker_track) {
+            .number = ++self->track_last,
+            .active = 1,
+            .bbox = *bbox,
+          };
+          LOGD("Track {} acquired", _i(self->tracks[t].number));
+          tracker__push_event(self, (struct tracker_event_record) {
+            .type = tracker_event_type_acquire,
+            .track = self->tracks[t].number,
+            .bbox = *bbox,
+          });
+          break;
+        }
+      }
+    }
+
+    if (best < 0) {
+      // No room for another track
+      self->this_frame_face_tracks[i] = -1;
+      continue;
+    }
+
+    // Continue the track with this face
+    // The box is restamped every frame, so only a change in place or size counts as a move
+    const struct tracker_bbox* old = &self->tracks[best].bbox;
+    if (old->bbox_x != bbox->bbox_x || old->bbox_y != bbox->bbox_y || old->bbox_w != bbox->bbox_w
+      || old->bbox_h != bbox->bbox_h) {
+      tracker__push_move(self, best, (struct tracker_event_record) {
+        .type = tracker_event_type_move,
+        .track = self->tracks[best].number,
+        .bbox = *bbox,
+        .bbox_old = self->tracks[best].bbox,
+      });
+    }
+    matched[best] = 1;
+    self->tracks[best].bbox = *bbox;
+    self->track_misses[best] = 0;
+    self->this_frame_face_tracks[i] = self->tracks[best].number;
+  }
+
+  // Lose tracks that have gone unmatched for too long
+  for (int t = 0; t < TRACKER_MAX_TRACKS; ++t) {
+    if (self->tracks[t].active && !matched[t] && ++self->track_misses[t] > TRACKER__GRACE_FRAMES) {
+      self->tracks[t].active = 0;
+      LOGD("Track {} lost", _i(self->tracks[t].number));
+      tracker__push_event(self, (struct tracker_event_record) {
+        .type = tracker_event_type_lose,
+        .track = self->tracks[t].number,
+        .bbox = {
+          .timestamp = self->this_frame_timestamp,
+        },
+      });
+    }
+  }
+
+  // Unlock the track mutex
+  LOCKPROF_MUTEX_UNLOCK(&self->track_mutex);
 }
 
 /**
@@ -153,6 +882,7 @@ static int tracker__detect_cb(SFContext ctx, SFImage image, SFRectangle* face, v
     .bbox_y = face->top,
     .bbox_w = face->right - face->left,
     .bbox_h = face->bottom - face->top,
+    .timestamp = self->this_frame_timestamp,
   };
 
   // Copy out repacked bounding box
@@ -169,31 +899,369 @@ static int tracker__detect_cb(SFContext ctx, SFImage image, SFRectangle* face, v
   return 0;
 }
 
+/**
+ * Make sure a frame buffer can hold a frame.
+ *
+ * A buffer that is too small is traded in at the pool for a bigger one. A
+ * buffer that is big enough is kept, so switching back and forth between
+ * resolutions settles on one buffer. A buffer that recognition still holds on
+ * to is left to it, and a fresh one taken in its place.
+ *
+ * @param buf The buffer (nullable)
+ * @param size The frame size
+ */
+static void tracker__reserve(struct framepool_buffer** buf, size_t size) {
+  if (*buf && (*buf)->capacity >= size && !framepool_shared(*buf)) {
+    return;
+  }
+
+  framepool_release(*buf);
+  *buf = framepool_acquire(size);
+}
+
+/** The spdyface face detection callback for warm-up frames. */
+static int tracker__warm_up_cb(SFContext ctx, SFImage image, SFRectangle* face, void* user) {
+  return 0;
+}
+
+/**
+ * Warm up the detector.
+ *
+ * This sizes the frame buffers for the biggest expected frame size and runs
+ * the detector over synthetic frames of each expected size, so the first real
+ * frames do not pay for cold buffers, pyramids, and caches. The detection
+ * buffer keeps a spdyface image for each size (up to FRAMEPOOL_MAX_IMAGES).
+ * The expected sizes come from the COZMONAUT_WARMUP_SIZES environment
+ * variable (e.g. "320x240,640x480").
+ *
+ * @param self The face tracker
+ */
+static void tracker__warm_up(struct tracker* self) {
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  const char* sizes = getenv("COZMONAUT_WARMUP_SIZES");
+  if (!sizes) {
+    sizes = TRACKER__WARMUP_SIZES;
+  }
+
+  // Parse the sizes
+  int widths[FRAMEPOOL_MAX_IMAGES];
+  int heights[FRAMEPOOL_MAX_IMAGES];
+  int num_sizes = 0;
+  size_t max_size = 0;
+  while (*sizes && num_sizes < FRAMEPOOL_MAX_IMAGES) {
+    char* end;
+    int width = (int) strtol(sizes, &end, 10);
+    int height = *end == 'x' ? (int) strtol(end + 1, &end, 10) : 0;
+    sizes = *end == ',' ? end + 1 : end;
+
+    if (width <= 0 || height <= 0) {
+      LOGW("Bad warm-up size list in COZMONAUT_WARMUP_SIZES");
+      break;
+    }
+
+    widths[num_sizes] = width;
+    heights[num_sizes] = height;
+    ++num_sizes;
+
+    if ((size_t) 3 * width * height > max_size) {
+      max_size = (size_t) 3 * width * height;
+    }
+  }
+
+  if (*sizes && num_sizes == FRAMEPOOL_MAX_IMAGES) {
+    LOGW("Only warming up for the first {} sizes in COZMONAUT_WARMUP_SIZES", _i(FRAMEPOOL_MAX_IMAGES));
+  }
+
+  // Size both frame buffers for the biggest frame, so every warmed-up size fits the same buffers
+  // A buffer that is big enough is kept (see tracker__reserve), so real frames land in these too
+  if (num_sizes > 0) {
+    LOCKPROF_MUTEX_LOCK(&self->fill_mutex, "fill_mutex");
+    LOCKPROF_MUTEX_LOCK(&self->frame_mutex, "frame_mutex");
+    if (!self->stopped) {
+      tracker__reserve(&self->frame_data, max_size);
+      tracker__reserve(&self->frame_spare, max_size);
+    }
+    LOCKPROF_MUTEX_UNLOCK(&self->frame_mutex);
+    LOCKPROF_MUTEX_UNLOCK(&self->fill_mutex);
+
+    tracker__reserve(&self->frame_data_secondary, max_size);
+  }
+
+  for (int s = 0; s < num_sizes && !self->detection_kill; ++s) {
+    int width = widths[s];
+    int height = heights[s];
+    size_t size = (size_t) 3 * width * height;
+
+    // Fill in a frame of gradients and noise, so the detector has something to chew on
+    char* data = self->frame_data_secondary->data;
+    unsigned int seed = 1;
+    for (size_t i = 0; i < size; ++i) {
+      seed = seed * 1103515245 + 12345;
+      data[i] = (char) ((i / 3 % (size_t) width) + (seed >> 24));
+    }
+
+    // The buffer keeps this image, so the first real frame of this size finds it ready
+    SFCozmoImage image = framepool_image(self->frame_data_secondary, width, height);
+
+    for (int pass = 0; pass < TRACKER__WARMUP_PASSES; ++pass) {
+      sfDetect(self->sf_context, (SFImage) image, &tracker__warm_up_cb, self);
+    }
+
+    LOGD("Tracker {} warmed up for {} by {}", _ul((size_t) self), _i(width), _i(height));
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  LOGI("Tracker {} is ready after {} ms of warm-up", _ul((size_t) self),
+    _d((double) (now.tv_sec - start.tv_sec) * 1e3 + (double) (now.tv_nsec - start.tv_nsec) / 1e6));
+
+  __atomic_store_n(&self->ready, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Check a frame against the deadline.
+ *
+ * Stale frames are counted as such.
+ *
+ * @param self The face tracker
+ * @param timestamp The capture time of the frame
+ * @return Nonzero if the frame is too old to bother with, otherwise zero
+ */
+static int tracker__stale(struct tracker* self, long long timestamp) {
+  long long deadline = __atomic_load_n(&self->deadline_ns, __ATOMIC_RELAXED);
+  if (!deadline || !timestamp || (long long) tracker__now_ns() - timestamp <= deadline) {
+    return 0;
+  }
+
+  __atomic_add_fetch(&self->stats.frames_stale, 1, __ATOMIC_RELAXED);
+  return 1;
+}
+
+/**
+ * Run detection on a frame and update the tracks.
+ *
+ * @param self The face tracker
+ * @param image The frame image
+ * @param state The shared-memory state slot (nullable)
+ * @param timestamp The capture time of the frame
+ */
+static void tracker__detect(struct tracker* self, SFCozmoImage image, struct state_robot* state, long long timestamp) {
+  unsigned long long start = tracker__now_ns();
+
+  // Everything found in this frame is stamped with its capture time
+  self->this_frame_timestamp = timestamp;
+
+  // Detect all faces in image
+  self->this_frame_face_count = 0;
+  trace_begin("sfDetect");
+  sfDetect(self->sf_context, (SFImage) image, &tracker__detect_cb, self);
+  trace_end();
+  start = tracker__add_stage_time(&self->stats.detect_ns, start);
+
+  trace_begin("tracker__update_tracks");
+  tracker__update_rate(self);
+  tracker__update_tracks(self);
+
+  // Publish results before they are rolled over into last frame state
+  if (state) {
+    tracker__publish_state(self, state);
+  }
+
+  __atomic_store_n(&self->stats.faces, self->this_frame_face_count, __ATOMIC_RELAXED);
+  __atomic_store_n(&self->stats.faces_total, self->stats.faces_total + (unsigned long long) self->this_frame_face_count,
+    __ATOMIC_RELAXED);
+
+  tracker__on_faces_detect(self);
+  trace_end();
+  tracker__add_stage_time(&self->stats.track_ns, start);
+}
+
+/**
+ * Hand the frame detection just processed over to recognition.
+ *
+ * Frames without faces are not handed over. A pooled frame is shared by
+ * reference; a frame that lives elsewhere (in the frame ring) is copied into
+ * the pool first, since its slot goes back to the capture side. Recognition
+ * only cares about the newest frame, so one it has not got to yet is dropped.
+ *
+ * @param self The face tracker
+ * @param buf The pooled frame buffer (nullable)
+ * @param data The frame data if it is not pooled
+ * @param width The frame width
+ * @param height The frame height
+ */
+static void tracker__hand_off(struct tracker* self, struct framepool_buffer* buf, const char* data, int width,
+  int height) {
+  if (self->this_frame_face_count == 0) {
+    return;
+  }
+
+  // Take a reference to the frame, copying it into the pool if need be
+  if (buf) {
+    framepool_retain(buf);
+  } else {
+    size_t size = (size_t) 3 * width * height;
+    buf = framepool_acquire(size);
+    memcpy(buf->data, data, size);
+  }
+
+  struct tracker__frame frame = {
+    .buf = buf,
+    .width = width,
+    .height = height,
+    .timestamp = self->this_frame_timestamp,
+    .face_count = self->this_frame_face_count,
+  };
+  memcpy(frame.face_bboxes, self->this_frame_face_bboxes, (size_t) frame.face_count * sizeof(struct tracker_bbox));
+  memcpy(frame.face_tracks, self->this_frame_face_tracks, (size_t) frame.face_count * sizeof(int));
+
+  // Lock the recognition mutex
+  LOCKPROF_MUTEX_LOCK(&self->recognition_mutex, "recognition_mutex");
+
+  struct framepool_buffer* stale = self->recognition_pending ? self->recognition_frame.buf : NULL;
+  self->recognition_frame = frame;
+  self->recognition_pending = 1;
+
+  // Unlock the recognition mutex
+  LOCKPROF_MUTEX_UNLOCK(&self->recognition_mutex);
+
+  framepool_release(stale);
+}
+
+/**
+ * Run detection on the newest frame in the frame ring, in place.
+ *
+ * @param self The face tracker
+ * @param ring The frame ring
+ * @return Nonzero if there was a frame, otherwise zero
+ */
+static int tracker__detect_ring(struct tracker* self, struct framering* ring) {
+  // Wait a bit for the capture side to publish something
+  const struct framering_slot* slot = framering_read_begin(ring, 1);
+  if (!slot) {
+    return 0;
+  }
+
+  __atomic_store_n(&self->ring_dropped, framering_dropped(ring), __ATOMIC_RELAXED);
+
+  trace_begin("tracker__do_detect");
+
+  int width = slot->width;
+  int height = slot->height;
+
+  // Skip frames that claim to be bigger than their slot
+  // The capture process writes the size, so it is bounded before anything is multiplied out
+  if (width <= 0 || height <= 0 || width > TRACKER__RING_MAX_DIM || height > TRACKER__RING_MAX_DIM
+    || (size_t) 3 * width * height > framering_slot_size(ring)) {
+    LOGW("Tracker {} skipped a bad ring frame", _ul((size_t) self));
+    framering_read_end(ring);
+    trace_end();
+    return 1;
+  }
+
+  // Capture processes that cannot tell the capture time leave it to us
+  long long timestamp = slot->timestamp ? slot->timestamp : (long long) tracker__now_ns();
+
+  // Skip frames that sat in the ring past the deadline
+  if (tracker__stale(self, timestamp)) {
+    framering_read_end(ring);
+    trace_end();
+    return 1;
+  }
+
+  // Get the spdyface image over the slot
+  // Each slot keeps its own, so this only allocates if the frame size changed
+  unsigned int index = framering_slot_index(ring, slot);
+  if (!self->ring_images[index] || self->ring_image_sizes[index][0] != width
+    || self->ring_image_sizes[index][1] != height) {
+    sfCozmoImageDestroy(self->ring_images[index]);
+    sfCozmoImageCreate(&self->ring_images[index], width, height, framering_slot_data(ring, slot));
+    self->ring_image_sizes[index][0] = width;
+    self->ring_image_sizes[index][1] = height;
+  }
+  SFCozmoImage image = self->ring_images[index];
+
+  // Grab the state slot
+  LOCKPROF_MUTEX_LOCK(&self->frame_mutex, "frame_mutex");
+  struct state_robot* state = self->state;
+  LOCKPROF_MUTEX_UNLOCK(&self->frame_mutex);
+
+  tracker__detect(self, image, state, timestamp);
+  tracker__hand_off(self, NULL, framering_slot_data(ring, slot), width, height);
+
+  // Hand the slot back to the capture side
+  framering_read_end(ring);
+  trace_end();
+  return 1;
+}
+
 /**
  * Carry out a detection iteration.
  *
  * @param self The face tracker
  */
 static void tracker__do_detect(struct tracker* self) {
+  struct framering* ring = __atomic_load_n(&self->ring, __ATOMIC_ACQUIRE);
+
   // If frame flag is set
   if (self->frame_flag) {
+    trace_begin("tracker__do_detect");
+
     // Lock the frame mutex
-    pthread_mutex_lock(&self->frame_mutex);
+    LOCKPROF_MUTEX_LOCK(&self->frame_mutex, "frame_mutex");
+
+    long long timestamp = self->frame_timestamp;
+
+    // Drop the frame without copying it if it has waited past the deadline
+    if (tracker__stale(self, timestamp)) {
+      self->frame_flag = 0;
+
+      // Unlock the frame mutex
+      LOCKPROF_MUTEX_UNLOCK(&self->frame_mutex);
+
+      trace_end();
+      return;
+    }
+
+    unsigned long long start = tracker__now_ns();
 
     // Copy the frame to safe storage
     // TODO: Fashion a double buffer to avoid a copy (everything can be better with just a little more time, ya know?)
-    memcpy(self->frame_data_secondary, self->frame_data, (size_t) (3 * self->frame_width * self->frame_height));
+    int width = self->frame_width;
+    int height = self->frame_height;
+    size_t size = (size_t) 3 * width * height;
+    tracker__reserve(&self->frame_data_secondary, size);
+    memcpy(self->frame_data_secondary->data, self->frame_data->data, size);
 
     // Clear the frame flag
+    // The frame stays pending until its results are in
     self->frame_flag = 0;
+    __atomic_store_n(&self->frame_busy, 1, __ATOMIC_RELAXED);
+
+    // Grab the state slot while we hold the lock
+    struct state_robot* state = self->state;
 
     // Unlock the frame mutex
-    pthread_mutex_unlock(&self->frame_mutex);
+    LOCKPROF_MUTEX_UNLOCK(&self->frame_mutex);
+
+    tracker__add_stage_time(&self->stats.copy_ns, start);
+
+    // Get the spdyface image for the secondary frame data
+    // The buffer keeps it around, so this only allocates if the frame size changed
+    SFCozmoImage image = framepool_image(self->frame_data_secondary, width, height);
 
-    // Detect all faces in image
-    self->this_frame_face_count = 0;
-    sfDetect(self->sf_context, (SFImage) self->sf_image, &tracker__detect_cb, self);
-    tracker__on_faces_detect(self);
+    tracker__detect(self, image, state, timestamp);
+    tracker__hand_off(self, self->frame_data_secondary, NULL, width, height);
+
+    __atomic_store_n(&self->frame_busy, 0, __ATOMIC_RELEASE);
+
+    trace_end();
+  } else if (ring) {
+    // Frames from the ring are worked on where they are
+    // Waiting on the ring takes the place of the sleep below
+    tracker__detect_ring(self, ring);
   } else {
     // Nothing to do right now, so sleep for a bit
     // There's a good chance the next few iterations will be useless, too
@@ -201,21 +1269,128 @@ static void tracker__do_detect(struct tracker* self) {
   }
 }
 
+/**
+ * Crop a face out of a frame.
+ *
+ * The box is scaled to TRACKER_FACE_SIZE pixels square by sampling the middle
+ * of each crop pixel. Parts of the box outside the frame repeat its edge.
+ *
+ * @param frame The frame
+ * @param bbox The face bounding box
+ * @param [out] pixels The crop
+ */
+static void tracker__crop_face(const struct tracker__frame* frame, const struct tracker_bbox* bbox,
+  unsigned char* pixels) {
+  const unsigned char* data = (const unsigned char*) frame->buf->data;
+
+  for (int y = 0; y < TRACKER_FACE_SIZE; ++y) {
+    int src_y = bbox->bbox_y + (int) ((long long) (2 * y + 1) * bbox->bbox_h / (2 * TRACKER_FACE_SIZE));
+    src_y = src_y < 0 ? 0 : src_y >= frame->height ? frame->height - 1 : src_y;
+    const unsigned char* row = data + (size_t) src_y * (size_t) frame->width * 3;
+
+    for (int x = 0; x < TRACKER_FACE_SIZE; ++x) {
+      int src_x = bbox->bbox_x + (int) ((long long) (2 * x + 1) * bbox->bbox_w / (2 * TRACKER_FACE_SIZE));
+      src_x = src_x < 0 ? 0 : src_x >= frame->width ? frame->width - 1 : src_x;
+
+      memcpy(pixels, row + (size_t) src_x * 3, 3);
+      pixels += 3;
+    }
+  }
+}
+
+/**
+ * Find the crop slot for a track.
+ *
+ * This is the track's own slot if it has one, or else the slot holding the
+ * oldest crop. The face crop mutex must be held.
+ *
+ * @param self The face tracker
+ * @param number The track number
+ * @return The slot
+ */
+static struct tracker__face* tracker__face_slot(struct tracker* self, int number) {
+  struct tracker__face* oldest = &self->faces[0];
+
+  for (int i = 0; i < TRACKER_MAX_TRACKS; ++i) {
+    struct tracker__face* face = &self->faces[i];
+    if (face->track == number) {
+      return face;
+    }
+    if (face->timestamp < oldest->timestamp) {
+      oldest = face;
+    }
+  }
+
+  return oldest;
+}
+
 /**
  * Carry out a recognition iteration.
  *
  * @param self The face tracker
  */
 static void tracker__do_recognition(struct tracker* self) {
-  // Sleep for a bit, as this thread gets a lot of downtime
-  nanosleep(&(struct timespec) {0, 1000000}, NULL);
+  // Take the newest frame from detection, if there is one
+  struct tracker__frame frame;
+
+  // Lock the recognition mutex
+  LOCKPROF_MUTEX_LOCK(&self->recognition_mutex, "recognition_mutex");
+
+  int pending = self->recognition_pending;
+  if (pending) {
+    frame = self->recognition_frame;
+    self->recognition_frame.buf = NULL;
+    self->recognition_pending = 0;
+  }
+
+  // Unlock the recognition mutex
+  LOCKPROF_MUTEX_UNLOCK(&self->recognition_mutex);
+
+  if (!pending) {
+    // Sleep for a bit, as this thread gets a lot of downtime
+    nanosleep(&(struct timespec) {0, 1000000}, NULL);
+    return;
+  }
+
+  trace_begin("tracker__do_recognition");
+
+  // Lock the face crop mutex
+  LOCKPROF_MUTEX_LOCK(&self->face_mutex, "face_mutex");
+
+  // Crop the tracked faces straight out of the frame, which stays put until we let go of it
+  // Identifying them is up to the embedding model reading the crops (see tracker_read_face)
+  for (int i = 0; i < frame.face_count; ++i) {
+    if (frame.face_tracks[i] < 0) {
+      continue;
+    }
+
+    struct tracker__face* face = tracker__face_slot(self, frame.face_tracks[i]);
+    face->track = frame.face_tracks[i];
+    face->timestamp = frame.timestamp;
+    tracker__crop_face(&frame, &frame.face_bboxes[i], face->pixels);
+  }
+
+  // Unlock the face crop mutex
+  LOCKPROF_MUTEX_UNLOCK(&self->face_mutex);
+
+  // Let go of the frame
+  // The buffer goes back to the pool unless detection is still on it
+  framepool_release(frame.buf);
+
+  trace_end();
 }
 
 static void* tracker__thd_detection_main(void* arg) {
   struct tracker* self = arg;
 
+  // Take our place before the warm-up, so it warms the caches we will run on
+  affinity_apply(affinity_role_detection, "cz-detect");
+
   LOGI("Tracker {} detection is online", _ul((size_t) self));
 
+  // Get the detector up to speed before the first real frame
+  tracker__warm_up(self);
+
   // The detection loop
   do {
     // If kill switch is set, break the loop
@@ -233,6 +1408,8 @@ static void* tracker__thd_detection_main(void* arg) {
 static void* tracker__thd_recognition_main(void* arg) {
   struct tracker* self = arg;
 
+  affinity_apply(affinity_role_recognition, "cz-recog");
+
   LOGI("Tracker {} recognition is online", _ul((size_t) self));
 
   // The recognition loop
@@ -249,62 +1426,375 @@ static void* tracker__thd_recognition_main(void* arg) {
   return NULL;
 }
 
+const struct tracker_track* tracker_get_track(struct tracker* self, int number) {
+  const struct tracker_track* track = NULL;
+
+  // Lock the track mutex
+  LOCKPROF_MUTEX_LOCK(&self->track_mutex, "track_mutex");
+
+  for (int t = 0; t < TRACKER_MAX_TRACKS; ++t) {
+    if (self->tracks[t].active && self->tracks[t].number == number) {
+      track = &self->tracks[t];
+      break;
+    }
+  }
+
+  // Unlock the track mutex
+  LOCKPROF_MUTEX_UNLOCK(&self->track_mutex);
+
+  return track;
+}
+
+int tracker_read_face(struct tracker* self, int number, unsigned char* pixels, long long* timestamp) {
+  int found = 0;
+
+  // Lock the face crop mutex
+  LOCKPROF_MUTEX_LOCK(&self->face_mutex, "face_mutex");
+
+  for (int i = 0; i < TRACKER_MAX_TRACKS; ++i) {
+    // Unused slots have track number zero, which no track has
+    const struct tracker__face* face = &self->faces[i];
+    if (number > 0 && face->track == number) {
+      memcpy(pixels, face->pixels, sizeof face->pixels);
+      if (timestamp) {
+        *timestamp = face->timestamp;
+      }
+      found = 1;
+      break;
+    }
+  }
+
+  // Unlock the face crop mutex
+  LOCKPROF_MUTEX_UNLOCK(&self->face_mutex);
+
+  return !found;
+}
+
 void tracker_poll_acquire(struct tracker* self, struct tracker_event_acquire** evt) {
-  *evt = NULL;
+  struct tracker_event_record rec;
+  if (!tracker__take_event(self, tracker_event_type_acquire, 0, &rec)) {
+    *evt = NULL;
+    return;
+  }
+
+  struct tracker_event_acquire* acquire = tracker__event_new(tracker_event_type_acquire);
+  acquire->track = rec.track;
+  acquire->bbox = rec.bbox;
+  *evt = acquire;
 }
 
 void tracker_poll_lose(struct tracker* self, struct tracker_event_lose** evt) {
-  *evt = NULL;
+  tracker_poll_track_lose(self, 0, evt);
 }
 
 void tracker_poll_track_move(struct tracker* self, int track, struct tracker_event_move** evt) {
-  *evt = NULL;
+  struct tracker_event_record rec;
+  if (!tracker__take_event(self, tracker_event_type_move, track, &rec)) {
+    *evt = NULL;
+    return;
+  }
+
+  struct tracker_event_move* move = tracker__event_new(tracker_event_type_move);
+  move->track = rec.track;
+  move->bbox_new = rec.bbox;
+  move->bbox_old = rec.bbox_old;
+  *evt = move;
 }
 
 void tracker_poll_track_identity(struct tracker* self, int track, struct tracker_event_identity** evt) {
-  *evt = NULL;
+  struct tracker_event_record rec;
+  if (!tracker__take_event(self, tracker_event_type_identity, track, &rec)) {
+    *evt = NULL;
+    return;
+  }
+
+  // The record has no room for the embedding, so take it from the track
+  struct tracker_event_identity* identity = tracker__event_new(tracker_event_type_identity);
+  identity->track = rec.track;
+  identity->registration = rec.registration;
+  identity->confidence = rec.confidence;
+  identity->version = rec.version;
+  identity->timestamp = rec.bbox.timestamp;
+
+  const struct tracker_track* t = tracker_get_track(self, rec.track);
+  if (t) {
+    memcpy(identity->identity, t->identity, sizeof(tracker_identity));
+  } else {
+    memset(identity->identity, 0, sizeof(tracker_identity));
+  }
+
+  *evt = identity;
 }
 
 void tracker_poll_track_lose(struct tracker* self, int track, struct tracker_event_lose** evt) {
-  *evt = NULL;
+  struct tracker_event_record rec;
+  if (!tracker__take_event(self, tracker_event_type_lose, track, &rec)) {
+    *evt = NULL;
+    return;
+  }
+
+  struct tracker_event_lose* lose = tracker__event_new(tracker_event_type_lose);
+  lose->track = rec.track;
+  lose->timestamp = rec.bbox.timestamp;
+  *evt = lose;
 }
 
-void tracker_submit_frame(struct tracker* self, int width, int height, char* data) {
-  // Lock the frame mutex
-  pthread_mutex_lock(&self->frame_mutex);
+void tracker_event_retain(const void* evt) {
+  __atomic_add_fetch(&tracker__event_header(evt)->refs, 1, __ATOMIC_RELAXED);
+}
+
+void tracker_event_release(const void* evt) {
+  if (!evt) {
+    return;
+  }
+
+  // Give the object back to its slab with the last reference
+  struct tracker__event_header* header = tracker__event_header(evt);
+  if (__atomic_sub_fetch(&header->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    slab_free(header->slab, header);
+  }
+}
+
+size_t tracker_pending_events(struct tracker* self) {
+  // Lock the event mutex
+  LOCKPROF_MUTEX_LOCK(&self->event_mutex, "event_mutex");
+
+  size_t count = self->event_count + self->event_move_count;
+
+  // Unlock the event mutex
+  LOCKPROF_MUTEX_UNLOCK(&self->event_mutex);
+
+  return count;
+}
+
+size_t tracker_drain_events(struct tracker* self, struct tracker_event_record* events, size_t max) {
+  // Lock the event mutex
+  LOCKPROF_MUTEX_LOCK(&self->event_mutex, "event_mutex");
+
+  // Put the pending moves in sequence order (there are only a few)
+  struct tracker_event_record* moves[TRACKER_MAX_TRACKS];
+  size_t num_moves = 0;
+  for (int t = 0; t < TRACKER_MAX_TRACKS; ++t) {
+    if (self->event_moves[t].seq) {
+      size_t i = num_moves++;
+      for (; i > 0 && moves[i - 1]->seq > self->event_moves[t].seq; --i) {
+        moves[i] = moves[i - 1];
+      }
+      moves[i] = &self->event_moves[t];
+    }
+  }
+
+  // Merge them with the ring
+  size_t num = 0;
+  size_t next_move = 0;
+  while (num < max) {
+    const struct tracker_event_record* oldest = self->event_span ? &self->events[self->event_head] : NULL;
+    if (next_move < num_moves && (!oldest || moves[next_move]->seq < oldest->seq)) {
+      events[num++] = *moves[next_move];
+      moves[next_move++]->seq = 0;
+      --self->event_move_count;
+    } else if (oldest) {
+      events[num++] = *oldest;
+      tracker__pop_event(self);
+      --self->event_count;
+    } else {
+      break;
+    }
+  }
 
-  // Old and new frame sizes
-  size_t size_old = (size_t) (3 * self->frame_width * self->frame_height);
-  size_t size_new = (size_t) (3 * width * height);
+  // Unlock the event mutex
+  LOCKPROF_MUTEX_UNLOCK(&self->event_mutex);
 
-  // If this frame submission changes the frame size
-  if (size_old != size_new) {
-    LOGI("The frame size is changing");
-    LOGI("Old size: {} by {}", _i(self->frame_width), _i(self->frame_height));
-    LOGI("New size: {} by {}", _i(width), _i(height));
+  return num;
+}
+
+void tracker_submit_frame(struct tracker* self, int width, int height, char* data, long long timestamp) {
+  trace_begin("tracker_submit_frame");
+
+  // Get the frame buffer
+  char* frame = tracker_lock_frame(self, width, height, timestamp);
+  if (frame) {
+    // Submit the frame by copy
+    memcpy(frame, data, (size_t) 3 * width * height);
+
+    tracker_unlock_frame(self, 1);
+  }
+
+  trace_end();
+}
+
+char* tracker_lock_frame(struct tracker* self, int width, int height, long long timestamp) {
+  // Lock the fill mutex
+  // This only keeps other producers out, so detection carries on meanwhile
+  LOCKPROF_MUTEX_LOCK(&self->fill_mutex, "fill_mutex");
+
+  // A stopped tracker has nowhere to put the frame
+  LOCKPROF_MUTEX_LOCK(&self->frame_mutex, "frame_mutex");
+  int stopped = self->stopped;
+  LOCKPROF_MUTEX_UNLOCK(&self->frame_mutex);
+
+  if (stopped) {
+    // Unlock the fill mutex
+    LOCKPROF_MUTEX_UNLOCK(&self->fill_mutex);
+
+    return NULL;
+  }
+
+  // Make room for the frame in the spare buffer
+  // This is a no-op unless the frame outgrows the buffer
+  tracker__reserve(&self->frame_spare, (size_t) 3 * width * height);
+
+  self->fill_width = width;
+  self->fill_height = height;
+  self->fill_timestamp = timestamp ? timestamp : (long long) tracker__now_ns();
+
+  return self->frame_spare->data;
+}
 
-    // Reallocate the frame data array for the new size
-    // Using realloc(3) here would look prettier, but it might unnecessarily copy
-    free(self->frame_data);
-    free(self->frame_data_secondary);
-    self->frame_data = malloc(size_new);
-    self->frame_data_secondary = malloc(size_new);
+void tracker_unlock_frame(struct tracker* self, int submit) {
+  // An abandoned frame never reached the frame data, so whatever is pending stays pending
+  if (submit) {
+    // Lock the frame mutex
+    LOCKPROF_MUTEX_LOCK(&self->frame_mutex, "frame_mutex");
+
+    if (!self->stopped) {
+      // If this frame submission changes the frame size
+      if (self->fill_width != self->frame_width || self->fill_height != self->frame_height) {
+        LOGI("The frame size is changing");
+        LOGI("Old size: {} by {}", _i(self->frame_width), _i(self->frame_height));
+        LOGI("New size: {} by {}", _i(self->fill_width), _i(self->fill_height));
+      }
+
+      // A frame detection never got to is about to be replaced
+      if (self->frame_flag) {
+        __atomic_add_fetch(&self->stats.frames_dropped, 1, __ATOMIC_RELAXED);
+      }
+
+      // Swap the filled-in buffer in
+      // The old frame data becomes the spare for the next frame
+      struct framepool_buffer* filled = self->frame_spare;
+      self->frame_spare = self->frame_data;
+      self->frame_data = filled;
+
+      self->frame_width = self->fill_width;
+      self->frame_height = self->fill_height;
+      self->frame_timestamp = self->fill_timestamp;
+
+      // Set the frame flag
+      self->frame_flag = 1;
+    }
 
-    // Recreate spdyface image for secondary frame data
-    // This keeps a pointer to the tracker's objective image
-    // Since we keep this image around for a long time, this is safe
-    sfCozmoImageDestroy(self->sf_image);
-    sfCozmoImageCreate(&self->sf_image, width, height, self->frame_data_secondary);
+    // Unlock the frame mutex
+    LOCKPROF_MUTEX_UNLOCK(&self->frame_mutex);
   }
 
-  // Submit the frame by copy
-  self->frame_width = width;
-  self->frame_height = height;
-  memcpy(self->frame_data, data, size_new);
+  // Unlock the fill mutex
+  LOCKPROF_MUTEX_UNLOCK(&self->fill_mutex);
+}
+
+int tracker_attach_ring(struct tracker* self, const char* name, unsigned int num_slots, size_t slot_size) {
+  int rc = 1;
+
+  // Lock the frame mutex
+  LOCKPROF_MUTEX_LOCK(&self->frame_mutex, "frame_mutex");
+
+  if (self->stopped) {
+    LOGE("Tracker {} is stopped and cannot take a frame ring", _ul((size_t) self));
+  } else if (self->ring) {
+    LOGE("Tracker {} already has a frame ring", _ul((size_t) self));
+  } else {
+    struct framering* ring = framering_create(name, num_slots, slot_size);
+    if (ring) {
+      LOGI("Tracker {} is reading frames from shared memory {}", _ul((size_t) self), _str(name));
+      __atomic_store_n(&self->ring, ring, __ATOMIC_RELEASE);
+      rc = 0;
+    } else {
+      LOGE("Unable to create frame ring {}: {}", _str(name), _str(strerror(errno)));
+    }
+  }
 
   // Unlock the frame mutex
-  pthread_mutex_unlock(&self->frame_mutex);
+  LOCKPROF_MUTEX_UNLOCK(&self->frame_mutex);
 
-  // Set the frame flag
-  self->frame_flag = 1;
+  return rc;
 }
+
+int tracker_frame_pending(struct tracker* self) {
+  // Lock the frame mutex
+  LOCKPROF_MUTEX_LOCK(&self->frame_mutex, "frame_mutex");
+
+  int pending = self->frame_flag || __atomic_load_n(&self->frame_busy, __ATOMIC_ACQUIRE);
+
+  // Unlock the frame mutex
+  LOCKPROF_MUTEX_UNLOCK(&self->frame_mutex);
+
+  return pending;
+}
+
+void tracker_set_deadline(struct tracker* self, long long deadline_ns) {
+  __atomic_store_n(&self->deadline_ns, deadline_ns > 0 ? deadline_ns : 0, __ATOMIC_RELAXED);
+}
+
+long long tracker_get_deadline(struct tracker* self) {
+  return __atomic_load_n(&self->deadline_ns, __ATOMIC_RELAXED);
+}
+
+int tracker_wants_frame(struct tracker* self) {
+  // Lock the frame mutex
+  LOCKPROF_MUTEX_LOCK(&self->frame_mutex, "frame_mutex");
+
+  int wants = !self->stopped && !self->frame_flag;
+
+  // Unlock the frame mutex
+  LOCKPROF_MUTEX_UNLOCK(&self->frame_mutex);
+
+  return wants;
+}
+
+void tracker_get_stats(struct tracker* self, struct tracker_stats* stats) {
+  stats->frames = __atomic_load_n(&self->stats.frames, __ATOMIC_RELAXED);
+  stats->frames_dropped = __atomic_load_n(&self->stats.frames_dropped, __ATOMIC_RELAXED)
+    + __atomic_load_n(&self->ring_dropped, __ATOMIC_RELAXED);
+  stats->frames_stale = __atomic_load_n(&self->stats.frames_stale, __ATOMIC_RELAXED);
+  __atomic_load(&self->stats.fps, &stats->fps, __ATOMIC_RELAXED);
+  stats->faces = __atomic_load_n(&self->stats.faces, __ATOMIC_RELAXED);
+  stats->faces_total = __atomic_load_n(&self->stats.faces_total, __ATOMIC_RELAXED);
+  stats->copy_ns = __atomic_load_n(&self->stats.copy_ns, __ATOMIC_RELAXED);
+  stats->detect_ns = __atomic_load_n(&self->stats.detect_ns, __ATOMIC_RELAXED);
+  stats->track_ns = __atomic_load_n(&self->stats.track_ns, __ATOMIC_RELAXED);
+}
+
+int tracker_ready(struct tracker* self) {
+  return __atomic_load_n(&self->ready, __ATOMIC_ACQUIRE);
+}
+
+void tracker_set_state(struct tracker* self, struct state_robot* slot) {
+  // Lock the frame mutex
+  LOCKPROF_MUTEX_LOCK(&self->frame_mutex, "frame_mutex");
+
+  self->state = slot;
+
+  // Unlock the frame mutex
+  LOCKPROF_MUTEX_UNLOCK(&self->frame_mutex);
+}
+
+void tracker_on_start(struct service* svc) {
+  LOGI("Tracker service started");
+
+  // Load a detector before the first robot shows up
+  // It waits idle in the model cache until a tracker takes it
+  models_release_detector(models_acquire_detector());
+}
+
+void tracker_on_stop(struct service* svc) {
+  LOGI("Tracker service stopping");
+
+  // Unload the idle detectors
+  models_flush_detectors();
+}
+
+struct service tracker_service = {
+  .name = "tracker",
+  .on_start = &tracker_on_start,
+  .on_stop = &tracker_on_stop,
+};
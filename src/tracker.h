@@ -6,6 +6,8 @@
 #ifndef TRACKER_H
 #define TRACKER_H
 
+#include <stddef.h>
+
 /**
  * A tracked identity.
  *
@@ -14,6 +16,12 @@
  */
 typedef double tracker_identity[128];
 
+/** The maximum number of simultaneous face tracks. */
+#define TRACKER_MAX_TRACKS 24
+
+/** The width and height of the face crops handed out by tracker_read_face(). */
+#define TRACKER_FACE_SIZE 112
+
 /** A track bounding box. */
 struct tracker_bbox {
   /** The bounding box top-left x-coordinate. */
@@ -27,6 +35,35 @@ struct tracker_bbox {
 
   /** The bounding box height. */
   int bbox_h;
+
+  /** The capture time of the frame the box was found in (nanoseconds on the monotonic clock). */
+  long long timestamp;
+};
+
+/**
+ * A face track.
+ *
+ * Tracks live in tracker-owned memory, and the tracker updates them in place
+ * as their faces move and are identified. The memory stays valid for as long
+ * as the tracker does, but the slot is reused for a new track after this one
+ * is lost, so check the number before trusting the contents. Readers on other
+ * threads may observe a partially-updated track.
+ */
+struct tracker_track {
+  /** The track number. Numbers start at one and are never reused. */
+  int number;
+
+  /** Nonzero while the track is active. */
+  int active;
+
+  /** The current bounding box (its timestamp is when the face was last seen). */
+  struct tracker_bbox bbox;
+
+  /** The latest identity. */
+  tracker_identity identity;
+
+  /** The confidence score for the latest identity. */
+  float confidence;
 };
 
 /**
@@ -51,6 +88,12 @@ struct tracker_event_acquire {
 struct tracker_event_lose {
   /** The track number. */
   int track;
+
+  /**
+   * The capture time of the frame the track was lost in, or of the frame it
+   * was last seen in if the tracker stopped (nanoseconds on the monotonic clock).
+   */
+  long long timestamp;
 };
 
 /**
@@ -89,15 +132,107 @@ struct tracker_event_identity {
 
   /** The identity version. Increments for each update. */
   int version;
+
+  /** The capture time of the frame the identity came from (nanoseconds on the monotonic clock). */
+  long long timestamp;
+};
+
+/** A tracker event type. */
+enum tracker_event_type {
+  tracker_event_type_acquire,
+  tracker_event_type_lose,
+  tracker_event_type_move,
+  tracker_event_type_identity,
+};
+
+/**
+ * A tracker event record.
+ *
+ * This is the fixed-size form of every event type, as handed out in bulk by
+ * tracker_drain_events(). Records are exactly 80 bytes with no implicit
+ * padding, so an array of them can be handed to Python as-is. Fields that do
+ * not apply to a record's type are zero, except that the bounding box
+ * timestamp always holds the capture time of the frame behind the event.
+ * Identity records do not carry the embedding itself; read it from the track
+ * (see tracker_get_track()).
+ */
+struct tracker_event_record {
+  /** The event sequence number. Numbers start at one and increase by one. */
+  unsigned long long seq;
+
+  /** The event type (an enum tracker_event_type). */
+  int type;
+
+  /** The track number. */
+  int track;
+
+  /** The bounding box (the new one for move events). */
+  struct tracker_bbox bbox;
+
+  /** The old bounding box (move events). */
+  struct tracker_bbox bbox_old;
+
+  /** The corresponding registration (identity events). */
+  int registration;
+
+  /** The confidence score for the identification (identity events). */
+  float confidence;
+
+  /** The identity version (identity events). */
+  int version;
+
+  /** Reserved. */
+  int reserved;
+};
+
+/**
+ * Tracker counters.
+ *
+ * These only ever go up, except for the rate and the last face count. Stage
+ * times add up over all processed frames.
+ */
+struct tracker_stats {
+  /** The number of frames processed. */
+  unsigned long long frames;
+
+  /** The number of frames replaced or skipped before detection got to them. */
+  unsigned long long frames_dropped;
+
+  /** The number of frames dropped for being older than the deadline (see tracker_set_deadline). */
+  unsigned long long frames_stale;
+
+  /** The smoothed detection rate in frames per second. */
+  double fps;
+
+  /** The number of faces in the last processed frame. */
+  int faces;
+
+  /** The number of faces over all processed frames. */
+  unsigned long long faces_total;
+
+  /** The time spent copying frames for detection in nanoseconds. */
+  unsigned long long copy_ns;
+
+  /** The time spent detecting faces (including waiting on the shared detector) in nanoseconds. */
+  unsigned long long detect_ns;
+
+  /** The time spent updating tracks and publishing results in nanoseconds. */
+  unsigned long long track_ns;
 };
 
 /** A face tracker. */
 struct tracker;
 
+/** A service definition. */
+struct service;
+
+/** A robot slot in the shared-memory state segment. */
+struct state_robot;
+
 /**
  * Create a face tracker.
  *
- * @return The face tracker
+ * @return The face tracker, or NULL if its threads could not be spawned
  */
 struct tracker* tracker_new();
 
@@ -108,13 +243,51 @@ struct tracker* tracker_new();
  */
 void tracker_delete(struct tracker* self);
 
+/**
+ * Stop a tracker.
+ *
+ * This shuts down the tracker threads and frees the frame buffers and the
+ * detector. All active tracks are lost. The tracker itself stays allocated, so
+ * tracks and events remain readable, but further frames are ignored. Stopping
+ * a stopped tracker does nothing.
+ *
+ * @param self The face tracker
+ */
+void tracker_stop(struct tracker* self);
+
+/**
+ * Look up an active track.
+ *
+ * @param self The face tracker
+ * @param number The track number
+ * @return The track, or NULL if no such track is active
+ */
+const struct tracker_track* tracker_get_track(struct tracker* self, int number);
+
+/**
+ * Read the newest face crop of a track.
+ *
+ * The recognition thread crops every tracked face out of the newest frame with
+ * faces in it, scaled to TRACKER_FACE_SIZE pixels square, in the same
+ * interleaved RGB8 format as camera frames. This copies out the newest crop of
+ * a track, for an embedding model to identify.
+ *
+ * @param self The face tracker
+ * @param number The track number
+ * @param [out] pixels The crop (3 * TRACKER_FACE_SIZE * TRACKER_FACE_SIZE bytes)
+ * @param [out] timestamp The capture time of the frame behind the crop (nullable)
+ * @return Zero on success, otherwise nonzero if the track has no crop
+ */
+int tracker_read_face(struct tracker* self, int number, unsigned char* pixels, long long* timestamp);
+
 /**
  * Poll for a global track-acquire event.
  *
- * This is a nonblocking call.
+ * This is a nonblocking call. Like every polled event, the event comes with a
+ * reference owned by the caller, or is NULL if there is no such event.
  *
  * @param self The face tracker
- * @param [out] evt The event
+ * @param [out] evt The event (release with tracker_event_release)
  */
 void tracker_poll_acquire(struct tracker* self, struct tracker_event_acquire** evt);
 
@@ -124,16 +297,20 @@ void tracker_poll_acquire(struct tracker* self, struct tracker_event_acquire** e
  * This is a nonblocking call.
  *
  * @param self The face tracker
- * @param [out] evt The event
+ * @param [out] evt The event (release with tracker_event_release)
  */
 void tracker_poll_lose(struct tracker* self, struct tracker_event_lose** evt);
 
 /**
  * Poll for a local track-move event.
  *
+ * A track has at most one move event pending. Moves made while it waits are
+ * folded into it, so it runs from the box at its own sequence number to the
+ * newest box.
+ *
  * @param self The face tracker
  * @param track The track number
- * @param [out] evt The event
+ * @param [out] evt The event (release with tracker_event_release)
  */
 void tracker_poll_track_move(struct tracker* self, int track, struct tracker_event_move** evt);
 
@@ -142,7 +319,7 @@ void tracker_poll_track_move(struct tracker* self, int track, struct tracker_eve
  *
  * @param self The face tracker
  * @param track The track number
- * @param [out] evt The event
+ * @param [out] evt The event (release with tracker_event_release)
  */
 void tracker_poll_track_identity(struct tracker* self, int track, struct tracker_event_identity** evt);
 
@@ -153,10 +330,54 @@ void tracker_poll_track_identity(struct tracker* self, int track, struct tracker
  *
  * @param self The face tracker
  * @param track The track number
- * @param [out] evt The event
+ * @param [out] evt The event (release with tracker_event_release)
  */
 void tracker_poll_track_lose(struct tracker* self, int track, struct tracker_event_lose** evt);
 
+/**
+ * Count the pending events.
+ *
+ * @param self The face tracker
+ * @return The number of pending events
+ */
+size_t tracker_pending_events(struct tracker* self);
+
+/**
+ * Take another reference to a polled event.
+ *
+ * Events live in per-type slab pools shared by all trackers. A reference can
+ * be handed to another thread, which then releases it on its own.
+ *
+ * @param evt The event
+ */
+void tracker_event_retain(const void* evt);
+
+/**
+ * Release a reference to a polled event.
+ *
+ * The event goes back to its pool with the last reference.
+ *
+ * @param evt The event (nullable)
+ */
+void tracker_event_release(const void* evt);
+
+/**
+ * Drain pending events in bulk.
+ *
+ * This removes up to max of the oldest pending events and copies them out in
+ * sequence order. It is a nonblocking call. Acquire, lose and identity events
+ * share one bounded queue; if nobody drains or polls it, the oldest events are
+ * dropped to make room, which shows up as a gap in the sequence numbers. Move
+ * events are folded per track instead (see tracker_poll_track_move()), so
+ * they never crowd out the others.
+ *
+ * @param self The face tracker
+ * @param [out] events The events
+ * @param max The capacity of events
+ * @return The number of events written
+ */
+size_t tracker_drain_events(struct tracker* self, struct tracker_event_record* events, size_t max);
+
 /**
  * Submit a camera frame for tracking.
  *
@@ -176,11 +397,151 @@ void tracker_poll_track_lose(struct tracker* self, int track, struct tracker_eve
  *
  * In the diagram above, each R, G, and B is an eight-bit char.
  *
+ * The capture time follows the frame into its results and events. It should
+ * be taken as close to the camera as possible; if it is unknown, the time of
+ * submission stands in for it.
+ *
  * @param self The face tracker
  * @param width The frame width
  * @param height The frame height
  * @param data The frame data
+ * @param timestamp The capture time in nanoseconds on the monotonic clock (or zero)
+ */
+void tracker_submit_frame(struct tracker* self, int width, int height, char* data, long long timestamp);
+
+/**
+ * Lock the frame buffer to fill in a frame in place.
+ *
+ * This is the zero-copy form of tracker_submit_frame(). The buffer is sized
+ * for an RGB24 frame of the given size, laid out as for tracker_submit_frame().
+ * Every successful lock must be followed by tracker_unlock_frame(). The buffer
+ * is a spare that only becomes the tracker's frame when it is submitted, so
+ * detection carries on with the previous frame while this one is filled in.
+ * Other producers wait for the unlock, though.
+ *
+ * @param self The face tracker
+ * @param width The frame width
+ * @param height The frame height
+ * @param timestamp The capture time in nanoseconds on the monotonic clock (or zero)
+ * @return The frame buffer, or NULL if the tracker is stopped
+ */
+char* tracker_lock_frame(struct tracker* self, int width, int height, long long timestamp);
+
+/**
+ * Unlock the frame buffer.
+ *
+ * @param self The face tracker
+ * @param submit Nonzero to submit the frame, or zero to abandon it
+ */
+void tracker_unlock_frame(struct tracker* self, int submit);
+
+/**
+ * Read frames from a shared-memory frame ring.
+ *
+ * This creates a frame ring (see framering.h) for a capture process to write
+ * into. From then on, the detection thread works on the newest frame in the
+ * ring in place, without a copy. Frames submitted directly still take
+ * precedence. The ring is closed when the tracker stops.
+ *
+ * @param self The face tracker
+ * @param name The segment name
+ * @param num_slots The number of slots
+ * @param slot_size The data capacity of each slot
+ * @return Zero on success, otherwise nonzero
+ */
+int tracker_attach_ring(struct tracker* self, const char* name, unsigned int num_slots, size_t slot_size);
+
+/**
+ * Check whether a submitted frame is still being worked on.
+ *
+ * A frame is pending from its submission until detection results for it are
+ * in. A driver that must not skip frames waits for this to clear before it
+ * submits the next one.
+ *
+ * @param self The face tracker
+ * @return Nonzero if a frame is pending, otherwise zero
  */
-void tracker_submit_frame(struct tracker* self, int width, int height, char* data);
+int tracker_frame_pending(struct tracker* self);
+
+/**
+ * Check whether the tracker wants another frame.
+ *
+ * The tracker wants a frame while no submitted frame is waiting for detection
+ * to get to it. A frame submitted while another one waits replaces it, so a
+ * producer that checks this first can skip capturing, decoding, and copying
+ * frames the detector would never see. Submitting while detection works on
+ * the previous frame is fine, as the next frame is then ready the moment
+ * detection is.
+ *
+ * @param self The face tracker
+ * @return Nonzero if the tracker wants a frame, otherwise zero
+ */
+int tracker_wants_frame(struct tracker* self);
+
+/**
+ * Set the frame latency deadline.
+ *
+ * Frames older than the deadline when detection gets to them are dropped
+ * before they are copied or detected, so results always describe what the
+ * camera saw recently, even after a stall. Frames from the frame ring are held
+ * to the same deadline. New trackers take their deadline from the
+ * COZMONAUT_FRAME_DEADLINE_MS environment variable, or have none.
+ *
+ * @param self The face tracker
+ * @param deadline_ns The deadline in nanoseconds (or zero for none)
+ */
+void tracker_set_deadline(struct tracker* self, long long deadline_ns);
+
+/**
+ * Get the frame latency deadline.
+ *
+ * @param self The face tracker
+ * @return The deadline in nanoseconds (or zero for none)
+ */
+long long tracker_get_deadline(struct tracker* self);
+
+/**
+ * Read the tracker counters.
+ *
+ * This takes no locks and can be called from any thread. Each counter is read
+ * atomically, but the set as a whole is not a consistent snapshot.
+ *
+ * @param self The face tracker
+ * @param [out] stats The counters
+ */
+void tracker_get_stats(struct tracker* self, struct tracker_stats* stats);
+
+/**
+ * Check whether a tracker is ready.
+ *
+ * A new tracker warms up its detector on synthetic frames before it reports
+ * ready. Frames submitted in the meantime are processed once warm-up ends.
+ *
+ * @param self The face tracker
+ * @return Nonzero if the tracker is ready, otherwise zero
+ */
+int tracker_ready(struct tracker* self);
+
+/**
+ * Publish tracker results to a shared-memory state slot.
+ *
+ * After each processed frame, the detection thread writes the face count,
+ * bounding boxes, and detection rate into the slot.
+ *
+ * @param self The face tracker
+ * @param slot The state slot (nullable)
+ */
+void tracker_set_state(struct tracker* self, struct state_robot* slot);
+
+/**
+ * The tracker service.
+ *
+ * This loads a face detector when it starts for the first tracker to take,
+ * so adding a robot does not have to wait for one to load.
+ */
+extern struct service tracker_service;
+
+/** The tracker service, for service lists and dependencies. */
+#define SERVICE_TRACKER (&tracker_service)
 
 #endif // #ifndef TRACKER_H
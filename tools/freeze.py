@@ -0,0 +1,131 @@
+#
+# Cozmonaut
+# Copyright 2019 The Cozmonaut Contributors
+#
+
+"""
+Freeze a Python package into C source.
+
+This compiles every module in a package to bytecode and writes the marshalled
+code objects out as C arrays, along with a table of frozen modules that the
+interpreter can import from without touching the disk.
+
+The bytecode format is specific to the Python version running this script, so
+it must match the version the executable embeds.
+
+Usage: freeze.py <source root> <package> <output file>
+"""
+
+import marshal
+import os
+import sys
+
+
+def find_modules(root, package):
+    """
+    Find the modules in a package.
+
+    :param root: The directory containing the package
+    :param package: The package name
+    :return: A sorted list of (module name, file path, is package) tuples
+    """
+    modules = []
+
+    for dirpath, dirnames, filenames in os.walk(os.path.join(root, package)):
+        # Skip caches and anything that is not a package
+        dirnames[:] = [d for d in dirnames if os.path.isfile(os.path.join(dirpath, d, '__init__.py'))]
+
+        rel = os.path.relpath(dirpath, root)
+        prefix = rel.replace(os.sep, '.')
+
+        for filename in filenames:
+            if not filename.endswith('.py'):
+                continue
+
+            path = os.path.join(dirpath, filename)
+            if filename == '__init__.py':
+                modules.append((prefix, path, True))
+            else:
+                modules.append((prefix + '.' + filename[:-3], path, False))
+
+    return sorted(modules)
+
+
+def c_identifier(name):
+    """
+    Make a C identifier for a module.
+
+    :param name: The module name
+    :return: The identifier
+    """
+    return 'frozen_' + name.replace('.', '_')
+
+
+def c_array(data):
+    """
+    Format bytes as the body of a C array initializer.
+
+    :param data: The bytes
+    :return: The initializer body
+    """
+    lines = []
+    for i in range(0, len(data), 16):
+        lines.append('  ' + ', '.join('%d' % b for b in data[i:i + 16]) + ',')
+    return '\n'.join(lines)
+
+
+def main(argv):
+    if len(argv) != 4:
+        print(__doc__, file=sys.stderr)
+        return 1
+
+    root, package, output = argv[1:]
+    modules = find_modules(root, package)
+
+    out = [
+        '/*',
+        ' * Cozmonaut',
+        ' * Copyright 2019 The Cozmonaut Contributors',
+        ' *',
+        ' * Generated by tools/freeze.py for Python %d.%d. Do not edit.' % sys.version_info[:2],
+        ' */',
+        '',
+        '#include <Python.h>',
+        '',
+        '#if PY_VERSION_HEX >= 0x030B0000',
+        '#define FROZEN(name, code, pkg) {name, code, (int) sizeof(code), pkg}',
+        '#else',
+        '#define FROZEN(name, code, pkg) {name, code, (pkg) ? -(int) sizeof(code) : (int) sizeof(code)}',
+        '#endif',
+        '',
+    ]
+
+    for name, path, is_package in modules:
+        with open(path, 'rb') as f:
+            source = f.read()
+
+        # Compile with a package-relative file name so tracebacks stay readable
+        filename = os.path.relpath(path, root)
+        code = compile(source, filename, 'exec', dont_inherit=True)
+
+        out.append('static const unsigned char %s[] = {' % c_identifier(name))
+        out.append(c_array(marshal.dumps(code)))
+        out.append('};')
+        out.append('')
+
+    out.append('/** The frozen modules. Terminated by an empty entry. */')
+    out.append('const struct _frozen cozmonaut_frozen_modules[] = {')
+    for name, path, is_package in modules:
+        out.append('  FROZEN("%s", %s, %d),' % (name, c_identifier(name), 1 if is_package else 0))
+    out.append('  {0},')
+    out.append('};')
+    out.append('')
+
+    with open(output, 'w') as f:
+        f.write('\n'.join(out))
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,109 @@
+/*
+ * Cozmonaut
+ * Copyright 2019 The Cozmonaut Contributors
+ */
+
+//
+// Telemetry dump
+//
+// This prints the samples in telemetry archives (see src/telemetry.h) as CSV,
+// one line per sample: the file, the timestamp in milliseconds since the
+// epoch, and then the sample values. The archives are the robot-*.tlm files
+// the client writes into COZMONAUT_TELEMETRY_DIR.
+//
+// A time window (-b and -e) only decodes the blocks that overlap it.
+//
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "telemetry.h"
+
+/**
+ * Print a sample.
+ *
+ * @param sample The sample
+ * @param num_values The number of values in the sample
+ * @param user The archive file path
+ * @return Zero to continue scanning
+ */
+static int tlmdump__print(const struct telemetry_sample* sample, int num_values, void* user) {
+  printf("%s,%lld", (const char*) user, sample->timestamp);
+  for (int i = 0; i < num_values; ++i) {
+    printf(",%.17g", sample->values[i]);
+  }
+  putchar('\n');
+
+  return 0;
+}
+
+/**
+ * Parse a timestamp argument.
+ *
+ * @param arg The argument
+ * @param [out] value The timestamp
+ * @return Zero on success, otherwise nonzero
+ */
+static int tlmdump__parse_time(const char* arg, long long* value) {
+  char* end;
+  errno = 0;
+  *value = strtoll(arg, &end, 10);
+  return errno || end == arg || *end;
+}
+
+/**
+ * Print usage.
+ *
+ * @param argv0 The program name
+ */
+static void tlmdump__usage(const char* argv0) {
+  fprintf(stderr,
+    "usage: %s [-b begin_ms] [-e end_ms] archive.tlm...\n"
+    "  -b  skip samples before this timestamp (milliseconds since the epoch)\n"
+    "  -e  skip samples after this timestamp (milliseconds since the epoch)\n",
+    argv0);
+}
+
+int main(int argc, char* argv[]) {
+  long long time_begin = LLONG_MIN;
+  long long time_end = LLONG_MAX;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "b:e:")) != -1) {
+    switch (opt) {
+      case 'b':
+        if (tlmdump__parse_time(optarg, &time_begin)) {
+          tlmdump__usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'e':
+        if (tlmdump__parse_time(optarg, &time_end)) {
+          tlmdump__usage(argv[0]);
+          return 1;
+        }
+        break;
+      default:
+        tlmdump__usage(argv[0]);
+        return 1;
+    }
+  }
+
+  if (optind == argc) {
+    tlmdump__usage(argv[0]);
+    return 1;
+  }
+
+  // Keep going past a bad archive, but report it in the exit code
+  int result = 0;
+  for (int i = optind; i < argc; ++i) {
+    if (telemetry_scan(argv[i], time_begin, time_end, &tlmdump__print, argv[i])) {
+      result = 1;
+    }
+  }
+
+  return result;
+}